@@ -105,12 +105,16 @@ typedef struct {
     char username[64];           /* Authenticated username (if any) */
     bool authenticated;          /* Authentication status */
     bool view_only;              /* Client is view-only */
-    uint64_t connected_time;     /* Connection timestamp */
+    uint64_t connected_time;     /* Connection timestamp (ms) */
     uint64_t bytes_sent;         /* Bytes sent to client */
     uint64_t bytes_received;     /* Bytes received from client */
     uint32_t frames_sent;        /* Video frames sent */
-    double last_activity;        /* Last activity timestamp */
+    double last_activity;        /* Last activity timestamp (ms) */
     char encoding[32];           /* Current encoding (Tight, Raw, etc.) */
+    uint64_t latency_count;      /* Input events measured */
+    double latency_p50_ms;       /* Input to framebuffer update sent */
+    double latency_p95_ms;
+    double latency_p99_ms;
 } x11vnc_client_info_t;
 
 /* Advanced server statistics */
@@ -140,14 +144,24 @@ typedef struct {
     uint64_t clipboard_events;
     
     /* Performance indicators */
-    double cpu_usage_percent;    /* Estimated CPU usage */
-    double memory_usage_mb;      /* Memory usage in MB */
-    int dropped_frames;          /* Frames dropped due to load */
+    double cpu_usage_percent;    /* Process CPU, percent of one core */
+    double memory_usage_mb;      /* Resident set size in MB */
+    int dropped_frames;          /* Screen changes merged into a later update */
     
     /* Network statistics */
     double bandwidth_in_kbps;    /* Incoming bandwidth */
     double bandwidth_out_kbps;   /* Outgoing bandwidth */
-    int compression_ratio;       /* Average compression ratio */
+    int compression_ratio;       /* Raw bytes / encoded bytes sent */
+    
+    /* Poll timing (new fields go last so older ones keep their offsets) */
+    double scan_time_ms;         /* Mean framebuffer poll time */
+    double scan_time_max_ms;     /* Slowest poll in the last interval */
+    
+    /* Input to framebuffer update latency, all clients */
+    uint64_t latency_count;      /* Input events measured */
+    double latency_p50_ms;
+    double latency_p95_ms;
+    double latency_p99_ms;
     
 } x11vnc_advanced_stats_t;
 
@@ -0,0 +1,112 @@
+/*
+ * x11vnc_shmfb.h - Damage header for -rawfb shm: and map: framebuffers
+ *
+ * Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com>
+ * All rights reserved.
+ *
+ * A program rendering into a shared memory segment (or a file that
+ * x11vnc maps) can put this header at the start of it and post the
+ * rectangles it draws, so x11vnc reads them instead of polling the
+ * whole framebuffer for changes.  The pixels follow the header at
+ * header_size bytes; x11vnc skips the header by itself.
+ *
+ * Segment layout:
+ *
+ *     x11vnc_shmfb_header_t                      32 bytes
+ *     x11vnc_shmfb_rect_t rects[ring_size]       16 bytes each
+ *     (padding up to header_size)
+ *     pixels, as given by -rawfb ...@WxHxB
+ *
+ * Producer protocol:
+ *
+ *  - call x11vnc_shmfb_init() once before x11vnc attaches.
+ *  - after drawing a rectangle (its pixels are in the segment) call
+ *    x11vnc_shmfb_damage() for it.
+ *  - after each complete frame call x11vnc_shmfb_frame_done().
+ *
+ * x11vnc only ever reads the segment.  If ring_size or more
+ * rectangles are posted between two of its polls it falls back to
+ * polling the whole framebuffer once and then follows the ring again.
+ */
+
+#ifndef X11VNC_SHMFB_H
+#define X11VNC_SHMFB_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define X11VNC_SHMFB_MAGIC   0x44524658u    /* "XFRD" */
+#define X11VNC_SHMFB_VERSION 1
+
+/* full memory barrier between the pixel/rect stores and the counters */
+#ifndef X11VNC_SHMFB_BARRIER
+#define X11VNC_SHMFB_BARRIER() __sync_synchronize()
+#endif
+
+typedef struct {
+    int32_t x, y, w, h;
+} x11vnc_shmfb_rect_t;
+
+typedef struct {
+    uint32_t magic;             /* X11VNC_SHMFB_MAGIC */
+    uint32_t version;           /* X11VNC_SHMFB_VERSION */
+    uint32_t header_size;       /* bytes from segment start to the pixels */
+    uint32_t ring_size;         /* number of entries in the rect ring */
+    volatile uint64_t frame;    /* frames completed */
+    volatile uint64_t rect_seq; /* rects posted, n-th is at n % ring_size */
+} x11vnc_shmfb_header_t;
+
+/* smallest header_size for a ring of n rectangles */
+#define X11VNC_SHMFB_HEADER_SIZE(n) \
+    (sizeof(x11vnc_shmfb_header_t) + (n) * sizeof(x11vnc_shmfb_rect_t))
+
+/* the rect ring follows the fixed part of the header */
+static inline x11vnc_shmfb_rect_t *x11vnc_shmfb_rects(x11vnc_shmfb_header_t *hdr) {
+    return (x11vnc_shmfb_rect_t *) (hdr + 1);
+}
+
+/*
+ * Set up the header at the start of seg.  header_size may be rounded up
+ * from X11VNC_SHMFB_HEADER_SIZE(ring_size), e.g. to align the pixels.
+ */
+static inline void x11vnc_shmfb_init(void *seg, uint32_t header_size,
+                                     uint32_t ring_size) {
+    x11vnc_shmfb_header_t *hdr = (x11vnc_shmfb_header_t *) seg;
+
+    memset(seg, 0, X11VNC_SHMFB_HEADER_SIZE(ring_size));
+    hdr->version = X11VNC_SHMFB_VERSION;
+    hdr->header_size = header_size;
+    hdr->ring_size = ring_size;
+    X11VNC_SHMFB_BARRIER();
+    hdr->magic = X11VNC_SHMFB_MAGIC;
+}
+
+/* post a rectangle whose pixels have been written */
+static inline void x11vnc_shmfb_damage(x11vnc_shmfb_header_t *hdr,
+                                       int x, int y, int w, int h) {
+    uint64_t seq = hdr->rect_seq;
+    x11vnc_shmfb_rect_t *r = x11vnc_shmfb_rects(hdr) + seq % hdr->ring_size;
+
+    X11VNC_SHMFB_BARRIER();
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+    X11VNC_SHMFB_BARRIER();
+    hdr->rect_seq = seq + 1;
+}
+
+static inline void x11vnc_shmfb_frame_done(x11vnc_shmfb_header_t *hdr) {
+    X11VNC_SHMFB_BARRIER();
+    hdr->frame = hdr->frame + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* X11VNC_SHMFB_H */
@@ -37,6 +37,7 @@ so, delete this exception statement from your version.
 #include "util.h"
 #include "win_utils.h"
 #include "xwrappers.h"
+#include "simd.h"
 
 int multivis_count = 0;
 int multivis_24count = 0;
@@ -66,6 +67,7 @@ static void poll_8bpp_complement(sraRegionPtr);
 static void mark_rgn_rects(sraRegionPtr mod);
 static int get_8bpp_regions(int validate);
 static int get_cmap(int j, Colormap cmap);
+static void check_cmap_events(void);
 static void do_8bpp_region(int n, sraRegionPtr mark);
 static XImage *cmap_xi(XImage *xi, Window win, int win_depth);
 static void transform_rect(sraRect rect, Window win, int win_depth, int cm);
@@ -83,6 +85,7 @@ typedef struct window8 {
 	int fetched;
 	double last_fetched;
 	sraRegionPtr clip_region;
+	Window cmap_sel;	/* ColormapChangeMask selected on it */
 } window8bpp_t;
 
 enum mark_8bpp_modes {
@@ -342,6 +345,7 @@ if (db24 > 2) fprintf(stderr, " check_for_multivis: %.4f\n", now - last_call);
 			windows_8bpp[i].fetched = 0;
 			windows_8bpp[i].last_fetched = -1.0;
 			windows_8bpp[i].clip_region = NULL;
+			windows_8bpp[i].cmap_sel = None;
 		}
 		set_poll_fb();
 
@@ -786,6 +790,13 @@ if (db24 > 1) fprintf(stderr, "multivis: STORE 0x%lx j: %3d ms: %d dep=%d\n", wi
 			windows_8bpp[j].fetched = 1;
 			windows_8bpp[j].last_fetched = dnow();
 
+			if (attr->depth <= 16 && windows_8bpp[j].cmap_sel != win) {
+				/* so check_cmap_events() hears of new colors */
+				XSelectInput_wr(dpy, win, attr->your_event_mask
+				    | ColormapChangeMask);
+				windows_8bpp[j].cmap_sel = win;
+			}
+
 			/* translate x y to be WRT the root window (not parent) */
 			xtranslate(win, window, 0, 0, &x, &y, &w, 1);
 			windows_8bpp[j].x = x;
@@ -853,7 +864,7 @@ static int poll_line(int x1, int x2, int y1, int n, sraRegionPtr mod) {
 #else
 	int fac, n_off, w, xo, yo;
 	char *poll_fb, *dst, *src;
-	int w2, xl, xh, stride = 32;
+	int w2, xl, xh, xe, lo, hi, stride = 32;
 	int inrun = 0, rx1 = -1, rx2 = -1;
 
 	static XImage *xi8 = NULL, *xi24 = NULL, *xi_r;
@@ -955,8 +966,17 @@ if (db24 > 2) fprintf(stderr, "avoid bad match...\n");
 
 	inrun = 0;
 
-	xl = x1;
-	while (xl < x2) {
+	/* only walk the stride chunks between the first and last change */
+	if (! fb_diff_span(dst, src, fac * w, &lo, &hi)) {
+		return 1;
+	}
+	xl = (lo / fac) - (lo / fac) % stride;
+	xe = x1 + (hi / fac) + 1;
+	dst += fac * xl;
+	src += fac * xl;
+	xl += x1;
+
+	while (xl < xe) {
 		xh = xl + stride;
 		if (xh > x2) {
 			xh = x2;
@@ -1364,6 +1384,15 @@ static int cmap_failed[CMAPMAX];
 static int color_init = 0;
 int histo[65536];
 
+/*
+ * rgb[j] is kept between calls and only fetched again when cmaps[j]
+ * changes, a ColormapNotify arrives for it, or it is CMAP_MAX_AGE old:
+ * XStoreColors on a colormap sends no event at all.
+ */
+#define CMAP_MAX_AGE 1.0
+static Colormap rgb_cmap[CMAPMAX];
+static double rgb_time[CMAPMAX];
+
 static int get_cmap(int j, Colormap cmap) {
 #if NO_X11
 	RAWFB_RET(0)
@@ -1372,9 +1401,16 @@ static int get_cmap(int j, Colormap cmap) {
 #else
 	int i, ncells, ncolor;
 	XErrorHandler old_handler = NULL;
+	double now = dnow();
 
 	RAWFB_RET(0)
 
+	if (color_init && rgb_cmap[j] == cmap && now < rgb_time[j] + CMAP_MAX_AGE) {
+		return ! cmap_failed[j];
+	}
+	rgb_cmap[j] = cmap;
+	rgb_time[j] = now;
+
 	if (depth > 16) {
 		/* 24 */
 		ncolor = NCOLOR;
@@ -1461,6 +1497,41 @@ if (db24 > 2) fprintf(stderr, " cmap[%02d][%03d]: %03d %03d %03d  0x%08x \n", j,
 #endif	/* NO_X11 */
 }
 
+/*
+ * Drop the cached rgb[] of colormaps we got a ColormapNotify for, and
+ * follow windows that were given a different colormap.
+ */
+static void check_cmap_events(void) {
+#if NO_X11
+	return;
+#else
+	XEvent xev;
+	int i, n = 0;
+
+	RAWFB_RET_VOID
+
+	X_LOCK;
+	while (XCheckTypedEvent(dpy, ColormapNotify, &xev)) {
+		Colormap cmap = xev.xcolormap.colormap;
+		for (i=0; i < CMAPMAX; i++) {
+			if (rgb_cmap[i] == cmap) {
+				rgb_time[i] = 0.0;
+			}
+		}
+		if (xev.xcolormap.new) {
+			for (i=0; i < MAX_8BPP_WINDOWS; i++) {
+				if (windows_8bpp[i].win == xev.xcolormap.window) {
+					windows_8bpp[i].cmap = cmap;
+				}
+			}
+		}
+		n++;
+	}
+	X_UNLOCK;
+if (db24 > 1 && n) fprintf(stderr, "check_cmap_events: %d\n", n);
+#endif	/* NO_X11 */
+}
+
 static void do_8bpp_region(int n, sraRegionPtr mark) {
 	int k, cm = -1, failed = 0;
 	sraRectangleIterator *iter;
@@ -1740,18 +1811,24 @@ if (db24) fprintf(stderr, "xi: wrong depth: %d\n", xi->depth);
 
 			/* line by line ... */
 			for (line = 0; line < h; line++) {
+				memcpy(poll, src, (size_t)w * ps1);
+				if (ps1 == 1 && ps2 == 4) {
+					/* the common 8bpp overlay case */
+					fb_cmap8to32((unsigned int *) dst,
+					    (unsigned char *) src, w, rgb[cm]);
+					src += xi->bytes_per_line;
+					dst += main_bytes_per_line * fac;
+					poll += poll_Bpl;
+					continue;
+				}
 				/* pixel by pixel... */
 				for (j = 0; j < w; j++) {
 					if (ps1 == 2) {
-						unsigned short *ptmp;
 						us    = (unsigned short *) (src + ps1 * j);
 						idx   = (int) (*us);
-						ptmp  = (unsigned short *) (poll + ps1 * j);
-						*ptmp = *us;
 					} else {
 						uc  = (unsigned char *) (src + ps1 * j);
 						idx = (int) (*uc);
-						*(poll + ps1 * j) = *uc;
 					}
 					ui = (unsigned int *) (dst + ps2 * j);
 					*ui = rgb[cm][idx];
@@ -1787,6 +1864,12 @@ if (db24) fprintf(stderr, "xi: wrong depth: %d\n", xi->depth);
 		
 		/* line by line ... */
 		for (line = 0; line < h; line++) {
+			if (ps == 4) {
+				/* index in the top 8 bits (FIXME: masks?) */
+				fb_cmap_hi8((unsigned int *) src, w, rgb[cm]);
+				src += main_bytes_per_line * fac;
+				continue;
+			}
 			/* pixel by pixel... */
 			for (j = 0; j < w; j++) {
 
@@ -1888,6 +1971,13 @@ if (db24 > 1) fprintf(stderr, "bpp8to24 %d %d %d %d %.4f\n", x1, y1, x2, y2, dno
 
 			/* line by line ... */
 			for (line = 0; line < h; line++) {
+				if (ps1 == 1 && db24 <= 2) {
+					fb_cmap8to32((unsigned int *) dst,
+					    (unsigned char *) src, w, root_rgb);
+					src += main_bytes_per_line;
+					dst += main_bytes_per_line * 4;
+					continue;
+				}
 				/* pixel by pixel... */
 				for (j = 0; j < w; j++) {
 					if (ps1 == 2) {
@@ -1998,8 +2088,9 @@ if (db24 > 1) fprintf(stderr, "bpp8to24 w=%d h=%d m=%p c=%p r=%p ncmaps=%d\n", w
 
 		/*
 		 * first, grab all of the associated colormaps from the
-		 * X server.  Hopefully just 1 or 2...
+		 * X server.  Hopefully just 1 or 2, and usually cached...
 		 */
+		check_cmap_events();
 		for (j=0; j<ncmaps; j++) {
 			if (! get_cmap(j, cmaps[j])) {
 				cmap_failed[j] = 1;
@@ -101,10 +101,14 @@ void clean_shm(int quick) {
 		shm_delete(&scanline_shm);
 		shm_delete(&fullscreen_shm);
 		shm_delete(&snaprect_shm);
+		shm_delete(&capture_row_shm[0]);
+		shm_delete(&capture_row_shm[1]);
 	} else {
 		shm_clean(&scanline_shm, scanline);
 		shm_clean(&fullscreen_shm, fullscreen);
 		shm_clean(&snaprect_shm, snaprect);
+		shm_clean(&capture_row_shm[0], capture_row[0]);
+		shm_clean(&capture_row_shm[1], capture_row[1]);
 	}
 
 	/* 
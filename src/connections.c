@@ -44,6 +44,7 @@ so, delete this exception statement from your version.
 #include "unixpw.h"
 #include "user.h"
 #include "scan.h"
+#include "stats.h"
 #include "sslcmds.h"
 #include "sslhelper.h"
 #include "xwrappers.h"
@@ -55,6 +56,7 @@ so, delete this exception statement from your version.
 #include "pointer.h"
 #include "xrandr.h"
 #include "xi2_devices.h"
+#include "evloop.h"
 
 
 /*
@@ -797,6 +799,14 @@ static void free_client_data(rfbClientPtr client) {
 				sraRgnDestroy(cd->cursor_region);
 				cd->cursor_region = NULL;
 			}
+			if (cd->video_held) {
+				sraRgnDestroy(cd->video_held);
+				cd->video_held = NULL;
+			}
+			if (cd->held_req) {
+				sraRgnDestroy(cd->held_req);
+				cd->held_req = NULL;
+			}
 		}
 		free(client->clientData);
 		client->clientData = NULL;
@@ -821,6 +831,7 @@ void client_gone(rfbClientPtr client) {
 
 	rfbLog("client_count: %d\n", client_count);
 	last_client_gone = dnow();
+	event_del_fd(client->sock);
 
 	if (unixpw_in_progress && unixpw_client) {
 		if (client == unixpw_client) {
@@ -905,6 +916,7 @@ void client_gone(rfbClientPtr client) {
 	  if(removeMD(dpy, cd->ptr_id))
 	    rfbLog("removed XInput2 MD for client %s.\n", client->host);
 
+	stats_client_gone(client);
 	free_client_data(client);
 
 	if (inetd && client == inetd_client) {
@@ -3890,6 +3902,7 @@ rfbBool password_check_chat_helper(rfbClientPtr cl, const char* response, int le
 enum rfbNewClientAction new_client_chat_helper(rfbClientPtr client) {
 	if (client) {}
 	client->clientGoneHook = client_gone_chat_helper;
+	event_add_fd(client->sock);
 	rfbLog("new chat helper\n");
 	return(RFB_CLIENT_ACCEPT);
 }
@@ -3897,6 +3910,7 @@ enum rfbNewClientAction new_client_chat_helper(rfbClientPtr client) {
 void client_gone_chat_helper(rfbClientPtr client) {
 	if (client) {}
 	rfbLog("finished chat helper\n");
+	event_del_fd(client->sock);
 	chat_window_client = NULL;
 }
 
@@ -4075,6 +4089,7 @@ enum rfbNewClientAction new_client(rfbClientPtr client) {
           }
 
 	client->clientGoneHook = client_gone;
+	event_add_fd(client->sock);
 
 	if (client_count) {
 		speeds_net_rate_measured = 0;
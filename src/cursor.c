@@ -577,7 +577,8 @@ void first_cursor(void) {
 	if (! screen) {
 		return;
 	}
-	if (! show_cursor) {
+	if (! show_cursor || rawfb_zerocopy) {
+		/* -zerocopy: no drawing into the mapped -rawfb */
 		LOCK(screen->cursorMutex);
 		screen->cursor = NULL;
 		UNLOCK(screen->cursorMutex);
@@ -1939,7 +1940,7 @@ void cursor_position(int x, int y, rfbClientPtr client) {
 
 static void set_rfb_cursor(int which) {
 
-	if (! show_cursor) {
+	if (! show_cursor || rawfb_zerocopy) {
 		return;
 	}
 	if (! screen) {
@@ -0,0 +1,418 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- evloop.c -- */
+
+#include "x11vnc.h"
+#include "evloop.h"
+#include "xdamage.h"
+#include "xwrappers.h"
+#include "sslhelper.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+/*
+ * -eventloop: watch_loop() sleeps in event_wait() instead of a fixed
+ * usleep().  The X connection (XDamage events come in on it), the
+ * listening sockets (SSL ones too), the clients, the -unixsock socket
+ * and the -sslinproc handshake pipe are waited on, so an input event,
+ * a new connection or a damage report ends the nap at once.
+ *
+ * When XDamage is telling us about changes and the last polls found
+ * nothing, or there are no clients at all, the nap is stretched to
+ * -eventidle msec: with nothing happening an instance then wakes up
+ * about once a second rather than 20-30 times.
+ *
+ * On Linux the fds are kept in an epoll set.  The clients are added by
+ * new_client() and taken out by client_gone() (event_add_fd() and
+ * event_del_fd()); the few other fds are compared with what the set
+ * has on each pass, so a pass where nothing came or went makes no
+ * epoll_ctl() calls.  The nap's deadline is a timerfd in the same set.
+ *
+ * The check_*() housekeeping in watch_loop() only runs when the nap was
+ * ended by one of the fds, on input, or every EVLOOP_CHECKS msec (see
+ * event_checks_due()) instead of on every poll.
+ */
+
+int event_loop = 0;		/* -eventloop */
+int event_idle_ms = 1000;	/* -eventidle */
+
+void event_wait(int msec, int tile_diffs);
+void event_add_fd(int fd);
+void event_del_fd(int fd);
+int event_checks_due(void);
+
+static int collect_fds(int *fds, int max, int clients);
+static int wait_fds(int msec);
+
+#define EVLOOP_FDS	256	/* select(): clients past this wait for the timeout */
+#define EVLOOP_QUIET	4	/* empty polls before stretching the nap */
+#define EVLOOP_CHECKS	100	/* msec between housekeeping passes at most */
+
+static int quiet_polls = 0;
+static int woke = 1;		/* the last nap was ended by an fd */
+static double last_checks = 0.0;
+
+#ifdef __linux__
+static int ep_fd = -1;
+static int ep_timer = -1;			/* the nap deadline */
+static int ep_fds[EVLOOP_FDS], ep_n = 0;	/* non-client fds in ep_fd */
+
+static int ep_setup(void);
+static void ep_sync(void);
+static int is_client_fd(int fd);
+#endif
+
+static int collect_fds(int *fds, int max, int clients) {
+	int n = 0;
+
+#define ADD_FD(f) if ((f) >= 0 && n < max) fds[n++] = (f)
+
+#if !NO_X11
+	if (dpy) {
+		ADD_FD(ConnectionNumber(dpy));
+	}
+#endif
+	ADD_FD(unix_sock_fd);
+
+	/* the SSL listeners and finished -sslinproc handshakes */
+	if (use_openssl) {
+		ADD_FD(openssl_sock);
+		ADD_FD(openssl_sock6);
+		ADD_FD(https_sock);
+		ADD_FD(https_sock6);
+		ADD_FD(ssl_inproc_ready_fd);
+	}
+
+	if (screen && ! use_threads) {
+		/* with -threads libvncserver's own threads do these */
+		ADD_FD(screen->listenSock);
+		ADD_FD(screen->httpListenSock);
+		ADD_FD(screen->httpSock);
+		ADD_FD(ipv6_listen_fd);
+		ADD_FD(ipv6_http_fd);
+
+		if (clients) {
+			rfbClientIteratorPtr iter;
+			rfbClientPtr cl;
+
+			iter = rfbGetClientIterator(screen);
+			while( (cl = rfbClientIteratorNext(iter)) ) {
+				ADD_FD(cl->sock);
+			}
+			rfbReleaseClientIterator(iter);
+		}
+	}
+#undef ADD_FD
+	return n;
+}
+
+/*
+ * Called by new_client() and client_gone().  By the time client_gone()
+ * runs libvncserver has usually closed the socket, which took it out
+ * of the set already, so EPOLL_CTL_DEL failing then is fine.
+ */
+void event_add_fd(int fd) {
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if (ep_fd < 0 || fd < 0 || use_threads) {
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST) {
+		rfbLogPerror("event_add_fd: epoll_ctl");
+	}
+#else
+	if (fd) {}
+#endif
+}
+
+void event_del_fd(int fd) {
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if (ep_fd < 0 || fd < 0 || use_threads) {
+		return;
+	}
+	epoll_ctl(ep_fd, EPOLL_CTL_DEL, fd, &ev);
+#else
+	if (fd) {}
+#endif
+}
+
+/*
+ * Called by watch_loop(): whether to do the check_*() calls this pass.
+ */
+int event_checks_due(void) {
+	double now;
+
+	if (! event_loop) {
+		return 1;
+	}
+	now = dnow();
+	if (woke || got_user_input || now < last_checks
+	    || now >= last_checks + EVLOOP_CHECKS / 1000.0) {
+		woke = 0;
+		last_checks = now;
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef __linux__
+/*
+ * Creates the epoll set with the timerfd and the clients already
+ * connected; the other fds are added by ep_sync().
+ */
+static int ep_setup(void) {
+	struct epoll_event ev;
+	int fds[EVLOOP_FDS], n, i;
+
+	ep_fd = epoll_create(EVLOOP_FDS);
+	if (ep_fd < 0) {
+		rfbLogPerror("event_wait: epoll_create");
+		return 0;
+	}
+	if (fcntl(ep_fd, F_SETFD, FD_CLOEXEC) < 0) {
+		rfbLogPerror("event_wait: fcntl");
+	}
+	ep_n = 0;
+
+	ep_timer = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (ep_timer < 0) {
+		rfbLogPerror("event_wait: timerfd_create");
+	} else {
+		if (fcntl(ep_timer, F_SETFD, FD_CLOEXEC) < 0) {
+			rfbLogPerror("event_wait: fcntl");
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = ep_timer;
+		if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, ep_timer, &ev) < 0) {
+			rfbLogPerror("event_wait: epoll_ctl");
+			close(ep_timer);
+			ep_timer = -1;
+		}
+	}
+	/* without the timerfd the epoll_wait() timeout is used */
+
+	n = collect_fds(fds, EVLOOP_FDS, 1);
+	for (i=0; i < n; i++) {
+		event_add_fd(fds[i]);
+	}
+	return 1;
+}
+
+static int is_client_fd(int fd) {
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	int found = 0;
+
+	if (! screen) {
+		return 0;
+	}
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		if (cl->sock == fd) {
+			found = 1;
+		}
+	}
+	rfbReleaseClientIterator(iter);
+	return found;
+}
+
+/*
+ * Brings the non-client fds in the set in line with collect_fds().
+ * Only an fd that came or went costs an epoll_ctl().
+ */
+static void ep_sync(void) {
+	struct epoll_event ev;
+	int fds[EVLOOP_FDS], n, i, j;
+
+	n = collect_fds(fds, EVLOOP_FDS, 0);
+
+	for (i=0; i < ep_n; i++) {
+		for (j=0; j < n; j++) {
+			if (fds[j] == ep_fds[i]) break;
+		}
+		if (j == n) {
+			/*
+			 * may be closed already, that removed it too, and
+			 * a new client may have its number by now.
+			 */
+			if (! is_client_fd(ep_fds[i])) {
+				epoll_ctl(ep_fd, EPOLL_CTL_DEL, ep_fds[i], &ev);
+			}
+			ep_fds[i--] = ep_fds[--ep_n];
+		}
+	}
+	for (j=0; j < n; j++) {
+		for (i=0; i < ep_n; i++) {
+			if (fds[j] == ep_fds[i]) break;
+		}
+		if (i < ep_n) {
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[j];
+		if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, fds[j], &ev) < 0
+		    && errno != EEXIST) {
+			static int warned = 0;
+			if (! warned++) {
+				rfbLogPerror("event_wait: epoll_ctl");
+			}
+			continue;
+		}
+		ep_fds[ep_n++] = fds[j];
+	}
+}
+
+/*
+ * Waits up to msec; returns the number of ready fds, the timer not
+ * counted.
+ */
+static int wait_fds(int msec) {
+	struct epoll_event evs[16];
+	struct itimerspec its;
+	int i, r, tmo = msec;
+
+	if (ep_fd < 0 && ! ep_setup()) {
+		event_loop = 0;
+		usleep(msec * 1000);
+		return 0;
+	}
+	ep_sync();
+
+	if (ep_timer >= 0) {
+		/* (re)arming also clears an expiry we did not read */
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = msec / 1000;
+		its.it_value.tv_nsec = (msec % 1000) * 1000000L;
+		if (timerfd_settime(ep_timer, 0, &its, NULL) == 0) {
+			tmo = -1;
+		}
+	}
+
+	r = epoll_wait(ep_fd, evs, 16, tmo);
+	if (r < 0) {
+		if (errno != EINTR) {
+			rfbLogPerror("event_wait: epoll_wait");
+			usleep(msec * 1000);
+		}
+		return 0;
+	}
+	for (i=0; i < r; i++) {
+		if (evs[i].data.fd == ep_timer) {
+			evs[i--] = evs[--r];
+		}
+	}
+	return r;
+}
+#else
+static int wait_fds(int msec) {
+	fd_set rfds;
+	struct timeval tv;
+	int fds[EVLOOP_FDS], i, n, nmax = -1;
+
+	n = collect_fds(fds, EVLOOP_FDS, 1);
+	FD_ZERO(&rfds);
+	for (i=0; i < n; i++) {
+		if (fds[i] < FD_SETSIZE) {
+			FD_SET(fds[i], &rfds);
+			if (fds[i] > nmax) {
+				nmax = fds[i];
+			}
+		}
+	}
+	tv.tv_sec = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	n = select(nmax + 1, &rfds, NULL, NULL, &tv);
+	return n < 0 ? 0 : n;
+}
+#endif
+
+/*
+ * Called by watch_loop() in place of its nap: msec is what
+ * choose_delay() wanted, tile_diffs the result of the last poll.
+ */
+void event_wait(int msec, int tile_diffs) {
+	int idle = 0;
+	double now = dnow();
+
+	if (tile_diffs > 0 || got_user_input) {
+		quiet_polls = 0;
+	} else if (quiet_polls < EVLOOP_QUIET) {
+		quiet_polls++;
+	}
+
+	if (! screen || ! screen->clientHead) {
+		idle = 1;
+	} else if (use_xdamage && xdamage_present && ! button_mask
+	    && quiet_polls >= EVLOOP_QUIET
+	    && now > last_keyboard_time + 1.0
+	    && now > last_pointer_time + 1.0) {
+		idle = 1;
+	}
+
+#if !NO_X11
+	if (dpy) {
+		int queued;
+
+		X_LOCK;
+		XFlush_wr(dpy);
+		queued = QLength(dpy);
+		X_UNLOCK;
+		if (queued) {
+			/* already read in, the fd will not tell us */
+			idle = 0;
+			woke = 1;
+		}
+	}
+#endif
+	if (idle && event_idle_ms > msec) {
+		msec = event_idle_ms;
+	}
+	if (msec <= 0) {
+		return;
+	}
+
+	if (wait_fds(msec) > 0) {
+		woke = 1;
+	}
+}
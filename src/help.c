@@ -35,6 +35,7 @@ so, delete this exception statement from your version.
 #include "x11vnc.h"
 #include "xdamage.h"
 #include "cursor.h"
+#include "evloop.h"
 
 /*
  * text printed out under -help option
@@ -1832,6 +1833,17 @@ void print_help(int mode) {
 "                       and only allows standard SSL tunneling.  You must also\n"
 "                       supply the -ssl ... option (see below.)\n"
 "\n"
+"-sslinproc             Handle the SSL connections inside x11vnc instead\n"
+"                       of forking an ssl_helper process for each viewer.\n"
+"                       A single thread does the SSL handshakes and the\n"
+"                       encryption for all of the viewers, which saves a\n"
+"                       process (and its memory) and a relay hop per viewer.\n"
+"                       Implies -sslonly.  HTTPS applet downloads on the VNC\n"
+"                       port are not available in this mode (use -https\n"
+"                       to serve them on a separate port.)  Requires a\n"
+"                       thread enabled build; -ssltimeout applies as an idle\n"
+"                       read timeout.\n"
+"\n"
 "\n"
 "-dhparams file         For some operations a set of Diffie Hellman parameters\n"
 "                       (prime and generator) is needed.  If so, use the\n"
@@ -3922,6 +3934,29 @@ void print_help(int mode) {
 "                       updating the scroll window without updating the rest\n"
 "                       of the screen.\n"
 "\n"
+"-scrolldetect          Detect scrolling from the framebuffer contents rather\n"
+"                       than from snooping on the X protocol.  Each poll the\n"
+"                       lines of the changed area are hashed before and after\n"
+"                       they are read in, and if most of them just moved up,\n"
+"                       down, left or right by the same amount that part is\n"
+"                       sent as a CopyRect and only the newly exposed strip\n"
+"                       as pixel data.  Works with toolkits and Xwayland where\n"
+"                       -scrollcopyrect sees nothing, at the cost of hashing\n"
+"                       the changed area twice.  The area has to be at least\n"
+"                       -scr_area pixels.  Not used with -scale, -rotate,\n"
+"                       -8to24, -ncache or -zerocopy.\n"
+"\n"
+"-tilecache             Remember where the tiles the viewers already have are\n"
+"                       by a hash of their pixels, and send a changed tile\n"
+"                       that is the same as one of them as a CopyRect from\n"
+"                       there.  Helps when windows are switched back and\n"
+"                       forth or content reappears somewhere else on the\n"
+"                       screen, and with -ncache also finds the saved window\n"
+"                       contents below the screen when the window ids do not\n"
+"                       match.  Costs hashing each changed tile.  All viewers\n"
+"                       must support CopyRect.  Not used with -scale, -rotate,\n"
+"                       -8to24 or -zerocopy.\n"
+"\n"
 "-fixscreen string      Periodically \"repair\" the screen based on settings\n"
 "                       in \"string\".  Hopefully you won't need this option,\n"
 "                       it is intended for cases when the -scrollcopyrect or\n"
@@ -4067,6 +4102,26 @@ void print_help(int mode) {
 "                       e.g. \"-speeds modem\".  The aliases are: \"modem\" for\n"
 "                       6,4,200; \"dsl\" for 6,100,50; and \"lan\" for 6,5000,1\n"
 "\n"
+"-bwlimit n             Limit the framebuffer update output to each client to\n"
+"                       n KB/sec (0, the default, means no limit).  A client\n"
+"                       over its budget is sent nothing until the budget\n"
+"                       refills; its screen changes pile up and go out as one\n"
+"                       update.  For Tight and ZYWRLE the JPEG quality level\n"
+"                       the viewer asked for is lowered while it is over\n"
+"                       budget and restored once it stays within it.  This\n"
+"                       keeps one slow viewer from using up the uplink that\n"
+"                       the other viewers share.\n"
+"\n"
+"-pacing                Pace the framebuffer updates to each client by its own\n"
+"                       link.  x11vnc watches how much data is waiting in each\n"
+"                       client's socket and how fast it drains.  A client with\n"
+"                       more than its round trip time plus about 0.1 sec worth\n"
+"                       of data queued is sent nothing until the queue drains;\n"
+"                       its screen changes pile up and go out as one update.\n"
+"                       So a slow viewer gets fewer but current frames and does\n"
+"                       not hold up the polling for the viewers on faster\n"
+"                       links.  Off by default; -nopacing turns it off again.\n"
+"\n"
 "-wmdt string           For some features, e.g. -wireframe and -scrollcopyrect,\n"
 "                       x11vnc has to work around issues for certain window\n"
 "                       managers or desktops (currently kde and xfce).\n"
@@ -4131,6 +4186,37 @@ void print_help(int mode) {
 "                       to really throttle down the screen polls (i.e. sleep\n"
 "                       for about 1.5 secs). Use 0 to disable.  Default: %d\n"
 "                       Set the env. var. X11VNC_SB_FACTOR to scale it.\n"
+"-eventloop             Between screen polls sleep on the X connection, the\n"
+"                       listening and client sockets and the -unixsock socket\n"
+"                       (epoll(7) on Linux) instead of for a fixed time, so\n"
+"                       input or an XDamage report is handled at once.  When\n"
+"                       XDamage is in use and nothing has changed for a few\n"
+"                       polls, or no client is connected, the sleep is\n"
+"                       stretched to -eventidle ms, cutting the idle load to\n"
+"                       about one wakeup a second.  The housekeeping checks\n"
+"                       (remote control files, connect files, etc.) then run\n"
+"                       when a socket woke x11vnc up or every 0.1 sec, not\n"
+"                       after every poll.\n"
+"-eventidle ms          Longest -eventloop sleep when idle.  Default: %d\n"
+"-heatpoll n            Keep a decaying per tile change frequency and scan the\n"
+"                       tile rows where nothing changed lately only every n-th\n"
+"                       poll (n is made odd).  Rows with a hot tile (a clock,\n"
+"                       a terminal, video) are scanned every poll as before.\n"
+"                       Every scanline is still checked within n*32 polls.\n"
+"                       Cuts the screen reads on mostly static desktops.  The\n"
+"                       heat map can be seen with -query heatmap.  Default: 0\n"
+"-videodetect           Find rectangles of the screen that change on nearly\n"
+"                       every poll (video, WebGL) and handle them apart from\n"
+"                       the rest of the desktop: see -videofps and\n"
+"                       -videoquality.  They are logged when found and can\n"
+"                       be listed with -query video_regions.\n"
+"-videofps f            With -videodetect poll and send the video regions at\n"
+"                       most f times a second (0 for no limit).  Default: 10\n"
+"-videoquality n        With -videodetect send the video regions in updates of\n"
+"                       their own, at Tight/ZYWRLE JPEG quality n (0-9), when\n"
+"                       the viewer has JPEG enabled.  The rest of the desktop\n"
+"                       keeps the viewer's quality.  Not used with -scale or\n"
+"                       -rotate.  Default: off\n"
 "\n"
 "-readtimeout n         Set LibVNCServer rfbMaxClientWait to n seconds. On\n"
 "                       slow links that take a long time to paint the first\n"
@@ -4256,6 +4342,16 @@ void print_help(int mode) {
 "                       there are problems or decrease it to live on the edge\n"
 "                       (perhaps useful on a slow machine).\n"
 "\n"
+"-xd_rects              Poll only where DAMAGE says the screen changed: the\n"
+"                       tiles touched by the DAMAGE rectangles of the last\n"
+"                       two polls are fetched and compared, and the scanline\n"
+"                       sweep is skipped.  On a mostly idle desktop (a clock,\n"
+"                       a blinking cursor) this makes polling nearly free.\n"
+"                       A scanline check still runs every couple of seconds;\n"
+"                       if it finds changes DAMAGE did not report (e.g. some\n"
+"                       OpenGL apps) x11vnc goes back to the normal sweep.\n"
+"                       Not used with -rawfb or -ncache.\n"
+"\n"
 "-sigpipe string        Broken pipe (SIGPIPE) handling.  \"string\" can be\n"
 "                       \"ignore\" or \"exit\".  For \"ignore\" LibVNCServer\n"
 "                       will handle the abrupt loss of a client and continue,\n"
@@ -4303,6 +4399,42 @@ void print_help(int mode) {
 "                       by checking the tile near the boundary.  Default: %d\n"
 "-fuzz n                Tolerance in pixels to mark a tiles edges as changed.\n"
 "                       Default: %d\n"
+"-nosimd                Do not use the SSE2/AVX2 kernels for comparing tiles\n"
+"                       and scanlines, use only the plain C versions.  The\n"
+"                       vectorized ones are picked at startup from what the\n"
+"                       CPU supports.  Also: env. X11VNC_NO_SIMD=1\n"
+"-scanthreads n         For a memory mapped -rawfb (map: or shm:) split the\n"
+"                       polling for changed tiles over n threads, each taking\n"
+"                       a band of tile rows.  The framebuffer is read in place\n"
+"                       rather than copied into polling images first.  Only\n"
+"                       used when there is no X display to serialize on and\n"
+"                       none of -blackout, -snapfb, -24to32 or -ncache apply.\n"
+"                       Default: 0 (single threaded).\n"
+"-zerocopy              For a memory mapped -rawfb (map: or shm:) in a pixel\n"
+"                       format x11vnc can serve as is, let the VNC encoders\n"
+"                       read straight from the mapping instead of from a copy\n"
+"                       of it.  Changes are found by comparing against a small\n"
+"                       table of hashes of each tile line, so changed tiles are\n"
+"                       only read, never copied.  Not used with -scale,\n"
+"                       -rotate, -8to24, -24to32, -blackout, -snapfb, -ncache,\n"
+"                       -multiptr or -unixpw, and it implies -nocursor since the\n"
+"                       cursor would otherwise be drawn into the mapping.\n"
+"-pipeline              Fetch the changed tile rows from the X server in a\n"
+"                       separate capture thread, one full width row ahead:\n"
+"                       while row y is compared and copied into the\n"
+"                       framebuffer the request for row y+1 is already\n"
+"                       under way.  Helps when the round trips to the X\n"
+"                       server dominate the polling, e.g. a busy desktop or\n"
+"                       a remote display.  Not used with -rawfb, -snapfb,\n"
+"                       -id/-sid or -xrandr.  Needs a threaded build.\n"
+"-nofbdamage            Ignore the damage header at the start of a -rawfb\n"
+"                       shm: or map: segment.  A program drawing into the\n"
+"                       segment can start it with the header described in\n"
+"                       x11vnc_shmfb.h and post the rectangles it draws there;\n"
+"                       x11vnc then reads those instead of polling for changes\n"
+"                       (and polls once whenever the ring of rectangles wraps\n"
+"                       between two reads).  The pixels are expected right\n"
+"                       after the header, +offset is set from it.\n"
 "-debug_tiles           Print debugging output for tiles, fb updates, etc.\n"
 "\n"
 "-snapfb                Instead of polling the X display framebuffer (fb)\n"
@@ -5390,6 +5522,7 @@ void print_help(int mode) {
 "                       slow_fb:f       set -slow_fb to f seconds.\n"
 "                       xrefresh:f      set -xrefresh to f seconds.\n"
 "                       readtimeout:n   set read timeout to n seconds.\n"
+"                       heatpoll:n      set -heatpoll to n.\n"
 "                       nap             enable  -nap mode.\n"
 "                       nonap           disable -nap mode.\n"
 "                       sb:n            set -sb to n s, same as screen_blank:n\n"
@@ -5652,7 +5785,7 @@ void print_help(int mode) {
 "                       nodk keycode keysym ptr fakebuttonevent sleep get_xprop\n"
 "                       set_xprop wininfo bcx_xattach deferupdate defer\n"
 "                       setdefer extra_fbur wait_ui wait_bog nowait_bog\n"
-"                       slow_fb xrefresh wait readtimeout nap nonap sb\n"
+"                       slow_fb xrefresh wait readtimeout heatpoll nap nonap sb\n"
 "                       screen_blank fbpm nofbpm dpms nodpms clientdpms\n"
 "                       noclientdpms forcedpms noforcedpms noserverdpms\n"
 "                       serverdpms noultraext ultraext chatwindow nochatwindow\n"
@@ -5682,7 +5815,8 @@ void print_help(int mode) {
 "                       sslverify stunnel stunnel_pem https httpsredir usepw\n"
 "                       using_shm logfile o flag rmflag rc norc h help V version\n"
 "                       lastmod bg sigpipe threads readrate netrate netlatency\n"
-"                       pipeinput clients client_count pid ext_xtest ext_xtrap\n"
+"                       pipeinput clients client_count latency latency_clients\n"
+"                       heatmap video_regions pid ext_xtest ext_xtrap\n"
 "                       ext_xrecord ext_xkb ext_xshm ext_xinerama ext_overlay\n"
 "                       ext_xfixes ext_xdamage ext_xrandr rootwin num_buttons\n"
 "                       button_mask mouse_x mouse_y grab_state pointer_pos\n"
@@ -5876,6 +6010,7 @@ void print_help(int mode) {
 		wait_ui,
 		take_naps ? "take naps":"no naps",
 		screen_blank,
+		event_idle_ms,
 		rfbMaxClientWait/1000,
 		watch_fbpm ? "-nofbpm":"-fbpm",
 		watch_dpms ? "-nodpms":"-dpms",
@@ -49,6 +49,7 @@ so, delete this exception statement from your version.
 #include "macosx.h"
 #include "screen.h"
 #include "xi2_devices.h"
+#include "stats.h"
 
 
 void get_keystate(int *keystate);
@@ -80,6 +81,10 @@ static int count_added_keycodes(void);
 static void add_remap(char *line);
 static void add_dead_keysyms(char *str);
 static void initialize_xkb_modtweak(void);
+#if HAVE_XKEYBOARD && !SKIP_XKB
+static int ks_hash(KeySym ks);
+static void xkb_index_keysyms(void);
+#endif
 static void xkb_tweak_keyboard(rfbBool down, rfbKeySym keysym,
     rfbClientPtr client);
 static void tweak_mod(signed char mod, rfbBool down, int dev_id);
@@ -980,6 +985,48 @@ void switch_to_xkb_if_better(void) {}
 
 #else
 
+/*
+ * keysym -> (keycode, group, level) index over xkbkeysyms[], rebuilt
+ * with it (MappingNotify -> initialize_modtweak()), so a key event
+ * does not have to scan every triple.  Entries are chained in the same
+ * (keycode, group, level) order as that scan, as slot numbers + 1 so
+ * that 0 ends a chain (and an unbuilt index is empty).
+ */
+#define KS_HASH 512
+#define KS_SLOT(kc, grp, lvl) (((kc) * GRP + (grp)) * LVL + (lvl))
+static unsigned short xkb_ks_head[KS_HASH];
+static unsigned short xkb_ks_next[0x100 * GRP * LVL];
+
+static int ks_hash(KeySym ks) {
+	return (int) (((unsigned int) ks * 2654435761U) >> 23) & (KS_HASH - 1);
+}
+
+/* (re)build the xkb_ks_head[] chains from xkbkeysyms[] */
+static void xkb_index_keysyms(void) {
+	static unsigned short tail[KS_HASH];
+	int kc, grp, lvl, h, e;
+
+	memset(xkb_ks_head, 0, sizeof(xkb_ks_head));
+	for (kc = kc_min; kc <= kc_max; kc++) {
+	    for (grp = 0; grp < grp_max+1; grp++) {
+		for (lvl = 0; lvl < lvl_max+1; lvl++) {
+			if (xkbkeysyms[kc][grp][lvl] == NoSymbol) {
+				continue;
+			}
+			h = ks_hash(xkbkeysyms[kc][grp][lvl]);
+			e = KS_SLOT(kc, grp, lvl) + 1;
+			xkb_ks_next[e-1] = 0;
+			if (xkb_ks_head[h] == 0) {
+				xkb_ks_head[h] = e;
+			} else {
+				xkb_ks_next[tail[h]-1] = e;
+			}
+			tail[h] = e;
+		}
+	    }
+	}
+}
+
 void switch_to_xkb_if_better(void) {
 	KeySym keysym, *keymap;
 	int miss_noxkb[256], miss_xkb[256], missing_noxkb = 0, missing_xkb = 0;
@@ -1520,6 +1567,8 @@ xkbmodifiers[]    For the KeySym bound to this (keycode,group,level) store
 	    }
 	}
 
+	xkb_index_keysyms();
+
 	/*
 	 * kc_vec will be used in some places to find modifiers, etc
 	 * we apply some permutations to it as workarounds.
@@ -1577,7 +1626,7 @@ static short **score_hint = NULL;
 static void xkb_tweak_keyboard(rfbBool down, rfbKeySym keysym,
     rfbClientPtr client) {
 
-	int kc, grp, lvl, i, kci;
+	int kc, grp, lvl, i, kci, e;
 	int kc_f[0x100], grp_f[0x100], lvl_f[0x100], state_f[0x100], found;
 	int ignore_f[0x100];
 	unsigned int state = 0;
@@ -1636,11 +1685,10 @@ static void xkb_tweak_keyboard(rfbBool down, rfbKeySym keysym,
 	}
 	cnt++;
 	if (cnt % 100 && khints && score_hint != NULL) {
-		int i, j;
+		int i;
 		for (i=0; i<0x100; i++) {
-			for (j=0; j<0x100; j++) {
-				score_hint[i][j] = -1;
-			}
+			/* all 0xff bytes: -1 */
+			memset(score_hint[i], 0xff, 0x100 * sizeof(short));
 		}
 	}
 
@@ -1672,60 +1720,56 @@ static void xkb_tweak_keyboard(rfbBool down, rfbKeySym keysym,
 	found = 0;
 
 	/*
-	 * loop over all (keycode, group, level) triples looking for
-	 * matching keysyms.  Amazingly this isn't slow (but maybe if
-	 * you type really fast...).  Hash lookup into a linked list of
-	 * (keycode,grp,lvl) triples would be the way to improve this
-	 * in the future if needed.
+	 * look up the (keycode, group, level) triples bound to this keysym
+	 * in the index xkb_index_keysyms() made of them.
 	 */
-	for (kc = kc_min; kc <= kc_max; kc++) {
-	    for (grp = 0; grp < grp_max+1; grp++) {
-		for (lvl = 0; lvl < lvl_max+1; lvl++) {
-			if (keysym != xkbkeysyms[kc][grp][lvl]) {
-				continue;
-			}
-			/* got a keysym match */
-			state = xkbstate[kc][grp][lvl];
-
-			if (debug_keyboard > 1) {
-				char *s1, *s2;
-				s1 = XKeysymToString(XKeycodeToKeysym_wr(dpy,
-				    kc, 0));
-				if (! s1) s1 = "null";
-				s2 = XKeysymToString(keysym);
-				if (! s2) s2 = "null";
-				fprintf(stderr, "  got match kc=%03d=0x%02x G%d"
-				    " L%d  ks=0x%x \"%s\"  (basesym: \"%s\")\n",
-				    kc, kc, grp+1, lvl+1, keysym, s2, s1);
-				fprintf(stderr, "    need state: %s\n",
-				    bitprint(state, 8));
-				fprintf(stderr, "    ignorable : %s\n",
-				    bitprint(xkbignore[kc][grp][lvl], 8));
-			}
+	for (e = xkb_ks_head[ks_hash(keysym)]; e; e = xkb_ks_next[e-1]) {
+		kc  = (e-1) / (GRP * LVL);
+		grp = ((e-1) / LVL) % GRP;
+		lvl = (e-1) % LVL;
+		if (keysym != xkbkeysyms[kc][grp][lvl]) {
+			continue;
+		}
+		/* got a keysym match */
+		state = xkbstate[kc][grp][lvl];
 
-			/* save it if state is OK and not told to skip */
-			if (state == (unsigned int) -1) {
-				continue;
-			}
-			if (skipkeycode[kc] && debug_keyboard) {
-				fprintf(stderr, "    xxx skipping keycode: %d "
-				   "G%d/L%d\n", kc, grp+1, lvl+1);
-			}
-			if (skipkeycode[kc]) {
-				continue;
-			}
-			if (found > 0 && kc == kc_f[found-1]) {
-				/* ignore repeats for same keycode */
-				continue;
-			}
-			kc_f[found] = kc;
-			grp_f[found] = grp;
-			lvl_f[found] = lvl;
-			state_f[found] = state;
-			ignore_f[found] = xkbignore[kc][grp][lvl];
-			found++;
+		if (debug_keyboard > 1) {
+			char *s1, *s2;
+			s1 = XKeysymToString(XKeycodeToKeysym_wr(dpy,
+			    kc, 0));
+			if (! s1) s1 = "null";
+			s2 = XKeysymToString(keysym);
+			if (! s2) s2 = "null";
+			fprintf(stderr, "  got match kc=%03d=0x%02x G%d"
+			    " L%d  ks=0x%x \"%s\"  (basesym: \"%s\")\n",
+			    kc, kc, grp+1, lvl+1, keysym, s2, s1);
+			fprintf(stderr, "    need state: %s\n",
+			    bitprint(state, 8));
+			fprintf(stderr, "    ignorable : %s\n",
+			    bitprint(xkbignore[kc][grp][lvl], 8));
+		}
+
+		/* save it if state is OK and not told to skip */
+		if (state == (unsigned int) -1) {
+			continue;
 		}
-	    }
+		if (skipkeycode[kc] && debug_keyboard) {
+			fprintf(stderr, "    xxx skipping keycode: %d "
+			   "G%d/L%d\n", kc, grp+1, lvl+1);
+		}
+		if (skipkeycode[kc]) {
+			continue;
+		}
+		if (found > 0 && kc == kc_f[found-1]) {
+			/* ignore repeats for same keycode */
+			continue;
+		}
+		kc_f[found] = kc;
+		grp_f[found] = grp;
+		lvl_f[found] = lvl;
+		state_f[found] = state;
+		ignore_f[found] = xkbignore[kc][grp][lvl];
+		found++;
 	}
 
 #define PKBSTATE  \
@@ -3156,6 +3200,9 @@ void keyboard(rfbBool down, rfbKeySym keysym, rfbClientPtr client) {
 	last_down = down;
 	last_keysym = keysym;
 	last_keyboard_time = tnow;
+	if (down && ! IsModifierKey(keysym)) {
+		stats_input(client, -1, -1);
+	}
 
 	last_rfb_down = down;
 	last_rfb_keysym = keysym;
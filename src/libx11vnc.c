@@ -22,6 +22,7 @@
 #include "options.h"
 #include "connections.h"
 #include "cleanup.h"
+#include "stats.h"
 
 /* Global state backup structure */
 typedef struct {
@@ -739,6 +740,7 @@ static void update_cached_stats(x11vnc_server_t* server) {
     if (!server) return;
     
     uint64_t now = get_timestamp_ms();
+    stats_snapshot_t* snap;
     
     /* Basic timing info */
     server->cached_stats.uptime_seconds = (now - server->start_time) / 1000;
@@ -756,13 +758,38 @@ static void update_cached_stats(x11vnc_server_t* server) {
         server->cached_stats.max_clients_reached = client_count;
     }
     
-    /* Performance indicators - placeholder values */
-    server->cached_stats.fps_current = 15.0; /* Estimate */
-    server->cached_stats.fps_average = 12.0; /* Estimate */
-    server->cached_stats.cpu_usage_percent = 5.0; /* Estimate */
-    server->cached_stats.memory_usage_mb = 50.0; /* Estimate */
-    
+    server->cached_stats.total_connections = clients_served;
+    server->cached_stats.pointer_events = got_pointer_calls;
+    server->cached_stats.key_events = got_keyboard_calls;
     server->stats_last_update = now;
+    
+    /* Performance indicators, sampled by the main loop (~25 KB, not
+     * on the stack: this may run from a callback) */
+    snap = malloc(sizeof(stats_snapshot_t));
+    if (!snap) {
+        return;
+    }
+    stats_get(snap);
+    server->cached_stats.fps_current = snap->fps;
+    server->cached_stats.fps_average = snap->fps_avg;
+    server->cached_stats.total_frames_sent = snap->fb_updates;
+    server->cached_stats.total_bytes_sent = snap->bytes_sent;
+    server->cached_stats.total_bytes_received = snap->bytes_rcvd;
+    server->cached_stats.screen_update_rate = snap->poll_rate;
+    server->cached_stats.cpu_usage_percent = snap->cpu;
+    server->cached_stats.memory_usage_mb = snap->rss_mb;
+    server->cached_stats.dropped_frames = (int) snap->dropped;
+    server->cached_stats.scan_time_ms = snap->scan_ms;
+    server->cached_stats.scan_time_max_ms = snap->scan_ms_max;
+    server->cached_stats.bandwidth_in_kbps = snap->kbps_in;
+    server->cached_stats.bandwidth_out_kbps = snap->kbps_out;
+    server->cached_stats.compression_ratio = (int) (snap->cmp_ratio + 0.5);
+    server->cached_stats.latency_count = snap->lat_count;
+    server->cached_stats.latency_p50_ms = snap->lat_p50;
+    server->cached_stats.latency_p95_ms = snap->lat_p95;
+    server->cached_stats.latency_p99_ms = snap->lat_p99;
+    
+    free(snap);
 }
 
 /* Phase 3 API Implementation */
@@ -829,28 +856,41 @@ int x11vnc_server_get_clients(x11vnc_server_t* server,
     
     *actual_count = 0;
     
-    /* Iterate through client list - simplified for now */
-    int count = (client_count < max_clients) ? client_count : max_clients;
+    /* Clients as of the last main loop sample */
+    stats_snapshot_t* snap = malloc(sizeof(stats_snapshot_t));
+    if (!snap) {
+        pthread_mutex_unlock(&server->mutex);
+        return X11VNC_ERROR_NO_MEMORY;
+    }
+    stats_get(snap);
+    
+    int count = (snap->nclients < max_clients) ? snap->nclients : max_clients;
     
     for (int i = 0; i < count; i++) {
         x11vnc_client_info_t* client = &clients[i];
+        stats_client_t* sc = &snap->clients[i];
         
-        /* Fill in client info - placeholder data */
-        snprintf(client->client_id, sizeof(client->client_id), "client_%d", i);
-        snprintf(client->hostname, sizeof(client->hostname), "127.0.0.1");
-        client->port = 5900 + i;
-        snprintf(client->username, sizeof(client->username), "user_%d", i);
+        snprintf(client->client_id, sizeof(client->client_id), "0x%x", sc->uid);
+        snprintf(client->hostname, sizeof(client->hostname), "%s", sc->host);
+        client->port = sc->port;
+        snprintf(client->username, sizeof(client->username), "%s", sc->user);
         client->authenticated = true;
-        client->view_only = false;
-        client->connected_time = get_timestamp_ms() - 30000; /* 30 seconds ago */
-        client->bytes_sent = 1024 * 1024; /* 1MB */
-        client->bytes_received = 64 * 1024; /* 64KB */
-        client->frames_sent = 1000;
-        client->last_activity = get_timestamp_ms() - 1000; /* 1 second ago */
-        snprintf(client->encoding, sizeof(client->encoding), "Tight");
+        client->view_only = sc->viewonly ? true : false;
+        client->connected_time = (uint64_t)sc->login_time * 1000;
+        client->bytes_sent = sc->bytes_sent;
+        client->bytes_received = sc->bytes_rcvd;
+        client->frames_sent = (uint32_t)sc->fb_updates;
+        client->last_activity = sc->last_activity * 1000.0;
+        snprintf(client->encoding, sizeof(client->encoding), "%s",
+                 stats_encoding_name(sc->encoding));
+        client->latency_count = sc->lat_count;
+        client->latency_p50_ms = sc->lat_p50;
+        client->latency_p95_ms = sc->lat_p95;
+        client->latency_p99_ms = sc->lat_p99;
         
         (*actual_count)++;
     }
+    free(snap);
     
     pthread_mutex_unlock(&server->mutex);
     
@@ -1177,6 +1217,7 @@ int x11vnc_server_set_bandwidth_limit(x11vnc_server_t* server,
     pthread_mutex_lock(&server->mutex);
     
     server->bandwidth_limit_kbps = max_kbps_per_client;
+    bw_limit = max_kbps_per_client;
     
     printf("Bandwidth limit set to %d KB/s per client\n", max_kbps_per_client);
     
@@ -80,6 +80,7 @@ char *ssl_verify = NULL;
 char *ssl_crl = NULL;
 int ssl_initialized = 0;
 int ssl_timeout_secs = -1;
+int ssl_inproc = 0;		/* -sslinproc */
 char *ssh_str = NULL;
 pid_t ssh_pid = 0;
 int usepw = USEPW;
@@ -93,6 +94,8 @@ char *solid_default = "cyan4";
 char *wmdt_str = NULL;		/* -wmdt */
 
 char *speeds_str = NULL;	/* -speeds */
+int bw_limit = 0;		/* -bwlimit, KB/sec per client, 0 is unlimited */
+int pacing = 0;			/* -pacing */
 
 char *rc_rcfile = NULL;		/* -rc */
 int rc_rcfile_default = 0;
@@ -488,6 +491,11 @@ int tile_fuzz = 2;	/* tolerance for suspecting changed tiles touching */
 			/* a known changed tile. */
 int grow_fill = 3;	/* do the grow islands heuristic with this width. */
 int gaps_fill = 4;	/* do a final pass to try to fill gaps between tiles. */
+int use_simd = 1;	/* -nosimd, use only the plain C fb kernels. */
+int scan_threads = 0;	/* -scanthreads, threads polling a mapped -rawfb. */
+int raw_fb_zerocopy = 0;	/* -zerocopy, serve a mapped -rawfb in place. */
+int scan_pipeline = 0;	/* -pipeline, fetch tile rows in a capture thread. */
+int heat_poll = 0;	/* -heatpoll n, scan cold tile rows every n-th poll */
 
 int debug_pointer = 0;
 int debug_keyboard = 0;
@@ -80,6 +80,7 @@ extern char *ssl_verify;
 extern char *ssl_crl;
 extern int ssl_initialized;
 extern int ssl_timeout_secs;
+extern int ssl_inproc;
 extern char *ssh_str;
 extern pid_t ssh_pid;
 extern int usepw;
@@ -93,6 +94,8 @@ extern char *solid_default;
 extern char *wmdt_str;
 
 extern char *speeds_str;
+extern int bw_limit;
+extern int pacing;
 extern char *rc_rcfile;
 extern int rc_rcfile_default;
 extern int rc_norc;
@@ -377,6 +380,11 @@ extern int tile_fuzz;
 
 extern int grow_fill;
 extern int gaps_fill;
+extern int use_simd;
+extern int scan_threads;
+extern int raw_fb_zerocopy;
+extern int scan_pipeline;
+extern int heat_poll;
 
 extern int debug_pointer;
 extern int debug_keyboard;
@@ -65,6 +65,8 @@ so, delete this exception statement from your version.
 #define VNC_CONNECT_MAX 16384
 #define X11VNC_REMOTE_MAX 65536
 #define PROP_MAX (262144L)
+/* largest selection we read or serve, moved in PROP_MAX pieces */
+#define SEL_MAX (64L*1024*1024)
 
 #define MAXN 256
 
@@ -50,6 +50,7 @@ so, delete this exception statement from your version.
 #include "macosx.h"
 #include "screen.h"
 #include "xi2_devices.h"
+#include "stats.h"
 
 
 int pointer_queued_sent = 0;
@@ -811,6 +812,7 @@ void pointer_event(int mask, int x, int y, rfbClientPtr client) {
 
 		last_pointer_time = now;
 		last_rfb_ptr_injected = dnow();
+		stats_pointer(client, mask, x, y);
 
 		if (blackout_ptr && blackouts) {
 			int b, ok = 1;
@@ -36,6 +36,12 @@ so, delete this exception statement from your version.
 #include "xwrappers.h"
 #include "scan.h"
 
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
 int measure_speeds = 1;
 int speeds_net_rate = 0;
 int speeds_net_rate_measured = 0;
@@ -53,11 +59,23 @@ int link_rate(int *latency, int *netrate);
 int get_net_rate(void);
 int get_net_latency(void);
 void measure_send_rates(int init);
+void bw_limit_clients(void);
+void quality_save(rfbClientPtr cl, client_quality_t *q);
+void quality_restore(rfbClientPtr cl, client_quality_t *q);
+void quality_set(rfbClientPtr cl, int level);
+void pace_clients(void);
+int pace_link_rate(int *latency, int *netrate);
 
 
 static void measure_display_hook(rfbClientPtr cl);
 static int get_rate(int which);
 static int get_latency(void);
+static void bw_restore(rfbClientPtr cl, ClientData *cd);
+static void updates_gate(rfbClientPtr cl, ClientData *cd);
+static int link_class(int latency, int netrate);
+static int sock_outq(int sock);
+static double sock_rtt(int sock);
+static void pace_release(rfbClientPtr cl, ClientData *cd);
 
 
 static void measure_display_hook(rfbClientPtr cl) {
@@ -293,13 +311,17 @@ int link_rate(int *latency, int *netrate) {
 		}
 	}
 
-	if (*latency == LATENCY0 && *netrate == NETRATE0)  {
+	return link_class(*latency, *netrate);
+}
+
+static int link_class(int latency, int netrate) {
+	if (latency == LATENCY0 && netrate == NETRATE0)  {
 		return LR_UNSET;
-	} else if (*latency > 150 || *netrate < 20) {
+	} else if (latency > 150 || netrate < 20) {
 		return LR_DIALUP;
-	} else if (*latency > 50 || *netrate < 150) {
+	} else if (latency > 50 || netrate < 150) {
 		return LR_BROADBAND;
-	} else if (*latency < 10 && *netrate > 300) {
+	} else if (latency < 10 && netrate > 300) {
 		return LR_LAN;
 	} else {
 		return LR_UNKNOWN;
@@ -728,3 +750,370 @@ if (db) fprintf(stderr, "dt3 calc: num rects req: %d/%d mod: %d/%d  "
 	}
 }
 
+
+void quality_save(rfbClientPtr cl, client_quality_t *q) {
+	q->tight = cl->tightQualityLevel;
+#if LIBVNCSERVER_HAS_TURBO
+	q->turbo = cl->turboQualityLevel;
+	q->subsamp = cl->turboSubsampLevel;
+#endif
+}
+
+void quality_restore(rfbClientPtr cl, client_quality_t *q) {
+	cl->tightQualityLevel = q->tight;
+#if LIBVNCSERVER_HAS_TURBO
+	cl->turboQualityLevel = q->turbo;
+	cl->turboSubsampLevel = q->subsamp;
+#endif
+}
+
+/*
+ * Set a 0-9 JPEG quality the way a SetEncodings quality level would.
+ * libvncserver >= 0.9.9 encodes from the turbo fields, so those get
+ * the same values its SetEncodings handler uses.
+ */
+void quality_set(rfbClientPtr cl, int level) {
+#if LIBVNCSERVER_HAS_TURBO
+	static const int turbo_qual[10] = {15, 29, 41, 42, 62, 77, 79, 86, 92, 100};
+	static const int turbo_subsamp[10] = {1, 1, 1, 2, 2, 2, 0, 0, 0, 0};
+#endif
+
+	if (level < 0) {
+		level = 0;
+	} else if (level > 9) {
+		level = 9;
+	}
+	cl->tightQualityLevel = level;
+#if LIBVNCSERVER_HAS_TURBO
+	cl->turboQualityLevel = turbo_qual[level];
+	cl->turboSubsampLevel = turbo_subsamp[level];
+#endif
+}
+
+/*
+ * Holding a client back from updates.  cl->onHold would also stop
+ * libvncserver from reading the client's input, so instead its
+ * requestedRegion is parked in cd->held_req: with no request pending
+ * nothing is sent, while the changes keep collecting in modifiedRegion
+ * and go out as one update when the request is put back.
+ */
+static void updates_gate(rfbClientPtr cl, ClientData *cd) {
+	int hold = cd->bw_held || cd->pace_held;
+
+	if (! hold && ! cd->held_req) {
+		return;
+	}
+	if (use_threads) LOCK(cl->updateMutex);
+	if (hold) {
+		if (! cd->held_req) {
+			cd->held_req = sraRgnCreate();
+		}
+		/* also catches requests that came in since the last pass */
+		sraRgnOr(cd->held_req, cl->requestedRegion);
+		sraRgnMakeEmpty(cl->requestedRegion);
+	} else {
+		sraRgnOr(cl->requestedRegion, cd->held_req);
+		sraRgnDestroy(cd->held_req);
+		cd->held_req = NULL;
+	}
+	if (use_threads) UNLOCK(cl->updateMutex);
+}
+
+static void bw_restore(rfbClientPtr cl, ClientData *cd) {
+	cd->bw_held = 0;
+	updates_gate(cl, cd);
+	if (cd->bw_degraded) {
+		quality_restore(cl, &cd->bw_quality);
+		cl->tightCompressLevel = cd->bw_compress;
+		cd->bw_degraded = 0;
+	}
+	cd->bw_time = 0.0;
+}
+
+/*
+ * -bwlimit: a token bucket per client on the encoded output.  A client
+ * that has spent its budget gets no updates (see updates_gate()); its
+ * modifiedRegion keeps growing meanwhile, so the pending changes
+ * coalesce into a single update once the bucket refills.  While over
+ * budget the Tight/ZYWRLE quality is stepped down (only if the viewer
+ * enabled JPEG) and the compression level up, so what it does get is
+ * cheaper.  The levels the viewer asked for are saved when this starts
+ * and stepped back to after it stays within budget for a while.
+ */
+void bw_limit_clients(void) {
+	static int was_limited = 0;
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	double now, rate, burst;
+
+	if (! screen) {
+		return;
+	}
+	if (bw_limit <= 0 && ! was_limited) {
+		return;
+	}
+
+	now = dnow();
+	rate = bw_limit * 1024.0;	/* bytes/sec */
+	burst = rate / 4;		/* 250ms worth */
+	if (burst < 8192) {
+		burst = 8192;
+	}
+
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		ClientData *cd = (ClientData *) cl->clientData;
+		unsigned int sent = 0;
+
+		if (! cd) {
+			continue;
+		}
+		if (bw_limit <= 0) {
+			bw_restore(cl, cd);
+			continue;
+		}
+		if (cl->state != RFB_NORMAL) {
+			continue;
+		}
+#if LIBVNCSERVER_HAS_STATS
+		sent = (unsigned int) rfbStatGetSentBytes(cl);
+#endif
+		if (cd->bw_time == 0.0) {
+			cd->bw_time = now;
+			cd->bw_ok_time = now;
+			cd->bw_sent = sent;
+			cd->bw_tokens = burst;
+			continue;
+		}
+
+		cd->bw_tokens += rate * (now - cd->bw_time);
+		cd->bw_tokens -= (double) (sent - cd->bw_sent);
+		if (cd->bw_tokens > burst) {
+			cd->bw_tokens = burst;
+		}
+		cd->bw_time = now;
+		cd->bw_sent = sent;
+
+		if (cd->bw_tokens < 0.0) {
+			if (! cd->bw_held && ! cl->onHold) {
+				cd->bw_held = 1;
+				if (! cd->bw_degraded) {
+					/* what the viewer asked for, as of now */
+					quality_save(cl, &cd->bw_quality);
+					cd->bw_compress = cl->tightCompressLevel;
+					cd->bw_degraded = 1;
+				}
+				if (cl->tightQualityLevel > 0) {
+					quality_set(cl, cl->tightQualityLevel - 2);
+				}
+				if (cl->tightCompressLevel < 9) {
+					cl->tightCompressLevel++;
+				}
+			}
+			cd->bw_ok_time = now;
+			updates_gate(cl, cd);
+			continue;
+		}
+		if (cd->bw_held) {
+			cd->bw_held = 0;
+		}
+		updates_gate(cl, cd);
+		if (cd->bw_degraded && now > cd->bw_ok_time + 2.0) {
+			/* within budget for a while, give some back */
+			if (cl->tightQualityLevel < cd->bw_quality.tight - 1) {
+				quality_set(cl, cl->tightQualityLevel + 1);
+			} else if (cl->tightCompressLevel <= cd->bw_compress + 1) {
+				quality_restore(cl, &cd->bw_quality);
+				cl->tightCompressLevel = cd->bw_compress;
+				cd->bw_degraded = 0;
+			}
+			if (cl->tightCompressLevel > cd->bw_compress) {
+				cl->tightCompressLevel--;
+			}
+			cd->bw_ok_time = now;
+		}
+	}
+	rfbReleaseClientIterator(iter);
+
+	was_limited = (bw_limit > 0);
+}
+
+/*
+ * Per client pacing.  Without it updates for a slow viewer pile up in
+ * its socket until the write blocks, stalling the main loop (or with
+ * -threads the sendMutex taken around each scan) for every viewer.
+ * Here each client's send queue depth (SIOCOUTQ), drain rate and TCP
+ * round trip time are tracked all the time, not just for the first
+ * updates as in measure_send_rates().  A client with more than its
+ * round trip plus ~100ms worth of data queued gets no updates until
+ * the queue is down to half that (see updates_gate(), its input is
+ * still read); meanwhile its changes coalesce in modifiedRegion like
+ * with -bwlimit.
+ */
+static int sock_outq(int sock) {
+	int n = 0;
+#if defined(__linux__) && defined(SIOCOUTQ)
+	if (ioctl(sock, SIOCOUTQ, &n) == 0) {
+		return n;
+	}
+#elif defined(SO_NWRITE)
+	socklen_t len = sizeof(n);
+	if (getsockopt(sock, SOL_SOCKET, SO_NWRITE, &n, &len) == 0) {
+		return n;
+	}
+#else
+	if (!sock || !n) {}
+#endif
+	return -1;
+}
+
+static double sock_rtt(int sock) {
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0 &&
+	    ti.tcpi_rtt > 0) {
+		return ti.tcpi_rtt / 1000000.0;
+	}
+#else
+	if (!sock) {}
+#endif
+	return 0.0;
+}
+
+static void pace_release(rfbClientPtr cl, ClientData *cd) {
+	if (cd->pace_held) {
+		cd->pace_held = 0;
+		updates_gate(cl, cd);
+	}
+}
+
+/*
+ * called every pass of watch_loop(), after bw_limit_clients().
+ */
+void pace_clients(void) {
+	static int was_pacing = 0;
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	double now;
+
+	if (! screen) {
+		return;
+	}
+	if (! pacing && ! was_pacing) {
+		return;
+	}
+
+	now = dnow();
+
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		ClientData *cd = (ClientData *) cl->clientData;
+		unsigned int sent = 0;
+		double limit;
+		int outq;
+
+		if (! cd) {
+			continue;
+		}
+		if (! pacing || cl->state != RFB_NORMAL) {
+			pace_release(cl, cd);
+			continue;
+		}
+		outq = sock_outq(cl->sock);
+		if (outq < 0) {
+			pace_release(cl, cd);
+			continue;
+		}
+#if LIBVNCSERVER_HAS_STATS
+		sent = (unsigned int) rfbStatGetSentBytes(cl);
+#endif
+		if (cd->pace_time == 0.0) {
+			cd->pace_time = now;
+			cd->pace_sent = sent;
+			cd->pace_outq = outq;
+			cd->pace_rate = cd->send_cmp_rate;
+			cd->pace_rtt = cd->latency;
+			continue;
+		}
+
+		if (now > cd->pace_time + 0.05) {
+			double dt = now - cd->pace_time, rtt;
+			double drained = (double) (sent - cd->pace_sent)
+			    - (outq - cd->pace_outq);
+
+			/* only a link that stayed busy shows its speed */
+			if (cd->pace_outq > 0 && outq > 0 && drained >= 0.0) {
+				double rate = drained / dt;
+				if (cd->pace_rate > 0.0) {
+					rate = 0.75 * cd->pace_rate + 0.25 * rate;
+				}
+				cd->pace_rate = rate;
+			}
+			rtt = sock_rtt(cl->sock);
+			if (rtt > 0.0) {
+				cd->pace_rtt = rtt;
+			}
+			cd->pace_time = now;
+			cd->pace_sent = sent;
+			cd->pace_outq = outq;
+		}
+
+		limit = cd->pace_rate * (cd->pace_rtt + 0.1);
+		if (limit < 32768) {
+			limit = 32768;
+		}
+		if (! cd->pace_held) {
+			if (outq > limit && ! cl->onHold) {
+				cd->pace_held = 1;
+				updates_gate(cl, cd);
+			}
+		} else if (outq <= limit / 2) {
+			pace_release(cl, cd);
+		} else {
+			/* park any request that came in meanwhile */
+			updates_gate(cl, cd);
+		}
+	}
+	rfbReleaseClientIterator(iter);
+
+	was_pacing = pacing;
+}
+
+/*
+ * Like link_rate(), but for the fastest client that keeps up.  With
+ * pacing the slower clients are held back on their own, so the poll
+ * interval can follow the best link instead of the worst one.
+ */
+int pace_link_rate(int *latency, int *netrate) {
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	double best_rate = 0.0, best_rtt = 0.0;
+
+	if (! screen || speeds_str) {
+		return link_rate(latency, netrate);
+	}
+
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		ClientData *cd = (ClientData *) cl->clientData;
+
+		if (! cd || cl->state != RFB_NORMAL || cd->pace_held) {
+			continue;
+		}
+		if (cd->pace_rate > best_rate) {
+			best_rate = cd->pace_rate;
+			best_rtt = cd->pace_rtt;
+		}
+	}
+	rfbReleaseClientIterator(iter);
+
+	if (best_rate == 0.0) {
+		return link_rate(latency, netrate);
+	}
+	*latency = (int) (1000.0 * best_rtt);
+	*netrate = (int) (best_rate / 1000.0);
+
+	return link_class(*latency, *netrate);
+}
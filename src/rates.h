@@ -51,5 +51,11 @@ extern int link_rate(int *latency, int *netrate);
 extern int get_net_rate(void);
 extern int get_net_latency(void);
 extern void measure_send_rates(int init);
+extern void bw_limit_clients(void);
+extern void quality_save(rfbClientPtr cl, client_quality_t *q);
+extern void quality_restore(rfbClientPtr cl, client_quality_t *q);
+extern void quality_set(rfbClientPtr cl, int level);
+extern void pace_clients(void);
+extern int pace_link_rate(int *latency, int *netrate);
 
 #endif /* _X11VNC_RATES_H */
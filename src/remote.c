@@ -60,6 +60,8 @@ so, delete this exception statement from your version.
 #include "userinput.h"
 #include "avahi.h"
 #include "sslhelper.h"
+#include "stats.h"
+#include "video.h"
 
 int send_remote_cmd(char *cmd, int query, int wait);
 int do_remote_query(char *remote_cmd, char *query_cmd, int remote_sync,
@@ -4801,6 +4803,20 @@ char *process_remote_cmd(char *cmd, int stringonly) {
 		waitms = w;
 		goto done;
 	}
+	if (strstr(p, "heatpoll") == p) {
+		int n;
+		COLON_CHECK("heatpoll:")
+		if (query) {
+			snprintf(buf, bufn, "ans=%s%s%d", p, co, heat_poll);
+			goto qry;
+		}
+		p += strlen("heatpoll:");
+		n = atoi(p);
+		if (n < 0) n = 0;
+		rfbLog("remote_cmd: setting heatpoll %d -> %d.\n", heat_poll, n);
+		heat_poll = n;
+		goto done;
+	}
 	if (strstr(p, "readtimeout") == p) {
 		int w, orig = rfbMaxClientWait;
 		COLON_CHECK("readtimeout:")
@@ -6090,6 +6106,56 @@ char *process_remote_cmd(char *cmd, int stringonly) {
 			snprintf(buf, bufn, "aro=%s:%d", p, client_count);
 			goto qry;
 		}
+		if (!strcmp(p, "video_regions")) {
+			char *str = video_regions_str();
+			snprintf(buf, bufn, "aro=%s:%s", p, NONUL(str));
+			if (str) free(str);
+			goto qry;
+		}
+		if (!strcmp(p, "heatmap")) {
+			char *str = heat_map_str();
+			snprintf(buf, bufn, "aro=%s:%s", p, str);
+			free(str);
+			goto qry;
+		}
+		if (!strcmp(p, "latency")) {
+			/* count,p50,p95,p99 in msec over all clients */
+			stats_snapshot_t *snap = (stats_snapshot_t *)
+			    malloc(sizeof(stats_snapshot_t));
+			if (! snap) {
+				snprintf(buf, bufn, "aro=%s:", p);
+				goto qry;
+			}
+			stats_get(snap);
+			snprintf(buf, bufn, "aro=%s:%llu,%.1f,%.1f,%.1f", p,
+			    snap->lat_count, snap->lat_p50, snap->lat_p95,
+			    snap->lat_p99);
+			free(snap);
+			goto qry;
+		}
+		if (!strcmp(p, "latency_clients")) {
+			/* id:host:count,p50,p95,p99;... */
+			stats_snapshot_t *snap = (stats_snapshot_t *)
+			    malloc(sizeof(stats_snapshot_t));
+			int i, len;
+			if (! snap) {
+				snprintf(buf, bufn, "aro=%s:", p);
+				goto qry;
+			}
+			stats_get(snap);
+			snprintf(buf, bufn, "aro=%s:", p);
+			for (i=0; i < snap->nclients; i++) {
+				stats_client_t *sc = &snap->clients[i];
+				len = strlen(buf);
+				snprintf(buf + len, bufn - len,
+				    "%s0x%x:%s:%llu,%.1f,%.1f,%.1f",
+				    i ? ";" : "", sc->uid, sc->host,
+				    sc->lat_count, sc->lat_p50, sc->lat_p95,
+				    sc->lat_p99);
+			}
+			free(snap);
+			goto qry;
+		}
 		if (!strcmp(p, "pid")) {
 			snprintf(buf, bufn, "aro=%s:%d", p, (int) getpid());
 			goto qry;
@@ -46,6 +46,12 @@ so, delete this exception statement from your version.
 #include "screen.h"
 #include "macosx.h"
 #include "userinput.h"
+#include "simd.h"
+#include "scan.h"
+#include "shmfb.h"
+#include "scrolldet.h"
+#include "tilecache.h"
+#include "video.h"
 
 /*
  * routines for scanning and reading the X11 display for changes, and
@@ -66,11 +72,29 @@ int copy_snap(void);
 void nap_sleep(int ms, int split);
 void set_offset(void);
 int scan_for_updates(int count_only);
+void scan_timing_reset(void);
+char *heat_map_str(void);
+int heat_cold_diffs(int x, int y, int r);
 void rotate_curs(char *dst_0, char *src_0, int Dx, int Dy, int Bpp);
 void rotate_coords(int x, int y, int *xo, int *yo, int dxi, int dyi);
 void rotate_coords_inverse(int x, int y, int *xo, int *yo, int dxi, int dyi);
 void rotate_cursor_coords(int x, int y, int *xo, int *yo, int dxi, int dyi);
 
+/* work arrays for copy_tiles(), one set per thread doing the copying. */
+typedef struct tile_scratch {
+	int *first_line, *last_line;
+	unsigned short *left_diff, *right_diff;
+	int size;
+	int direct;	/* read the -rawfb mapping in place */
+} tile_scratch_t;
+
+#define SCAN_THREADS_MAX 64
+
+enum {
+	SCAN_JOB_SCAN,
+	SCAN_JOB_COPY
+};
+
 static void set_fs_factor(int max);
 static char *flip_ximage_byte_order(XImage *xim);
 static int shm_create(XShmSegmentInfo *shm, XImage **ximg_ptr, int w, int h,
@@ -78,38 +102,98 @@ static int shm_create(XShmSegmentInfo *shm, XImage **ximg_ptr, int w, int h,
 static void create_tile_hint(int x, int y, int tw, int th, hint_t *hint);
 static void extend_tile_hint(int x, int y, int tw, int th, hint_t *hint);
 static void save_hint(hint_t hint, int loc);
+static int tile_diff_next(int n, int end);
+static int tile_diff_prev(int n, int start);
+static int tile_diff_count(void);
 static void hint_updates(void);
 static void mark_hint(hint_t hint);
+static void tile_scratch_alloc(tile_scratch_t *ts);
 static int copy_tiles(int tx, int ty, int nt);
+static int copy_tiles_scratch(int tx, int ty, int nt, tile_scratch_t *ts);
 static int copy_all_tiles(void);
 static int copy_all_tile_runs(void);
+static int copy_tile_runs_band(int ty0, int ty1, tile_scratch_t *ts,
+    int *spill, int *nspill);
+static char *rawfb_direct_addr(int x, int y, int *bpl);
+static unsigned long long zc_hash(char *p, int len);
+static int zc_line_diff(char *src, int x, int y, int w, int update,
+    int *left, int *right);
+static void zc_rehash_all(void);
 static int copy_tiles_backward_pass(void);
 static int copy_tiles_additional_pass(void);
-static int gap_try(int x, int y, int *run, int *saw, int along_x);
+static int gap_copy(int x, int y, int gap, int along_x);
 static int fill_tile_gaps(void);
-static int island_try(int x, int y, int u, int v, int *run);
+static int island_grow(int row, int *x, int run, int dx);
 static int grow_islands(void);
 static void blackout_regions(void);
 static void nap_set(int tile_cnt);
 static void nap_check(int tile_cnt);
 static void ping_clients(int tile_cnt);
+static void phase_add(int phase, double *t0);
 static int blackout_line_skip(int n, int x, int y, int rescan,
     int *tile_count);
 static int blackout_line_cmpskip(int n, int x, int y, char *dst, char *src,
     int w, int pixelsize);
+static int span_has_diff(char *dst, char *src, int off, int len, int lo,
+    int hi);
 static int scan_display(int ystart, int rescan);
+static int heat_plan(void);
+static void heat_update(void);
+static void rot_steps(int Dx, int Dy, int Bpp, int rbl, long *base,
+    int *sx, int *sy);
+static void rot_pixels(char *dst, int sx, int sy, char *src, int sbl,
+    int w, int h, int Bpp);
+static void rot_rect(char *dst_0, int rbl, char *src_0, int fbl,
+    int x1, int y1, int x2, int y2, int Dx, int Dy, int Bpp);
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+static int scan_threads_ok(void);
+static int scan_threads_run(int job, int ystart, int rescan);
+static int capture_ok(void);
+static void capture_request(int ty);
+static int capture_get(int y, char **src, int *bpl);
+static void capture_flush(void);
+#endif
 
 
 /* array to hold the hints: */
 static hint_t *hint_list;
 
+/*
+ * Per phase timing of scan_for_updates(), off unless something like
+ * x11vnc_bench turns it on.  The dnow() calls are all it costs.
+ */
+int scan_timing = 0;
+double scan_phase_time[SCAN_PHASE_MAX];
+int scan_phase_calls[SCAN_PHASE_MAX];
+long scan_tiles_fetched = 0;
+
+#define PHASE_BEGIN	if (scan_timing) phase_t0 = dnow()
+#define PHASE_END(p)	if (scan_timing) phase_add(p, &phase_t0)
+
 /* nap state */
 int nap_ok = 0;
 static int nap_diff_count = 0;
 
 static int scan_count = 0;	/* indicates which scan pattern we are on  */
+static int copy_screen_nomark = 0;
 static int scan_in_progress = 0;	
 
+/*
+ * Per tile change frequency: an exponential average of tile_has_diff
+ * over the polls, 16 bit fixed point.  With -heatpoll n the tile rows
+ * where no tile is hot are left out of the first scan_display() pass
+ * except on every n-th poll.
+ */
+static unsigned short *tile_heat = NULL;
+static unsigned char *heat_row_skip = NULL;
+static unsigned char *heat_cold = NULL;	/* changed now, was not hot */
+static int tile_heat_n = 0;
+static int heat_cycle = 0;
+static int heat_scan = 0;	/* scan_display() may use heat_row_skip[] */
+
+#define HEAT_SHIFT	4		/* 1/16 per poll */
+#define HEAT_HOT	(65535 >> 6)	/* about 1/4 of a recent change */
+
 
 typedef struct tile_change_region {
 	/* start and end lines, along y, of the changed area inside a tile. */
@@ -123,6 +207,14 @@ typedef struct tile_change_region {
 /* array to hold the tiles region_t-s. */
 static region_t *tile_region;
 
+/*
+ * -zerocopy keeps no copy of the framebuffer to compare against.
+ * Instead each line of each tile has three hashes: the left tile_fuzz
+ * pixels, the middle, and the right tile_fuzz pixels, the last two
+ * giving the edge diffs copy_tiles() records.  0 means never seen.
+ */
+static unsigned long long *tile_line_hash = NULL;
+
 
 
 
@@ -137,6 +229,8 @@ void initialize_tiles(void) {
 
 	tile_has_diff = (unsigned char *)
 		calloc((size_t) (ntiles * sizeof(unsigned char)), 1);
+	tile_diff_bits = (unsigned long long *)
+		calloc((size_t) (TILE_BITS_WORDS * sizeof(unsigned long long)), 1);
 	tile_has_xdamage_diff = (unsigned char *)
 		calloc((size_t) (ntiles * sizeof(unsigned char)), 1);
 	tile_row_has_xdamage_diff = (unsigned char *)
@@ -156,6 +250,11 @@ void initialize_tiles(void) {
 
 	/* there will never be more hints than tiles: */
 	hint_list = (hint_t *) calloc((size_t) (ntiles * sizeof(hint_t)), 1);
+
+	if (rawfb_zerocopy) {
+		tile_line_hash = (unsigned long long *) calloc((size_t)
+		    (3 * ntiles_x * dpy_y * sizeof(unsigned long long)), 1);
+	}
 }
 
 void free_tiles(void) {
@@ -163,6 +262,10 @@ void free_tiles(void) {
 		free(tile_has_diff);
 		tile_has_diff = NULL;
 	}
+	if (tile_diff_bits) {
+		free(tile_diff_bits);
+		tile_diff_bits = NULL;
+	}
 	if (tile_has_xdamage_diff) {
 		free(tile_has_xdamage_diff);
 		tile_has_xdamage_diff = NULL;
@@ -199,6 +302,10 @@ void free_tiles(void) {
 		free(hint_list);
 		hint_list = NULL;
 	}
+	if (tile_line_hash) {
+		free(tile_line_hash);
+		tile_line_hash = NULL;
+	}
 }
 
 /*
@@ -434,6 +541,11 @@ void initialize_polling_images(void) {
 	snaprect_shm.shmid	= -1;
 	snaprect_shm.shmaddr	= (char *) -1;
 	snaprect		= NULL;
+	for (i=0; i < 2; i++) {
+		capture_row_shm[i].shmid	= -1;
+		capture_row_shm[i].shmaddr	= (char *) -1;
+		capture_row[i]			= NULL;
+	}
 	for (i=1; i<=ntiles_x; i++) {
 		tile_row_shm[i].shmid	= -1;
 		tile_row_shm[i].shmaddr	= (char *) -1;
@@ -478,6 +590,21 @@ void initialize_polling_images(void) {
 		}
 	}
 
+	/*
+	 * -pipeline: two full width tile rows for the capture thread to
+	 * fetch into while copy_tiles() works on the other one.
+	 */
+	if (scan_pipeline && ! raw_fb) {
+		for (i=0; i < 2; i++) {
+			if (! shm_create(&capture_row_shm[i], &capture_row[i],
+			    dpy_x, tile_y, "capture_row")) {
+				rfbLog("warning: disabling -pipeline.\n");
+				scan_pipeline = 0;
+				break;
+			}
+		}
+	}
+
 	/*
 	 * for copy_tiles we need a lot of shared memory areas, one for
 	 * each possible run length of changed tiles.  32 for 1024x768
@@ -578,51 +705,130 @@ static void save_hint(hint_t hint, int loc) {
 	hint_list[loc].h = hint.h;
 }
 
+/*
+ * The passes over tile_has_diff[] below usually find only a handful of
+ * changed tiles among thousands, so they walk tile_diff_bits[] (see
+ * TILE_DIFF() in x11vnc.h) instead: tile_diff_next() returns the first
+ * n <= i < end with tile_has_diff[i] set (end if none), tile_diff_prev()
+ * the last start <= i <= n (start - 1 if none).  An empty word skips 64
+ * tiles and a set bit is found with one count-zeros instruction.
+ *
+ * tile_tried[] and tile_copied[] stay byte maps: they are only looked
+ * up tile by tile, never walked.
+ */
+#if defined(__GNUC__)
+#define TILE_CTZ(w)	__builtin_ctzll(w)
+#define TILE_CLZ(w)	__builtin_clzll(w)
+#else
+static int tile_ctz(unsigned long long w) {
+	int i = 0;
+	while (! (w & 1)) {
+		w >>= 1;
+		i++;
+	}
+	return i;
+}
+static int tile_clz(unsigned long long w) {
+	int i = 0;
+	while (! (w & (1ULL << 63))) {
+		w <<= 1;
+		i++;
+	}
+	return i;
+}
+#define TILE_CTZ(w)	tile_ctz(w)
+#define TILE_CLZ(w)	tile_clz(w)
+#endif
+
+static int tile_diff_next(int n, int end) {
+	unsigned long long w;
+	int k;
+
+	if (n >= end) {
+		return end;
+	}
+	k = n >> 6;
+	w = tile_diff_bits[k] & (~0ULL << (n & 63));
+	while (! w) {
+		if (++k << 6 >= end) {
+			return end;
+		}
+		w = tile_diff_bits[k];
+	}
+	n = (k << 6) + TILE_CTZ(w);
+	return n < end ? n : end;
+}
+
+static int tile_diff_prev(int n, int start) {
+	unsigned long long w;
+	int k;
+
+	if (n < start) {
+		return start - 1;
+	}
+	k = n >> 6;
+	w = tile_diff_bits[k] & (~0ULL >> (63 - (n & 63)));
+	while (! w) {
+		if (--k < 0 || (k << 6) + 63 < start) {
+			return start - 1;
+		}
+		w = tile_diff_bits[k];
+	}
+	n = (k << 6) + 63 - TILE_CLZ(w);
+	return n >= start ? n : start - 1;
+}
+
+static int tile_diff_count(void) {
+	int n, count = 0;
+
+	for (n = tile_diff_next(0, ntiles); n < ntiles;
+	    n = tile_diff_next(n + 1, ntiles)) {
+		count++;
+	}
+	return count;
+}
+
 /*
  * Glue together horizontal "runs" of adjacent changed tiles into one big
  * rectangle change "hint" to be passed to the vnc machinery.
  */
 static void hint_updates(void) {
 	hint_t hint;
-	int x, y, i, n, ty, th, tx, tw;
+	int x, y, i, n, ty, th, tx, tw, row, end;
 	int hint_count = 0, in_run = 0;
 
 	hint.x = hint.y = hint.w = hint.h = 0;
 
 	for (y=0; y < ntiles_y; y++) {
-		for (x=0; x < ntiles_x; x++) {
-			n = x + y * ntiles_x;
-
-			if (tile_has_diff[n]) {
-				ty = tile_region[n].first_line;
-				th = tile_region[n].last_line - ty + 1;
-
-				tx = tile_region[n].first_x;
-				tw = tile_region[n].last_x - tx + 1;
-				if (tx < 0) {
-					tx = 0;
-					tw = tile_x;
-				}
+		row = y * ntiles_x;
+		end = row + ntiles_x;
+		for (n = tile_diff_next(row, end); n < end;
+		    n = tile_diff_next(n + 1, end)) {
+			x = n - row;
+
+			ty = tile_region[n].first_line;
+			th = tile_region[n].last_line - ty + 1;
+
+			tx = tile_region[n].first_x;
+			tw = tile_region[n].last_x - tx + 1;
+			if (tx < 0) {
+				tx = 0;
+				tw = tile_x;
+			}
 
-				if (! in_run) {
-					create_tile_hint( x * tile_x + tx,
-					    y * tile_y + ty, tw, th, &hint);
-					in_run = 1;
-				} else {
-					extend_tile_hint( x * tile_x + tx,
-					    y * tile_y + ty, tw, th, &hint);
-				}
+			if (! in_run) {
+				create_tile_hint( x * tile_x + tx,
+				    y * tile_y + ty, tw, th, &hint);
+				in_run = 1;
 			} else {
-				if (in_run) {
-					/* end of a row run of altered tiles: */
-					save_hint(hint, hint_count++);
-					in_run = 0;
-				}
+				extend_tile_hint( x * tile_x + tx,
+				    y * tile_y + ty, tw, th, &hint);
+			}
+			if (n + 1 == end || ! tile_has_diff[n + 1]) {
+				/* end of a row run of altered tiles: */
+				save_hint(hint, hint_count++);
+				in_run = 0;
 			}
-		}
-		if (in_run) {	/* save the last row run */
-			save_hint(hint, hint_count++);
-			in_run = 0;
 		}
 	}
 
@@ -639,6 +845,120 @@ static void hint_updates(void) {
 	(double) ((int) (x)) : (double) ((int) (x) + 1) )
 #define FLOOR(x) ( (double) ((int) (x)) )
 
+/*
+ * Fixed point box filter weights for the 32bpp shrink case of
+ * scale_rect(), one table per axis.  The weights are the same
+ * integration weights as the double loop below uses, scaled so each
+ * dest pixel's add up to exactly SCALE_ONE.  They only depend on
+ * (factor, N, n), so the last few tables are kept around: the screen
+ * x and y axes and the cursor's, typically.
+ */
+#define SCALE_TAPS_CACHE 4
+
+static void free_scale_taps(scale_taps_t *t) {
+	if (t->first) free(t->first);
+	if (t->count) free(t->count);
+	if (t->woff) free(t->woff);
+	if (t->w) free(t->w);
+	memset(t, 0, sizeof(*t));
+}
+
+static int build_scale_taps(scale_taps_t *t, double factor, int N, int n) {
+	double d = 1.0/factor, x1, x2, wd[256], wsum;
+	int i, I, I1, I2, c, k, big, tot, max, nw = 0;
+
+	max = (int) CEIL(d) + 1;
+	if (max > 256) {
+		return 0;
+	}
+	t->first = (int *) malloc(n * sizeof(int));
+	t->count = (int *) malloc(n * sizeof(int));
+	t->woff  = (int *) malloc(n * sizeof(int));
+	t->w = (unsigned short *) malloc(n * max * sizeof(unsigned short));
+	if (! t->first || ! t->count || ! t->woff || ! t->w) {
+		free_scale_taps(t);
+		return 0;
+	}
+
+	for (i=0; i < n; i++) {
+		x1 = i * d;
+		if (x1 > N - 1) {
+			x1 = N - 1;
+		}
+		x2 = x1 + d;
+		I1 = (int) FLOOR(x1);
+		if (I1 >= N) I1 = N - 1;
+		I2 = (int) CEIL(x2) - 1;
+		if (I2 >= N) I2 = N - 1;
+
+		c = I2 - I1 + 1;
+		if (c < 1 || c > max) {
+			free_scale_taps(t);
+			return 0;
+		}
+		wsum = 0.0;
+		for (I=I1; I <= I2; I++) {
+			if (I < x1) {
+				wd[I-I1] = I+1 - x1;
+			} else if (I+1 > x2) {
+				wd[I-I1] = x2 - I;
+			} else {
+				wd[I-I1] = 1.0;
+			}
+			wsum += wd[I-I1];
+		}
+		if (wsum <= 0.0) {
+			wsum = 1.0;
+		}
+		/* round, then give the remainder to the largest weight */
+		tot = 0;
+		big = 0;
+		for (k=0; k < c; k++) {
+			t->w[nw+k] = (unsigned short)
+			    (SCALE_ONE * wd[k] / wsum + 0.5);
+			tot += t->w[nw+k];
+			if (t->w[nw+k] > t->w[nw+big]) {
+				big = k;
+			}
+		}
+		t->w[nw+big] += SCALE_ONE - tot;
+
+		t->first[i] = I1;
+		t->count[i] = c;
+		t->woff[i] = nw;
+		nw += c;
+	}
+	t->factor = factor;
+	t->N = N;
+	t->n = n;
+	return 1;
+}
+
+static scale_taps_t *get_scale_taps(double factor, int N, int n,
+    scale_taps_t *keep) {
+	static scale_taps_t cache[SCALE_TAPS_CACHE];
+	static int next = 0;
+	scale_taps_t *t;
+	int i;
+
+	for (i=0; i < SCALE_TAPS_CACHE; i++) {
+		t = &cache[i];
+		if (t->w && t->factor == factor && t->N == N && t->n == n) {
+			return t;
+		}
+	}
+	if (&cache[next] == keep) {
+		next = (next + 1) % SCALE_TAPS_CACHE;
+	}
+	t = &cache[next];
+	next = (next + 1) % SCALE_TAPS_CACHE;
+	free_scale_taps(t);
+	if (! build_scale_taps(t, factor, N, n)) {
+		return NULL;
+	}
+	return t;
+}
+
 /*
  * Scaling:
  *
@@ -964,6 +1284,51 @@ void scale_rect(double factor_x, double factor_y, int blend, int interpolate, in
 		goto markit;
 	}
 
+	/*
+	 * 32bpp blended shrink, the usual -scale case: fixed point with
+	 * the cached weight tables, one source line at a time through
+	 * fb_scale_acc32() (SIMD when available).
+	 */
+	if (shrink && blend && ! interpolate && Bpp == 4 && i2 > i1) {
+		static unsigned int *acc = NULL;
+		static int acc_len = 0;
+		scale_taps_t *tx, *ty;
+
+		tx = get_scale_taps(factor_x, Nx, nx, NULL);
+		ty = get_scale_taps(factor_y, Ny, ny, tx);
+		if (tx && ty) {
+			int len = 4 * (i2 - i1), n;
+
+			if (len > acc_len) {
+				if (acc) free(acc);
+				acc = (unsigned int *) malloc(len *
+				    sizeof(unsigned int));
+				acc_len = acc ? len : 0;
+			}
+			if (acc) {
+				for (j=j1; j<j2; j++) {
+					unsigned short *wj = ty->w + ty->woff[j];
+
+					memset(acc, 0, len * sizeof(unsigned int));
+					src = src_fb + ty->first[j] *
+					    src_bytes_per_line;
+					for (n=0; n < ty->count[j]; n++) {
+						fb_scale_acc32(acc, src, tx,
+						    i1, i2, wj[n]);
+						src += src_bytes_per_line;
+					}
+					dest = dst_fb + j*dst_bytes_per_line
+					    + i1*Bpp;
+					for (k=0; k < len; k++) {
+						dest[k] = (char)
+						    ((acc[k] + (1 << 20)) >> 21);
+					}
+				}
+				goto markit;
+			}
+		}
+	}
+
 	/* set these all to 1.0 to begin with */
 	wx = 1.0;
 	wy = 1.0;
@@ -1469,34 +1834,136 @@ void rotate_coords_inverse(int x, int y, int *xo, int *yo, int dxi, int dyi) {
 	}
 }
 
-	/* unroll the Bpp loop to be used in each case: */
-#define ROT_COPY \
-	src = src_0 + fbl*y  + Bpp*x;  \
-	dst = dst_0 + rbl*yn + Bpp*xn; \
-	if (Bpp == 1) { \
-		*(dst) = *(src);	 \
-	} else if (Bpp == 2) { \
-		*(dst+0) = *(src+0);	 \
-		*(dst+1) = *(src+1);	 \
-	} else if (Bpp == 3) { \
-		*(dst+0) = *(src+0);	 \
-		*(dst+1) = *(src+1);	 \
-		*(dst+2) = *(src+2);	 \
-	} else if (Bpp == 4) { \
-		*(dst+0) = *(src+0);	 \
-		*(dst+1) = *(src+1);	 \
-		*(dst+2) = *(src+2);	 \
-		*(dst+3) = *(src+3);	 \
+/*
+ * Every -rotate mode puts source pixel (x, y) at base + x*sx + y*sy
+ * bytes into the rotated buffer (rbl bytes per line, Dx x Dy the
+ * unrotated size).  For X, Y and XY sx is +-Bpp and lines stay lines;
+ * the 90 degree ones are transposes with sx = +-rbl, sy = +-Bpp.
+ */
+static void rot_steps(int Dx, int Dy, int Bpp, int rbl, long *base,
+    int *sx, int *sy) {
+	*base = 0;
+	*sx = Bpp;
+	*sy = rbl;
+	if (rotating == ROTATE_X) {
+		*base = (long) Bpp * (Dx - 1);
+		*sx = -Bpp;
+	} else if (rotating == ROTATE_Y) {
+		*base = (long) rbl * (Dy - 1);
+		*sy = -rbl;
+	} else if (rotating == ROTATE_XY) {
+		*base = (long) rbl * (Dy - 1) + Bpp * (Dx - 1);
+		*sx = -Bpp;
+		*sy = -rbl;
+	} else if (rotating == ROTATE_90) {
+		*base = (long) Bpp * (Dy - 1);
+		*sx = rbl;
+		*sy = -Bpp;
+	} else if (rotating == ROTATE_90X) {
+		*sx = rbl;
+		*sy = Bpp;
+	} else if (rotating == ROTATE_90Y) {
+		*base = (long) rbl * (Dx - 1) + Bpp * (Dy - 1);
+		*sx = -rbl;
+		*sy = -Bpp;
+	} else if (rotating == ROTATE_270) {
+		*base = (long) rbl * (Dx - 1);
+		*sx = -rbl;
+		*sy = Bpp;
+	}
+}
+
+/* w x h pixels from src to dst, sx and sy as in rot_steps() */
+static void rot_pixels(char *dst, int sx, int sy, char *src, int sbl,
+    int w, int h, int Bpp) {
+	int i, j;
+
+	for (j = 0; j < h; j++) {
+		char *s = src + sbl * j, *d = dst + sy * j;
+
+		/* fixed size memcpy()s become single moves */
+		switch (Bpp) {
+		case 1:
+			for (i = 0; i < w; i++, s += 1, d += sx) {
+				*d = *s;
+			}
+			break;
+		case 2:
+			for (i = 0; i < w; i++, s += 2, d += sx) {
+				memcpy(d, s, 2);
+			}
+			break;
+		case 3:
+			for (i = 0; i < w; i++, s += 3, d += sx) {
+				memcpy(d, s, 3);
+			}
+			break;
+		case 4:
+			for (i = 0; i < w; i++, s += 4, d += sx) {
+				memcpy(d, s, 4);
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * The 90 degree modes read along source lines but write down columns
+ * of the destination, so a pixel at a time each write lands on a new
+ * cache line and, on big screens, a new page.  Strips ROT_STRIP source
+ * columns wide make that ROT_STRIP destination lines written front to
+ * back, ROT_BLOCK rows at a time.  32bpp strips go through the SIMD
+ * transpose kernels.
+ */
+#define ROT_STRIP 8
+#define ROT_BLOCK 256
+
+static void rot_rect(char *dst_0, int rbl, char *src_0, int fbl,
+    int x1, int y1, int x2, int y2, int Dx, int Dy, int Bpp) {
+	int bx, by, w, h, sx, sy;
+	long base;
+	char *src, *dst;
+
+	if (x2 <= x1 || y2 <= y1) {
+		return;
+	}
+	rot_steps(Dx, Dy, Bpp, rbl, &base, &sx, &sy);
+
+	if (sx == Bpp) {
+		/* ROTATE_Y: whole lines, just in another order */
+		for (by = y1; by < y2; by++) {
+			memcpy(dst_0 + base + (long) sx * x1 + (long) sy * by,
+			    src_0 + (long) fbl * by + Bpp * x1,
+			    (size_t) Bpp * (x2 - x1));
+		}
+		return;
+	}
+	if (sx == -Bpp) {
+		/* ROTATE_X, ROTATE_XY: lines reversed, still sequential */
+		rot_pixels(dst_0 + base + (long) sx * x1 + (long) sy * y1,
+		    sx, sy, src_0 + (long) fbl * y1 + Bpp * x1, fbl,
+		    x2 - x1, y2 - y1, Bpp);
+		return;
+	}
+
+	for (bx = x1; bx < x2; bx += ROT_STRIP) {
+		w = x2 - bx < ROT_STRIP ? x2 - bx : ROT_STRIP;
+		for (by = y1; by < y2; by += ROT_BLOCK) {
+			h = y2 - by < ROT_BLOCK ? y2 - by : ROT_BLOCK;
+			src = src_0 + (long) fbl * by + Bpp * bx;
+			dst = dst_0 + base + (long) sx * bx + (long) sy * by;
+			if (Bpp == 4) {
+				fb_transpose32(dst, sx, sy < 0, src, fbl, w, h);
+			} else {
+				rot_pixels(dst, sx, sy, src, fbl, w, h, Bpp);
+			}
+		}
 	}
+}
 
 void rotate_fb(int x1, int y1, int x2, int y2) {
-	int x, y, xn, yn, r_x1, r_y1, r_x2, r_y2, Bpp = bpp/8;
-	int fbl = rfb_bytes_per_line;
-	int rbl = rot_bytes_per_line;
+	int Bpp = bpp/8;
 	int Dx, Dy;
-	char *src, *dst;
-	char *src_0 = rfb_fb;
-	char *dst_0 = rot_fb;
 
 	if (! rotating || ! rot_fb) {
 		return;
@@ -1509,73 +1976,12 @@ void rotate_fb(int x1, int y1, int x2, int y2) {
 		Dx = dpy_x;
 		Dy = dpy_y;
 	}
-	rotate_coords(x1, y1, &r_x1, &r_y1, -1, -1);
-	rotate_coords(x2, y2, &r_x2, &r_y2, -1, -1);
 
-	dst = rot_fb;
-
-	if (rotating == ROTATE_X) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = Dx - x - 1;
-				yn = y;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_Y) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = x;
-				yn = Dy - y - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_XY) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = Dx - x - 1;
-				yn = Dy - y - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = Dy - y - 1;
-				yn = x;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90X) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = y;
-				yn = x;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90Y) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = Dy - y - 1;
-				yn = Dx - x - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_270) {
-		for (y = y1; y < y2; y++)  {
-			for (x = x1; x < x2; x++)  {
-				xn = y;
-				yn = Dx - x - 1;
-				ROT_COPY
-			}
-		}
-	}
+	rot_rect(rot_fb, rot_bytes_per_line, rfb_fb, rfb_bytes_per_line,
+	    x1, y1, x2, y2, Dx, Dy, Bpp);
 }
 
 void rotate_curs(char *dst_0, char *src_0, int Dx, int Dy, int Bpp) {
-	int x, y, xn, yn;
-	char *src, *dst;
 	int fbl, rbl;
 
 	if (! rotating) {
@@ -1589,64 +1995,7 @@ void rotate_curs(char *dst_0, char *src_0, int Dx, int Dy, int Bpp) {
 		rbl = Dy * Bpp;
 	}
 
-	if (rotating == ROTATE_X) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = Dx - x - 1;
-				yn = y;
-				ROT_COPY
-if (0) fprintf(stderr, "rcurs: %d %d  %d %d\n", x, y, xn, yn);
-			}
-		}
-	} else if (rotating == ROTATE_Y) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = x;
-				yn = Dy - y - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_XY) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = Dx - x - 1;
-				yn = Dy - y - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = Dy - y - 1;
-				yn = x;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90X) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = y;
-				yn = x;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_90Y) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = Dy - y - 1;
-				yn = Dx - x - 1;
-				ROT_COPY
-			}
-		}
-	} else if (rotating == ROTATE_270) {
-		for (y = 0; y < Dy; y++)  {
-			for (x = 0; x < Dx; x++)  {
-				xn = y;
-				yn = Dx - x - 1;
-				ROT_COPY
-			}
-		}
-	}
+	rot_rect(dst_0, rbl, src_0, fbl, 0, 0, Dx, Dy, Dx, Dy, Bpp);
 }
 
 void mark_wrapper(int x1, int y1, int x2, int y2) {
@@ -1738,42 +2087,59 @@ static void mark_hint(hint_t hint) {
  * devices are optimized for write, not read, so we are limited by the
  * read bandwidth, sometimes only 5 MB/sec on otherwise fast hardware.
  */
-static int *first_line = NULL, *last_line = NULL;
-static unsigned short *left_diff = NULL, *right_diff = NULL;
+static tile_scratch_t tile_scratch = {NULL, NULL, NULL, NULL, 0, 0};
+
+static void tile_scratch_alloc(tile_scratch_t *ts) {
+	int n = ntiles_x + 1;
+
+	if (ts->size == n && ts->first_line != NULL) {
+		return;
+	}
+	if (ts->first_line != NULL) {
+		free(ts->first_line);
+		free(ts->last_line);
+		free(ts->left_diff);
+		free(ts->right_diff);
+	}
+	/* allocate arrays first time in. */
+	rfbLog("copy_tiles: allocating first_line at size %d\n", n);
+	ts->first_line = (int *) malloc((size_t) (n * sizeof(int)));
+	ts->last_line  = (int *) malloc((size_t) (n * sizeof(int)));
+	ts->left_diff  = (unsigned short *)
+		malloc((size_t) (n * sizeof(unsigned short)));
+	ts->right_diff = (unsigned short *)
+		malloc((size_t) (n * sizeof(unsigned short)));
+	ts->size = n;
+}
 
 static int copy_tiles(int tx, int ty, int nt) {
+	return copy_tiles_scratch(tx, ty, nt, &tile_scratch);
+}
+
+/*
+ * ts holds the per-caller work arrays.  If ts->direct is set the source
+ * is read in place from the memory mapped -rawfb (see -scanthreads)
+ * instead of being copied into tile_row[nt] first.
+ */
+static int copy_tiles_scratch(int tx, int ty, int nt, tile_scratch_t *ts) {
 	int x, y, line;
 	int size_x, size_y, width1, width2;
 	int off, len, n, dw, dx, t;
 	int w1, w2, dx1, dx2;	/* tmps for normal and short tiles */
 	int pixelsize = bpp/8;
-	int first_min, last_max;
+	int first_min, last_max, src_bpl;
 	int first_x = -1, last_x = -1;
-	static int prev_ntiles_x = -1;
+	int *first_line, *last_line;
+	unsigned short *left_diff, *right_diff;
 
-	char *src, *dst, *s_src, *s_dst, *m_src, *m_dst;
-	char *h_src, *h_dst;
+	char *src, *dst, *s_src, *s_dst;
 	if (unixpw_in_progress) return 0;
 
-	if (ntiles_x != prev_ntiles_x && first_line != NULL) {
-		free(first_line);	first_line = NULL;
-		free(last_line);	last_line = NULL;
-		free(left_diff);	left_diff = NULL;
-		free(right_diff);	right_diff = NULL;
-	}
-
-	if (first_line == NULL) {
-		/* allocate arrays first time in. */
-		int n = ntiles_x + 1;
-		rfbLog("copy_tiles: allocating first_line at size %d\n", n);
-		first_line = (int *) malloc((size_t) (n * sizeof(int)));
-		last_line  = (int *) malloc((size_t) (n * sizeof(int)));
-		left_diff  = (unsigned short *)
-			malloc((size_t) (n * sizeof(unsigned short)));
-		right_diff = (unsigned short *)
-			malloc((size_t) (n * sizeof(unsigned short)));
-	}
-	prev_ntiles_x = ntiles_x;
+	tile_scratch_alloc(ts);
+	first_line = ts->first_line;
+	last_line  = ts->last_line;
+	left_diff  = ts->left_diff;
+	right_diff = ts->right_diff;
 
 	x = tx * tile_x;
 	y = ty * tile_y;
@@ -1802,49 +2168,61 @@ static int copy_tiles(int tx, int ty, int nt) {
 		 * no need to poll screen or do anything else..
 		 * n.b. we are in single copy_tile mode: nt=1
 		 */
-		tile_has_diff[n] = 0;
+		TILE_DIFF(n, 0);
 		return(0);
 	}
 
-	X_LOCK;
-	XRANDR_SET_TRAP_RET(-1, "copy_tile-set");
-	/* read in the whole tile run at once: */
-	copy_image(tile_row[nt], x, y, size_x, size_y);
-	XRANDR_CHK_TRAP_RET(-1, "copy_tile-chk");
-
+	if (ts->direct || rawfb_zerocopy) {
+		src = rawfb_direct_addr(x, y, &src_bpl);
+	} else {
+		if (capture_get(y, &src, &src_bpl)) {
+			/* -pipeline already has the whole row */
+			src += x * pixelsize;
+		} else {
+			X_LOCK;
+			XRANDR_SET_TRAP_RET(-1, "copy_tile-set");
+			/* read in the whole tile run at once: */
+			copy_image(tile_row[nt], x, y, size_x, size_y);
+			XRANDR_CHK_TRAP_RET(-1, "copy_tile-chk");
 
-	X_UNLOCK;
 
-	if (blackouts && tile_blackout[n].cover == 1) {
-		/*
-		 * If there are blackouts and this tile is partially covered
-		 * we should re-black-out the portion.
-		 * n.b. we are in single copy_tile mode: nt=1
-		 */
-		int x1, x2, y1, y2, b;
-		int w, s, fill = 0;
+			X_UNLOCK;
 
-		for (b=0; b < tile_blackout[n].count; b++) {
-			char *b_dst = tile_row[nt]->data;
-			
-			x1 = tile_blackout[n].bo[b].x1 - x;
-			y1 = tile_blackout[n].bo[b].y1 - y;
-			x2 = tile_blackout[n].bo[b].x2 - x;
-			y2 = tile_blackout[n].bo[b].y2 - y;
+			src = tile_row[nt]->data;
+			src_bpl = tile_row[nt]->bytes_per_line;
+		}
 
-			w = (x2 - x1) * pixelsize;
-			s = x1 * pixelsize;
+		if (blackouts && tile_blackout[n].cover == 1) {
+			/*
+			 * If there are blackouts and this tile is partially
+			 * covered we should re-black-out the portion.
+			 * n.b. we are in single copy_tile mode: nt=1
+			 */
+			int x1, x2, y1, y2, b;
+			int w, s, fill = 0;
 
-			for (line = 0; line < size_y; line++) {
-				if (y1 <= line && line < y2) {
-					memset(b_dst + s, fill, (size_t) w);
+			for (b=0; b < tile_blackout[n].count; b++) {
+				char *b_dst = src;
+			
+				x1 = tile_blackout[n].bo[b].x1 - x;
+				y1 = tile_blackout[n].bo[b].y1 - y;
+				x2 = tile_blackout[n].bo[b].x2 - x;
+				y2 = tile_blackout[n].bo[b].y2 - y;
+
+				w = (x2 - x1) * pixelsize;
+				s = x1 * pixelsize;
+
+				for (line = 0; line < size_y; line++) {
+					if (y1 <= line && line < y2) {
+						memset(b_dst + s, fill,
+						    (size_t) w);
+					}
+					b_dst += src_bpl;
 				}
-				b_dst += tile_row[nt]->bytes_per_line;
 			}
 		}
 	}
 
-	src = tile_row[nt]->data;
 	dst = main_fb + y * main_bytes_per_line + x * pixelsize;
 
 	s_src = src;
@@ -1852,49 +2230,91 @@ static int copy_tiles(int tx, int ty, int nt) {
 
 	for (t=1; t <= nt; t++) {
 		first_line[t] = -1;
+		last_line[t] = -1;
+		left_diff[t] = 0;
+		right_diff[t] = 0;
 	}
 
-	/* find the first line with difference: */
 	w1 = width1 * pixelsize;
 	w2 = width2 * pixelsize;
 
+	dx1 = (width1 - tile_fuzz) * pixelsize;
+	dx2 = (width2 - tile_fuzz) * pixelsize;
+	dw = tile_fuzz * pixelsize; 
+
+	/*
+	 * One pass over the tile run: for each line and tile
+	 * fb_diff_span() gives the first and last differing byte,
+	 * from which we get the first and last changed lines and
+	 * whether the left and right edges (within tile_fuzz) differ.
+	 */
+
 	/* foreach line: */
 	for (line = 0; line < size_y; line++) {
 		/* foreach horizontal tile: */
 		for (t=1; t <= nt; t++) {
-			if (first_line[t] != -1) {
-				continue;
-			}
+			int lo, hi, left, right;
 
 			off = (t-1) * w1;
 			if (t == nt) {
 				len = w2;	/* possible short tile */
+				dx = dx2;
 			} else {
 				len = w1;
+				dx = dx1;
 			}
-			
-			if (memcmp(s_dst + off, s_src + off, len)) {
+
+			if (rawfb_zerocopy) {
+				if (! zc_line_diff(s_src + off, x + (t-1) * tile_x,
+				    y + line, len / pixelsize, 1, &left, &right)) {
+					continue;
+				}
+			} else {
+				if (! fb_diff_span(s_dst + off, s_src + off, len,
+				    &lo, &hi)) {
+					continue;
+				}
+				left = (lo < dw);
+				right = (hi >= dx);
+			}
+			if (first_line[t] == -1) {
 				first_line[t] = line;
 			}
+			last_line[t] = line;
+
+			if (dx <= 0) {
+				/* short tile, no edges to check */
+				continue;
+			}
+			if (left) {
+				left_diff[t] = 1;
+			}
+			if (right) {
+				right_diff[t] = 1;
+			}
 		}
-		s_src += tile_row[nt]->bytes_per_line;
+		s_src += src_bpl;
 		s_dst += main_bytes_per_line;
 	}
 
 	/* see if there were any differences for any tile: */
 	first_min = -1;
+	last_max = -1;
 	for (t=1; t <= nt; t++) {
 		tile_tried[n+(t-1)] = 1;
 		if (first_line[t] != -1) {
 			if (first_min == -1 || first_line[t] < first_min) {
 				first_min = first_line[t];
 			}
+			if (last_max == -1 || last_line[t] > last_max) {
+				last_max = last_line[t];
+			}
 		}
 	}
 	if (first_min == -1) {
 		/* no tile has a difference, note this and get out: */
 		for (t=1; t <= nt; t++) {
-			tile_has_diff[n+(t-1)] = 0;
+			TILE_DIFF(n+(t-1), 0);
 		}
 		return(0);
 	} else {
@@ -1905,147 +2325,24 @@ static int copy_tiles(int tx, int ty, int nt) {
 		 */
 		for (t=1; t <= nt; t++) {
 			if (first_line[t] == -1) {
-				tile_has_diff[n+(t-1)] = 0;
+				TILE_DIFF(n+(t-1), 0);
 			} else {
-				tile_has_diff[n+(t-1)] = 1;
+				TILE_DIFF(n+(t-1), 1);
 			}
 		}
 	}
 
-	m_src = src + (tile_row[nt]->bytes_per_line * size_y);
-	m_dst = dst + (main_bytes_per_line * size_y);
+	/* now finally copy the difference to the rfb framebuffer: */
+	if (! rawfb_zerocopy) {
+		s_src = src + src_bpl * first_min;
+		s_dst = dst + main_bytes_per_line * first_min;
 
-	for (t=1; t <= nt; t++) {
-		last_line[t] = first_line[t];
-	}
-
-	/* find the last line with difference: */
-	w1 = width1 * pixelsize;
-	w2 = width2 * pixelsize;
-
-	/* foreach line: */
-	for (line = size_y - 1; line > first_min; line--) {
-
-		m_src -= tile_row[nt]->bytes_per_line;
-		m_dst -= main_bytes_per_line;
-
-		/* foreach tile: */
-		for (t=1; t <= nt; t++) {
-			if (first_line[t] == -1
-			    || last_line[t] != first_line[t]) {
-				/* tile has no changes or already done */
-				continue;
-			}
-
-			off = (t-1) * w1;
-			if (t == nt) {
-				len = w2;	/* possible short tile */
-			} else {
-				len = w1;
-			}
-			if (memcmp(m_dst + off, m_src + off, len)) {
-				last_line[t] = line;
-			}
-		}
-	}
-	
-	/*
-	 * determine the farthest down last changed line
-	 * will be used below to limit our memcpy() to the framebuffer.
-	 */
-	last_max = -1;
-	for (t=1; t <= nt; t++) {
-		if (first_line[t] == -1) {
-			continue;
-		}
-		if (last_max == -1 || last_line[t] > last_max) {
-			last_max = last_line[t];
-		}
-	}
-
-	/* look for differences on left and right hand edges: */
-	for (t=1; t <= nt; t++) {
-		left_diff[t] = 0;
-		right_diff[t] = 0;
-	}
-
-	h_src = src;
-	h_dst = dst;
-
-	w1 = width1 * pixelsize;
-	w2 = width2 * pixelsize;
-
-	dx1 = (width1 - tile_fuzz) * pixelsize;
-	dx2 = (width2 - tile_fuzz) * pixelsize;
-	dw = tile_fuzz * pixelsize; 
-
-	/* foreach line: */
-	for (line = 0; line < size_y; line++) {
-		/* foreach tile: */
-		for (t=1; t <= nt; t++) {
-			if (first_line[t] == -1) {
-				/* tile has no changes at all */
-				continue;
-			}
-
-			off = (t-1) * w1;
-			if (t == nt) {
-				dx = dx2;	/* possible short tile */
-				if (dx <= 0) {
-					break;
-				}
-			} else {
-				dx = dx1;
-			}
-
-			if (! left_diff[t] && memcmp(h_dst + off,
-			    h_src + off, dw)) {
-				left_diff[t] = 1;
-			}
-			if (! right_diff[t] && memcmp(h_dst + off + dx,
-			    h_src + off + dx, dw) ) {
-				right_diff[t] = 1;
-			}
-		}
-		h_src += tile_row[nt]->bytes_per_line;
-		h_dst += main_bytes_per_line;
-	}
-
-	/* now finally copy the difference to the rfb framebuffer: */
-	s_src = src + tile_row[nt]->bytes_per_line * first_min;
-	s_dst = dst + main_bytes_per_line * first_min;
-
-	for (line = first_min; line <= last_max; line++) {
-		/* for I/O speed we do not do this tile by tile */
-		memcpy(s_dst, s_src, (size_t)size_x * pixelsize);
-		if (nt == 1) {
-			/*
-			 * optimization for tall skinny lines, e.g. wm
-			 * frame. try to find first_x and last_x to limit
-			 * the size of the hint.  could help for a slow
-			 * link.  Unfortunately we spent a lot of time
-			 * reading in the many tiles.
-			 *
-			 * BTW, we like to think the above memcpy leaves
-			 * the data we use below in the cache... (but
-			 * it could be two 128 byte segments at 32bpp)
-			 * so this inner loop is not as bad as it seems.
-			 */
-			int k, kx;
-			kx = pixelsize;
-			for (k=0; k<size_x; k++) {
-				if (memcmp(s_dst + k*kx, s_src + k*kx, kx))  {
-					if (first_x == -1 || k < first_x) {
-						first_x = k;
-					}
-					if (last_x == -1 || k > last_x) {
-						last_x = k;
-					}
-				}
-			}
+		for (line = first_min; line <= last_max; line++) {
+			/* for I/O speed we do not do this tile by tile */
+			memcpy(s_dst, s_src, (size_t)size_x * pixelsize);
+			s_src += src_bpl;
+			s_dst += main_bytes_per_line;
 		}
-		s_src += tile_row[nt]->bytes_per_line;
-		s_dst += main_bytes_per_line;
 	}
 
 	/* record all the info in the region array for this tile: */
@@ -2099,36 +2396,35 @@ static int copy_all_tiles(void) {
 
 	if (unixpw_in_progress) return 0;
 
-	for (y=0; y < ntiles_y; y++) {
-		for (x=0; x < ntiles_x; x++) {
-			n = x + y * ntiles_x;
+	/* the guesses below are all ahead of n, so the skip finds them */
+	for (n = tile_diff_next(0, ntiles); n < ntiles;
+	    n = tile_diff_next(n + 1, ntiles)) {
+		x = n % ntiles_x;
+		y = n / ntiles_x;
 
-			if (tile_has_diff[n]) {
-				ct = copy_tiles(x, y, 1);
-				if (ct < 0) return ct;	/* fatal */
-			}
-			if (! tile_has_diff[n]) {
-				/*
-				 * n.b. copy_tiles() may have detected
-				 * no change and reset tile_has_diff to 0.
-				 */
-				continue;
-			}
-			diffs++;
+		ct = copy_tiles(x, y, 1);
+		if (ct < 0) return ct;	/* fatal */
+		if (! tile_has_diff[n]) {
+			/*
+			 * n.b. copy_tiles() may have detected
+			 * no change and reset tile_has_diff to 0.
+			 */
+			continue;
+		}
+		diffs++;
 
-			/* neighboring tile downward: */
-			if ( (y+1) < ntiles_y && tile_region[n].bot_diff) {
-				m = x + (y+1) * ntiles_x;
-				if (! tile_has_diff[m]) {
-					tile_has_diff[m] = 2;
-				}
+		/* neighboring tile downward: */
+		if ( (y+1) < ntiles_y && tile_region[n].bot_diff) {
+			m = x + (y+1) * ntiles_x;
+			if (! tile_has_diff[m]) {
+				TILE_DIFF(m, 2);
 			}
-			/* neighboring tile to right: */
-			if ( (x+1) < ntiles_x && tile_region[n].right_diff) {
-				m = (x+1) + y * ntiles_x;
-				if (! tile_has_diff[m]) {
-					tile_has_diff[m] = 2;
-				}
+		}
+		/* neighboring tile to right: */
+		if ( (x+1) < ntiles_x && tile_region[n].right_diff) {
+			m = (x+1) + y * ntiles_x;
+			if (! tile_has_diff[m]) {
+				TILE_DIFF(m, 2);
 			}
 		}
 	}
@@ -2140,66 +2436,84 @@ static int copy_all_tiles(void) {
  * of adjacent changed tiles.
  */
 static int copy_all_tile_runs(void) {
-	int x, y, n, m, i;
+	return copy_tile_runs_band(0, ntiles_y, &tile_scratch, NULL, NULL);
+}
+
+/*
+ * Does the tile rows ty0 <= y < ty1.  If spill is non-NULL, downward
+ * guesses that cross into row ty1 are stored there (*nspill of them)
+ * rather than set in tile_has_diff[], since another thread owns that row.
+ */
+static int copy_tile_runs_band(int ty0, int ty1, tile_scratch_t *ts,
+    int *spill, int *nspill) {
+	int x, y, n, m, i, row;
 	int diffs = 0, ct;
-	int in_run = 0, run = 0;
+	int run = 0;
 	int ntave = 0, ntcnt = 0;
+	int pipe;
 
 	if (unixpw_in_progress) return 0;
 
-	for (y=0; y < ntiles_y; y++) {
-		for (x=0; x < ntiles_x + 1; x++) {
-			n = x + y * ntiles_x;
+	/* -pipeline: the capture thread stays one tile row ahead */
+	pipe = (spill == NULL && ! ts->direct && capture_ok());
+	if (pipe) {
+		capture_request(ty0);
+	}
 
-			if (x != ntiles_x && tile_has_diff[n]) {
-				in_run = 1;
+	for (y=ty0; y < ty1; y++) {
+		if (pipe && y+1 < ty1) {
+			capture_request(y+1);
+		}
+		row = y * ntiles_x;
+		x = tile_diff_next(row, row + ntiles_x) - row;
+		while (x < ntiles_x) {
+			/* the run of changed tiles starting at x: */
+			run = 1;
+			while (x + run < ntiles_x && tile_has_diff[row + x + run]) {
 				run++;
-			} else {
-				if (! in_run) {
-					in_run = 0;
-					run = 0;
-					continue;
-				}
-				ct = copy_tiles(x - run, y, run);
-				if (ct < 0) return ct;	/* fatal */
+			}
+			ct = copy_tiles_scratch(x, y, run, ts);
+			if (ct < 0) {
+				if (pipe) capture_flush();
+				return ct;	/* fatal */
+			}
 
-				ntcnt++;
-				ntave += run;
-				diffs += run;
-
-				/* neighboring tile downward: */
-				for (i=1; i <= run; i++) {
-					if ((y+1) < ntiles_y
-					    && tile_region[n-i].bot_diff) {
-						m = (x-i) + (y+1) * ntiles_x;
-						if (! tile_has_diff[m]) {
-							tile_has_diff[m] = 2;
-						}
-					}
-				}
+			ntcnt++;
+			ntave += run;
+			diffs += run;
 
-				/* neighboring tile to right: */
-				if (((x-1)+1) < ntiles_x
-				    && tile_region[n-1].right_diff) {
-					m = ((x-1)+1) + y * ntiles_x;
-					if (! tile_has_diff[m]) {
-						tile_has_diff[m] = 2;
+			x += run;	/* first tile past the run */
+			n = row + x;
+
+			/* neighboring tile downward: */
+			for (i=1; i <= run; i++) {
+				if ((y+1) < ntiles_y
+				    && tile_region[n-i].bot_diff) {
+					m = (x-i) + (y+1) * ntiles_x;
+					if (spill && y+1 >= ty1) {
+						spill[(*nspill)++] = m;
+					} else if (! tile_has_diff[m]) {
+						TILE_DIFF(m, 2);
 					}
-					
-					/* note that this starts a new run */
-					in_run = 1;
-					run = 1;
-				} else {
-					in_run = 0;
-					run = 0;
 				}
 			}
+
+			/* neighboring tile to right: */
+			if (x < ntiles_x && tile_region[n-1].right_diff) {
+				/* note that this starts a new run at x */
+				TILE_DIFF(n, 2);
+			} else if (x < ntiles_x) {
+				x = tile_diff_next(n + 1, row + ntiles_x) - row;
+			}
 		}
 		/*
 		 * Could some activity go here, to emulate threaded
 		 * behavior by servicing some libvncserver tasks?
 		 */
 	}
+	if (pipe) {
+		capture_flush();
+	}
 	return diffs;
 }
 
@@ -2231,7 +2545,7 @@ static int copy_tiles_backward_pass(void) {
 
 		if (y >= 1 && ! tile_has_diff[m] && tile_region[n].top_diff) {
 			if (! tile_tried[m]) {
-				tile_has_diff[m] = 2;
+				TILE_DIFF(m, 2);
 				ct = copy_tiles(x, y-1, 1);
 				if (ct < 0) return ct;	/* fatal */
 			}
@@ -2241,7 +2555,7 @@ static int copy_tiles_backward_pass(void) {
 
 		if (x >= 1 && ! tile_has_diff[m] && tile_region[n].left_diff) {
 			if (! tile_tried[m]) {
-				tile_has_diff[m] = 2;
+				TILE_DIFF(m, 2);
 				ct = copy_tiles(x-1, y, 1);
 				if (ct < 0) return ct;	/* fatal */
 			}
@@ -2285,24 +2599,74 @@ static int copy_tiles_additional_pass(void) {
 	return diffs;
 }
 
-static int gap_try(int x, int y, int *run, int *saw, int along_x) {
-	int n, m, i, xt, yt, ct;
+/*
+ * Look for small gaps of unchanged tiles that may actually contain changes.
+ * E.g. when paging up and down in a web broswer or terminal there can
+ * be a distracting delayed filling in of such gaps.  gaps_fill is the
+ * tweak parameter that sets the width of the gaps that are checked.
+ *
+ * BTW, grow_islands() is actually pretty successful at doing this too...
+ */
+static int fill_tile_gaps(void) {
+	static int *last = NULL, last_n = 0;
+	int x, y, n, p, row, end;
+	int ct;
+
+	if (last_n < ntiles_x) {
+		if (last) free(last);
+		last = (int *) malloc(ntiles_x * sizeof(int));
+		last_n = ntiles_x;
+	}
+	for (x=0; x < ntiles_x; x++) {
+		last[x] = -1;
+	}
 
-	n = x + y * ntiles_x;
+	for (y=0; y < ntiles_y; y++) {
+		row = y * ntiles_x;
+		end = row + ntiles_x;
+
+		/* horizontal: the gaps between changed tiles in the row */
+		p = -1;
+		for (n = tile_diff_next(row, end); n < end;
+		    n = tile_diff_next(n + 1, end)) {
+			if (p >= 0) {
+				ct = gap_copy(n - row, y, n - p - 1, 1);
+				if (ct < 0) return ct;	/* fatal */
+			}
+			p = n;
+		}
 
-	if (! tile_has_diff[n]) {
-		if (*saw) {
-			(*run)++;	/* extend the gap run. */
+		/*
+		 * vertical: the gaps up to the last changed tile in each
+		 * column, done a row at a time instead of a column at a
+		 * time so the skip works.  Only tiles above this row are
+		 * copied, so the result is the same.
+		 */
+		for (n = tile_diff_next(row, end); n < end;
+		    n = tile_diff_next(n + 1, end)) {
+			x = n - row;
+			if (last[x] >= 0) {
+				ct = gap_copy(x, y, y - last[x] - 1, 0);
+				if (ct < 0) return ct;	/* fatal */
+			}
+			last[x] = y;
 		}
-		return 0;
 	}
-	if (! *saw || *run == 0 || *run > gaps_fill) {
-		*run = 0;		/* unacceptable run. */
-		*saw = 1;
+
+	return tile_diff_count();
+}
+
+/*
+ * The gap of unchanged tiles just left of, or just above, the changed
+ * tile (x, y) is gap long.  Check it if it is short enough.
+ */
+static int gap_copy(int x, int y, int gap, int along_x) {
+	int i, m, xt, yt, ct;
+
+	if (gap <= 0 || gap > gaps_fill) {
 		return 0;
 	}
-
-	for (i=1; i <= *run; i++) {	/* iterate thru the run. */
+	for (i=1; i <= gap; i++) {	/* iterate thru the run. */
 		if (along_x) {
 			xt = x - i;
 			yt = y;
@@ -2319,75 +2683,32 @@ static int gap_try(int x, int y, int *run, int *saw, int along_x) {
 		ct = copy_tiles(xt, yt, 1);
 		if (ct < 0) return ct;	/* fatal */
 	}
-	*run = 0;
-	*saw = 1;
 	return 1;
 }
 
 /*
- * Look for small gaps of unchanged tiles that may actually contain changes.
- * E.g. when paging up and down in a web broswer or terminal there can
- * be a distracting delayed filling in of such gaps.  gaps_fill is the
- * tweak parameter that sets the width of the gaps that are checked.
- *
- * BTW, grow_islands() is actually pretty successful at doing this too...
+ * A run of run changed tiles ends at *x in the tile row starting at
+ * row; try the unchanged tiles past it in direction dx for as long as
+ * they turn out changed.  *x is left where the extension stopped.
  */
-static int fill_tile_gaps(void) {
-	int x, y, run, saw;
-	int n, diffs = 0, ct;
-
-	/* horizontal: */
-	for (y=0; y < ntiles_y; y++) {
-		run = 0;
-		saw = 0;
-		for (x=0; x < ntiles_x; x++) {
-			ct = gap_try(x, y, &run, &saw, 1);
-			if (ct < 0) return ct;	/* fatal */
-		}
-	}
-
-	/* vertical: */
-	for (x=0; x < ntiles_x; x++) {
-		run = 0;
-		saw = 0;
-		for (y=0; y < ntiles_y; y++) {
-			ct = gap_try(x, y, &run, &saw, 0);
-			if (ct < 0) return ct;	/* fatal */
-		}
-	}
+static int island_grow(int row, int *x, int run, int dx) {
+	int u, ct;
 
-	for (n=0; n < ntiles; n++) {
-		if (tile_has_diff[n]) {
-			diffs++;
+	for (u = *x + dx; u >= 0 && u < ntiles_x; u += dx, run++) {
+		if (tile_has_diff[row + u]) {
+			continue;	/* ran into the next island */
 		}
-	}
-	return diffs;
-}
-
-static int island_try(int x, int y, int u, int v, int *run) {
-	int n, m, ct;
-
-	n = x + y * ntiles_x;
-	m = u + v * ntiles_x;
-
-	if (tile_has_diff[n]) {
-		(*run)++;
-	} else {
-		*run = 0;
-	}
-
-	if (tile_has_diff[n] && ! tile_has_diff[m]) {
 		/* found a discontinuity */
-
-		if (tile_tried[m]) {
-			return 0;
-		} else if (*run < grow_fill) {
-			return 0;
+		if (tile_tried[row + u] || run < grow_fill) {
+			break;
 		}
-
-		ct = copy_tiles(u, v, 1);
+		ct = copy_tiles(u, row / ntiles_x, 1);
 		if (ct < 0) return ct;	/* fatal */
+		if (! tile_has_diff[row + u]) {
+			break;
+		}
 	}
+	*x = u;
 	return 1;
 }
 
@@ -2397,8 +2718,7 @@ static int island_try(int x, int y, int u, int v, int *run) {
  * Vertical scans are skipped since they do not seem to yield much...
  */
 static int grow_islands(void) {
-	int x, y, n, run;
-	int diffs = 0, ct;
+	int x, y, n, run, row, end, ct;
 
 	/*
 	 * n.b. the way we scan here should keep an extension going,
@@ -2407,26 +2727,34 @@ static int grow_islands(void) {
 
 	/* left to right: */
 	for (y=0; y < ntiles_y; y++) {
-		run = 0;
-		for (x=0; x <= ntiles_x - 2; x++) {
-			ct = island_try(x, y, x+1, y, &run);
+		row = y * ntiles_x;
+		end = row + ntiles_x;
+		n = tile_diff_next(row, end);
+		while (n < end) {
+			for (run = 1; n + 1 < end && tile_has_diff[n+1]; run++) {
+				n++;
+			}
+			x = n - row;
+			ct = island_grow(row, &x, run, 1);
 			if (ct < 0) return ct;	/* fatal */
+			n = tile_diff_next(row + x, end);
 		}
 	}
 	/* right to left: */
 	for (y=0; y < ntiles_y; y++) {
-		run = 0;
-		for (x = ntiles_x - 1; x >= 1; x--) {
-			ct = island_try(x, y, x-1, y, &run);
+		row = y * ntiles_x;
+		n = tile_diff_prev(row + ntiles_x - 1, row);
+		while (n >= row) {
+			for (run = 1; n - 1 >= row && tile_has_diff[n-1]; run++) {
+				n--;
+			}
+			x = n - row;
+			ct = island_grow(row, &x, run, -1);
 			if (ct < 0) return ct;	/* fatal */
+			n = tile_diff_prev(row + x, row);
 		}
 	}
-	for (n=0; n < ntiles; n++) {
-		if (tile_has_diff[n]) {
-			diffs++;
-		}
-	}
-	return diffs;
+	return tile_diff_count();
 }
 
 /*
@@ -2461,6 +2789,13 @@ int copy_screen(void) {
 		return 0;
 	}
 
+	if (rawfb_zerocopy) {
+		/* the clients already see the mapping, no copy needed */
+		zc_rehash_all();
+		mark_rect_as_modified(0, 0, dpy_x, dpy_y, 0);
+		return 0;
+	}
+
 	block_size = ((dpy_y/fs_factor) * main_bytes_per_line);
 
 	fbp = main_fb;
@@ -2486,7 +2821,9 @@ int copy_screen(void) {
 		blackout_regions();
 	}
 
-	mark_rect_as_modified(0, 0, dpy_x, dpy_y, 0);
+	if (! copy_screen_nomark) {
+		mark_rect_as_modified(0, 0, dpy_x, dpy_y, 0);
+	}
 	return 0;
 }
 
@@ -2712,7 +3049,7 @@ static void snap_vcsa_rawfb(void) {
 
 static void snap_all_rawfb(void) {
 	int pixelsize = bpp/8;
-	int n, sz;
+	int sz;
 	char *dst;
 	static char *unclipped_dst = NULL;
 	static int unclipped_len = 0;
@@ -2740,23 +3077,10 @@ static void snap_all_rawfb(void) {
 		memcpy(dst, raw_fb_addr + raw_fb_offset, sz);
 
 	} else {
-		int len = sz, del = 0;
-		off_t off = (off_t) raw_fb_offset;
-
-		lseek(raw_fb_fd, off, SEEK_SET);
-		while (len > 0) {
-			n = read(raw_fb_fd, dst + del, len);
-			if (n > 0) {
-				del += n;
-				len -= n;
-			} else if (n == 0) {
-				break;
-			} else if (errno != EINTR && errno != EAGAIN) {
-				break;
-			}
-		}
+		raw_fb_read_rows(dst, sz, (off_t) raw_fb_offset, sz, sz, 1);
 	}
 
+
 	if (dst == unclipped_dst) {
 		char *src;
 		int h;
@@ -3082,7 +3406,7 @@ static int blackout_line_skip(int n, int x, int y, int rescan,
     int *tile_count) {
 	
 	if (tile_blackout[n].cover == 2) {
-		tile_has_diff[n] = 0;
+		TILE_DIFF(n, 0);
 		return 1;	/* skip it */
 
 	} else if (tile_blackout[n].cover == 1) {
@@ -3112,7 +3436,7 @@ static int blackout_line_skip(int n, int x, int y, int rescan,
 		}
 		if (hit) {
 			if (! rescan) {
-				tile_has_diff[n] = 0;
+				TILE_DIFF(n, 0);
 			} else {
 				*tile_count += tile_has_diff[n];
 			}
@@ -3194,6 +3518,22 @@ void set_offset(void) {
 
 static int xd_samples = 0, xd_misses = 0, xd_do_check = 0;
 
+/*
+ * Whether the len bytes at offset off of a scanline differ, given
+ * the first (lo) and last (hi) differing bytes of the whole line.
+ * Only segments strictly between them need to be compared.
+ */
+static int span_has_diff(char *dst, char *src, int off, int len, int lo,
+    int hi) {
+	if (lo < 0 || off + len <= lo || off > hi) {
+		return 0;
+	}
+	if (off <= lo || off + len > hi) {
+		return 1;
+	}
+	return memcmp(dst, src, (size_t) len) ? 1 : 0;
+}
+
 /*
  * Loop over 1-pixel tall horizontal scanlines looking for changes.  
  * Record the changes in tile_has_diff[].  Scanlines in the loop are
@@ -3202,11 +3542,11 @@ static int xd_samples = 0, xd_misses = 0, xd_do_check = 0;
  */
 
 static int scan_display(int ystart, int rescan) {
-	char *src, *dst;
+	char *src, *dst, *line_src;
 	int pixelsize = bpp/8;
-	int x, y, w, n;
+	int x, y, w, n, bpl, diff;
 	int tile_count = 0;
-	int nodiffs = 0, diff_hint;
+	int nodiffs = 0, diff_hint, lo, hi;
 	int xd_check = 0, xd_freq = 1;
 	static int xd_tck = 0;
 
@@ -3219,10 +3559,22 @@ static int scan_display(int ystart, int rescan) {
 		return 0;
 	}
 
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	if (scan_threads_ok()) {
+		return scan_threads_run(SCAN_JOB_SCAN, ystart, rescan);
+	}
+#endif
+
 	X_LOCK;
 
 	while (y < dpy_y) {
 
+		if (heat_scan && heat_row_skip[y/tile_y]) {
+			/* cold tile row, not its turn (-heatpoll) */
+			y += NSCAN;
+			continue;
+		}
+
 		if (use_xdamage) {
 			XD_tot++;
 			xd_check = 0;
@@ -3296,16 +3648,28 @@ if (ncdb) fprintf(stderr, "\n*** SCAN_DISPLAY CHECK_NCACHE/%d *** %d rescan=%d\n
 }
 #endif
 
-		XRANDR_SET_TRAP_RET(-1, "scan_display-set");
-		copy_image(scanline, 0, y, 0, 0);
-		XRANDR_CHK_TRAP_RET(-1, "scan_display-chk");
+		if (rawfb_zerocopy) {
+			/* hashed tile by tile below, nothing to copy */
+			line_src = rawfb_direct_addr(0, y, &bpl);
+			lo = 0;
+			hi = main_bytes_per_line - 1;
+		} else {
+			XRANDR_SET_TRAP_RET(-1, "scan_display-set");
+			copy_image(scanline, 0, y, 0, 0);
+			XRANDR_CHK_TRAP_RET(-1, "scan_display-chk");
+			line_src = scanline->data;
+		}
 
 		/* for better memory i/o try the whole line at once */
-		src = scanline->data;
+		src = line_src;
 		dst = main_fb + y * main_bytes_per_line;
 
-		if (! memcmp(dst, src, main_bytes_per_line)) {
+		if (rawfb_zerocopy) {
+			;
+		} else if (! fb_diff_span(dst, src, main_bytes_per_line,
+		    &lo, &hi)) {
 			/* no changes anywhere in scan line */
+			lo = hi = -1;
 			nodiffs = 1;
 			if (! rescan) {
 				y += NSCAN;
@@ -3342,7 +3706,7 @@ if (ncdb) fprintf(stderr, "\n*** SCAN_DISPLAY CHECK_NCACHE/%d *** %d rescan=%d\n
 			}
 
 			/* set ptrs to correspond to the x offset: */
-			src = scanline->data + x * pixelsize;
+			src = line_src + x * pixelsize;
 			dst = main_fb + y * main_bytes_per_line + x * pixelsize;
 
 			/* compute the width of data to be compared: */
@@ -3352,17 +3716,25 @@ if (ncdb) fprintf(stderr, "\n*** SCAN_DISPLAY CHECK_NCACHE/%d *** %d rescan=%d\n
 				w = NSCAN;
 			}
 
-			if (diff_hint || memcmp(dst, src, (size_t)w * pixelsize)) {
+			if (diff_hint) {
+				diff = 1;
+			} else if (rawfb_zerocopy) {
+				diff = zc_line_diff(src, x, y, w, 0, NULL, NULL);
+			} else {
+				diff = span_has_diff(dst, src, x * pixelsize,
+				    w * pixelsize, lo, hi);
+			}
+			if (diff) {
 				/* found a difference, record it: */
 				if (! blackouts) {
-					tile_has_diff[n] = 1;
+					TILE_DIFF(n, 1);
 					tile_count++;		
 				} else {
 					if (blackout_line_cmpskip(n, x, y,
 					    dst, src, w, pixelsize)) {
-						tile_has_diff[n] = 0;
+						TILE_DIFF(n, 0);
 					} else {
-						tile_has_diff[n] = 1;
+						TILE_DIFF(n, 1);
 						tile_count++;		
 					}
 				}
@@ -3377,42 +3749,749 @@ if (ncdb) fprintf(stderr, "\n*** SCAN_DISPLAY CHECK_NCACHE/%d *** %d rescan=%d\n
 	return tile_count;
 }
 
-
-int scanlines[NSCAN] = {
-	 0, 16,  8, 24,  4, 20, 12, 28,
-	10, 26, 18,  2, 22,  6, 30, 14,
-	 1, 17,  9, 25,  7, 23, 15, 31,
-	19,  3, 27, 11, 29, 13,  5, 21
-};
-
 /*
- * toplevel for the scanning, rescanning, and applying the heuristics.
- * returns number of changed tiles.
+ * Address of pixel (x, y) in a memory mapped -rawfb (map: or shm:),
+ * the same location copy_raw_fb() would copy from.
  */
-int scan_for_updates(int count_only) {
-	int i, tile_count, tile_diffs;
-	int old_copy_tile;
-	double frac1 = 0.1;   /* tweak parameter to try a 2nd scan_display() */
-	double frac2 = 0.35;  /* or 3rd */
-	double frac3 = 0.02;  /* do scan_display() again after copy_tiles() */
-	static double last_poll = 0.0;
+static char *rawfb_direct_addr(int x, int y, int *bpl) {
+	int pixelsize = bpp/8;
 
-	if (unixpw_in_progress) return 0;
- 
-	if (slow_fb > 0.0) {
-		double now = dnow();
-		if (now < last_poll + slow_fb) {
-			return 0;
+	*bpl = raw_fb_bytes_per_line;
+	if (clipshift) {
+		x += coff_x;
+		y += coff_y;
+		if (wdpy_x != cdpy_x) {
+			*bpl = wdpy_x * pixelsize;
 		}
-		last_poll = now;
 	}
+	return raw_fb_addr + raw_fb_offset + (*bpl) * y + pixelsize * x;
+}
 
-	for (i=0; i < ntiles; i++) {
+/*
+ * 64 bit multiply/xorshift hash over 8 byte words; never returns 0.
+ */
+static unsigned long long zc_hash(char *p, int len) {
+	unsigned long long h = 0x9e3779b97f4a7c15ULL ^ (unsigned) len, w;
+
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 29;
+		p += 8;
+		len -= 8;
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, p, (size_t) len);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 29;
+	}
+	return h | 1;
+}
+
+/*
+ * -zerocopy version of comparing w pixels of line y at the tile
+ * boundary x against main_fb: src (the mapping at x, y) is hashed and
+ * compared to tile_line_hash[].  With update set the new hashes are
+ * stored, which stands in for copying the pixels into main_fb.
+ * left/right (if not NULL) tell whether the tile_fuzz edges changed.
+ */
+static int zc_line_diff(char *src, int x, int y, int w, int update,
+    int *left, int *right) {
+	unsigned long long h[3], *s;
+	int pixelsize = bpp/8;
+	int dw = tile_fuzz * pixelsize, len = w * pixelsize;
+	int l, m, r;
+
+	s = tile_line_hash + 3 * (y * ntiles_x + x / tile_x);
+	if (dw > 0 && len > 2 * dw) {
+		h[0] = zc_hash(src, dw);
+		h[1] = zc_hash(src + dw, len - 2 * dw);
+		h[2] = zc_hash(src + len - dw, dw);
+	} else {
+		/* short tile, no edges */
+		h[0] = h[2] = 1;
+		h[1] = zc_hash(src, len);
+	}
+	l = (h[0] != s[0]);
+	m = (h[1] != s[1]);
+	r = (h[2] != s[2]);
+	if (left) {
+		*left = l;
+	}
+	if (right) {
+		*right = r;
+	}
+	if (! (l || m || r)) {
+		return 0;
+	}
+	if (update) {
+		s[0] = h[0];
+		s[1] = h[1];
+		s[2] = h[2];
+	}
+	return 1;
+}
+
+/* the copy_screen() of -zerocopy: only the hashes need refreshing */
+static void zc_rehash_all(void) {
+	char *src;
+	int x, y, w, bpl;
+
+	for (y=0; y < dpy_y; y++) {
+		src = rawfb_direct_addr(0, y, &bpl);
+		for (x=0; x < dpy_x; x += tile_x) {
+			w = dpy_x - x;
+			if (w > tile_x) {
+				w = tile_x;
+			}
+			zc_line_diff(src + x * (bpp/8), x, y, w, 1, NULL, NULL);
+		}
+	}
+}
+
+/*
+ * -pipeline: copy_tile_runs_band() goes down the screen one tile row
+ * at a time and every run of changed tiles costs a round trip to the
+ * X server before it can be compared.  A capture thread instead
+ * fetches the next row with changed tiles, full width, into one of
+ * capture_row[2] while the current row is compared and copied out of
+ * the other.  Tiles guessed changed only after their row was requested
+ * (or rows with no changed tiles yet) are fetched the old way.
+ */
+
+enum {
+	CAPTURE_IDLE = 0,
+	CAPTURE_WANT,		/* requested, not started */
+	CAPTURE_BUSY,		/* the thread is fetching it */
+	CAPTURE_READY
+};
+
+static int capture_state[2] = {CAPTURE_IDLE, CAPTURE_IDLE};
+static int capture_ty[2] = {-1, -1};
+
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+static int capture_started = 0;
+static pthread_t capture_thread_id;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t capture_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void *capture_thread(void *arg) {
+	int b, y, h;
+
+	if (arg) {}
+	while (1) {
+		pthread_mutex_lock(&capture_mutex);
+		while (1) {
+			b = -1;
+			if (capture_state[0] == CAPTURE_WANT) {
+				b = 0;
+			}
+			if (capture_state[1] == CAPTURE_WANT && (b < 0
+			    || capture_ty[1] < capture_ty[0])) {
+				b = 1;
+			}
+			if (b >= 0) {
+				break;
+			}
+			pthread_cond_wait(&capture_cond, &capture_mutex);
+		}
+		capture_state[b] = CAPTURE_BUSY;
+		y = capture_ty[b] * tile_y;
+		pthread_mutex_unlock(&capture_mutex);
+
+		h = dpy_y - y;
+		if (h > tile_y) {
+			h = tile_y;
+		}
+		X_LOCK;
+		copy_image(capture_row[b], 0, y, dpy_x, h);
+		X_UNLOCK;
+
+		pthread_mutex_lock(&capture_mutex);
+		capture_state[b] = CAPTURE_READY;
+		pthread_cond_broadcast(&capture_done_cond);
+		pthread_mutex_unlock(&capture_mutex);
+	}
+	return NULL;
+}
+#endif
+
+/*
+ * Whether -pipeline can be used right now; starts the thread the first
+ * time.  The X error trapping of -id and -xrandr (which may reset the
+ * whole screen) has to stay in the main thread.
+ */
+static int capture_ok(void) {
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	if (! scan_pipeline || ! capture_row[0] || ! capture_row[1]) {
+		return 0;
+	}
+	if (raw_fb || use_snapfb || subwin || xrandr || macosx_console) {
+		return 0;
+	}
+	if (capture_row[0]->width != dpy_x || capture_row[1]->width != dpy_x) {
+		return 0;
+	}
+	if (capture_started) {
+		return 1;
+	}
+	if (pthread_create(&capture_thread_id, NULL, capture_thread, NULL)
+	    != 0) {
+		rfbLogPerror("pthread_create");
+		rfbLog("warning: disabling -pipeline.\n");
+		scan_pipeline = 0;
+		return 0;
+	}
+	capture_started = 1;
+	rfbLog("pipeline: fetching tile rows in a capture thread.\n");
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Queue tile row ty, if it has any changed tiles, into capture_row[ty % 2].
+ */
+static void capture_request(int ty) {
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	int x, b = ty % 2, n = ty * ntiles_x;
+
+	for (x=0; x < ntiles_x; x++) {
+		if (tile_has_diff[n+x]) {
+			break;
+		}
+	}
+	if (x == ntiles_x) {
+		return;
+	}
+
+	pthread_mutex_lock(&capture_mutex);
+	/* the buffer may still be on its way in for row ty-2 */
+	while (capture_state[b] == CAPTURE_WANT
+	    || capture_state[b] == CAPTURE_BUSY) {
+		pthread_cond_wait(&capture_done_cond, &capture_mutex);
+	}
+	capture_ty[b] = ty;
+	capture_state[b] = CAPTURE_WANT;
+	pthread_cond_signal(&capture_cond);
+	pthread_mutex_unlock(&capture_mutex);
+#else
+	if (ty) {}
+#endif
+}
+
+/*
+ * If the tile row at pixel row y was requested, waits for it and sets
+ * *src and *bpl to the start of that row in the capture buffer.
+ */
+static int capture_get(int y, char **src, int *bpl) {
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	int b, ty = y / tile_y;
+
+	if (! capture_started || y % tile_y != 0) {
+		return 0;
+	}
+	b = ty % 2;
+
+	pthread_mutex_lock(&capture_mutex);
+	if (capture_ty[b] != ty || capture_state[b] == CAPTURE_IDLE) {
+		pthread_mutex_unlock(&capture_mutex);
+		return 0;
+	}
+	while (capture_state[b] != CAPTURE_READY) {
+		pthread_cond_wait(&capture_done_cond, &capture_mutex);
+	}
+	pthread_mutex_unlock(&capture_mutex);
+
+	*src = capture_row[b]->data;
+	*bpl = capture_row[b]->bytes_per_line;
+	return 1;
+#else
+	if (y || src || bpl) {}
+	return 0;
+#endif
+}
+
+/*
+ * Waits for any fetch still in flight and drops both rows, so the later
+ * passes and the next poll do not pick up stale pixels.
+ */
+static void capture_flush(void) {
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	int b;
+
+	if (! capture_started) {
+		return;
+	}
+	pthread_mutex_lock(&capture_mutex);
+	for (b=0; b < 2; b++) {
+		while (capture_state[b] == CAPTURE_WANT
+		    || capture_state[b] == CAPTURE_BUSY) {
+			pthread_cond_wait(&capture_done_cond, &capture_mutex);
+		}
+		capture_state[b] = CAPTURE_IDLE;
+		capture_ty[b] = -1;
+	}
+	pthread_mutex_unlock(&capture_mutex);
+#endif
+}
+
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+/*
+ * -scanthreads n: with a memory mapped -rawfb there is no X connection
+ * to serialize on, so the scanline sweep of scan_display() and the tile
+ * run copying are split over n threads, each owning a band of tile
+ * rows.  The calling thread does the first band.  Tiles are read in
+ * place from the mapping, and each band only writes the tile_* arrays
+ * for its own rows.  Downward guesses crossing into the next band are
+ * collected and copied serially after all the bands are done.
+ */
+
+typedef struct scan_band {
+	int ty0, ty1;		/* tile rows ty0 <= y < ty1 */
+	int count;		/* changed tiles found */
+	int *spill;		/* downward guesses into row ty1 */
+	int nspill, spill_size;
+	tile_scratch_t scratch;
+	pthread_t thread;
+} scan_band_t;
+
+static scan_band_t *scan_bands = NULL;
+static int scan_nbands = 0;
+static int scan_job = SCAN_JOB_SCAN, scan_job_gen = 0, scan_job_pending = 0;
+static int scan_job_ystart = 0, scan_job_rescan = 0;
+static pthread_mutex_t scan_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scan_done_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * The scan_display() loop for the scanlines inside one band, reading
+ * the mapping directly.  Blackouts, xdamage and ncache are excluded by
+ * scan_threads_ok() so they do not appear here.
+ */
+static int scan_band_lines(scan_band_t *b) {
+	char *src, *dst;
+	int pixelsize = bpp/8;
+	int x, y, y1, w, n, bpl, lo, hi, diff;
+	int tile_count = 0, nodiffs = 0;
+	int ystart = scan_job_ystart, rescan = scan_job_rescan;
+
+	y = b->ty0 * tile_y;
+	if (y > ystart) {
+		y = ystart + ((y - ystart + NSCAN - 1) / NSCAN) * NSCAN;
+	} else {
+		y = ystart;
+	}
+	y1 = b->ty1 * tile_y;
+	if (y1 > dpy_y) {
+		y1 = dpy_y;
+	}
+
+	while (y < y1) {
+		if (heat_scan && heat_row_skip[y/tile_y]) {
+			y += NSCAN;
+			continue;
+		}
+		src = rawfb_direct_addr(0, y, &bpl);
+		dst = main_fb + y * main_bytes_per_line;
+
+		if (rawfb_zerocopy) {
+			/* hashed tile by tile below */
+			lo = 0;
+			hi = dpy_x * pixelsize - 1;
+		} else if (! fb_diff_span(dst, src, dpy_x * pixelsize,
+		    &lo, &hi)) {
+			/* no changes anywhere in scan line */
+			lo = hi = -1;
+			nodiffs = 1;
+			if (! rescan) {
+				y += NSCAN;
+				continue;
+			}
+		}
+
+		x = 0;
+		while (x < dpy_x) {
+			n = (x/tile_x) + (y/tile_y) * ntiles_x;
+
+			if (rescan) {
+				if (nodiffs || tile_has_diff[n]) {
+					tile_count += tile_has_diff[n];
+					x += NSCAN;
+					continue;
+				}
+			}
+
+			if (x + NSCAN > dpy_x) {
+				w = dpy_x - x;
+			} else {
+				w = NSCAN;
+			}
+
+			if (rawfb_zerocopy) {
+				diff = zc_line_diff(src + x * pixelsize, x, y,
+				    w, 0, NULL, NULL);
+			} else {
+				diff = span_has_diff(dst + x * pixelsize,
+				    src + x * pixelsize, x * pixelsize,
+				    w * pixelsize, lo, hi);
+			}
+			if (diff) {
+				TILE_DIFF(n, 1);
+				tile_count++;
+			}
+			x += NSCAN;
+		}
+		y += NSCAN;
+	}
+	return tile_count;
+}
+
+static void scan_band_do(scan_band_t *b) {
+	if (b->ty0 >= b->ty1) {
+		b->count = 0;
+		return;
+	}
+	if (scan_job == SCAN_JOB_SCAN) {
+		b->count = scan_band_lines(b);
+	} else {
+		if (b->spill_size < ntiles_x + 1) {
+			if (b->spill) {
+				free(b->spill);
+			}
+			b->spill_size = ntiles_x + 1;
+			b->spill = (int *) malloc((size_t)
+			    (b->spill_size * sizeof(int)));
+		}
+		b->nspill = 0;
+		b->count = copy_tile_runs_band(b->ty0, b->ty1, &b->scratch,
+		    b->ty1 < ntiles_y ? b->spill : NULL, &b->nspill);
+	}
+}
+
+static void *scan_band_thread(void *arg) {
+	scan_band_t *b = (scan_band_t *) arg;
+	int gen = 0;
+
+	while (1) {
+		pthread_mutex_lock(&scan_job_mutex);
+		while (scan_job_gen == gen) {
+			pthread_cond_wait(&scan_job_cond, &scan_job_mutex);
+		}
+		gen = scan_job_gen;
+		pthread_mutex_unlock(&scan_job_mutex);
+
+		scan_band_do(b);
+
+		pthread_mutex_lock(&scan_job_mutex);
+		if (--scan_job_pending == 0) {
+			pthread_cond_signal(&scan_done_cond);
+		}
+		pthread_mutex_unlock(&scan_job_mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Whether the threaded polling can be used right now; starts the
+ * threads the first time.
+ */
+static int scan_threads_ok(void) {
+	int i;
+
+	if (scan_threads < 2 || ! raw_fb || ! raw_fb_addr || raw_fb_seek) {
+		return 0;
+	}
+	if (xform24to32 || raw_fb_native_bpp < 8 || use_snapfb) {
+		return 0;
+	}
+	if (blackouts || use_xdamage || ncache > 0 || macosx_console) {
+		return 0;
+	}
+	if (scan_bands != NULL) {
+		return 1;
+	}
+
+	if (scan_threads > SCAN_THREADS_MAX) {
+		scan_threads = SCAN_THREADS_MAX;
+	}
+	scan_bands = (scan_band_t *) calloc((size_t)
+	    (scan_threads * sizeof(scan_band_t)), 1);
+	scan_nbands = 1;
+	for (i=1; i < scan_threads; i++) {
+		scan_bands[i].scratch.direct = 1;
+		if (pthread_create(&scan_bands[i].thread, NULL,
+		    scan_band_thread, (void *) &scan_bands[i]) != 0) {
+			rfbLogPerror("pthread_create");
+			break;
+		}
+		scan_nbands++;
+	}
+	scan_bands[0].scratch.direct = 1;
+	rfbLog("scanthreads: polling -rawfb with %d threads.\n",
+	    scan_nbands);
+	return 1;
+}
+
+/*
+ * Runs job over all the bands and returns the total count.  For the
+ * copy job the spilled downward guesses are then done here serially.
+ */
+static int scan_threads_run(int job, int ystart, int rescan) {
+	int i, k, m, nb, per, ct, count = 0;
+
+	nb = scan_nbands;
+	if (nb > ntiles_y) {
+		nb = ntiles_y;
+	}
+	per = (ntiles_y + nb - 1) / nb;
+	for (i=0; i < scan_nbands; i++) {
+		scan_bands[i].ty0 = i * per;
+		scan_bands[i].ty1 = (i+1) * per;
+		if (scan_bands[i].ty0 > ntiles_y) {
+			scan_bands[i].ty0 = ntiles_y;
+		}
+		if (scan_bands[i].ty1 > ntiles_y) {
+			scan_bands[i].ty1 = ntiles_y;
+		}
+		scan_bands[i].nspill = 0;
+	}
+
+	pthread_mutex_lock(&scan_job_mutex);
+	scan_job = job;
+	scan_job_ystart = ystart;
+	scan_job_rescan = rescan;
+	scan_job_pending = scan_nbands - 1;
+	scan_job_gen++;
+	pthread_cond_broadcast(&scan_job_cond);
+	pthread_mutex_unlock(&scan_job_mutex);
+
+	scan_band_do(&scan_bands[0]);
+
+	pthread_mutex_lock(&scan_job_mutex);
+	while (scan_job_pending > 0) {
+		pthread_cond_wait(&scan_done_cond, &scan_job_mutex);
+	}
+	pthread_mutex_unlock(&scan_job_mutex);
+
+	for (i=0; i < scan_nbands; i++) {
+		if (scan_bands[i].count < 0) {
+			return scan_bands[i].count;	/* fatal */
+		}
+		count += scan_bands[i].count;
+	}
+	if (job != SCAN_JOB_COPY) {
+		return count;
+	}
+
+	for (i=0; i < scan_nbands; i++) {
+		for (k=0; k < scan_bands[i].nspill; k++) {
+			m = scan_bands[i].spill[k];
+			/* follow the guess down until it stops paying off */
+			while (! tile_has_diff[m] && ! tile_tried[m]) {
+				TILE_DIFF(m, 2);
+				ct = copy_tiles(m % ntiles_x, m / ntiles_x, 1);
+				if (ct < 0) return ct;	/* fatal */
+				if (! tile_has_diff[m]) {
+					break;
+				}
+				count++;
+				if (m + ntiles_x >= ntiles ||
+				    ! tile_region[m].bot_diff) {
+					break;
+				}
+				m += ntiles_x;
+			}
+		}
+	}
+	return count;
+}
+#endif	/* LIBVNCSERVER_HAVE_LIBPTHREAD */
+
+
+/*
+ * Decides which tile rows the first scan_display() of this poll skips.
+ * A cold row is scanned on every n-th poll, staggered by row.  n is
+ * kept odd so those polls walk through all NSCAN scanlines[] offsets:
+ * every line of the screen is still looked at within n * NSCAN polls.
+ */
+static int heat_plan(void) {
+	int r, t, hot, period = heat_poll;
+
+	if (period <= 1 || ! tile_heat || tile_heat_n != ntiles) {
+		return 0;
+	}
+	if (period % 2 == 0) {
+		period++;
+	}
+	heat_cycle = (heat_cycle + 1) % period;
+
+	for (r=0; r < ntiles_y; r++) {
+		unsigned short *h = tile_heat + r * ntiles_x;
+
+		hot = 0;
+		for (t=0; t < ntiles_x; t++) {
+			if (h[t] >= HEAT_HOT) {
+				hot = 1;
+				break;
+			}
+		}
+		heat_row_skip[r] = ! hot && (heat_cycle + r) % period != 0;
+	}
+	return 1;
+}
+
+/*
+ * Folds this poll's tile_has_diff[] into tile_heat[].
+ */
+static void heat_update(void) {
+	int n, h;
+
+	if (tile_heat_n != ntiles) {
+		if (tile_heat) free(tile_heat);
+		if (heat_row_skip) free(heat_row_skip);
+		if (heat_cold) free(heat_cold);
+		tile_heat = (unsigned short *) calloc((size_t) ntiles,
+		    sizeof(unsigned short));
+		heat_row_skip = (unsigned char *) calloc((size_t) ntiles_y, 1);
+		heat_cold = (unsigned char *) calloc((size_t) ntiles, 1);
+		if (! tile_heat || ! heat_row_skip || ! heat_cold) {
+			tile_heat_n = 0;
+			return;
+		}
+		tile_heat_n = ntiles;
+	}
+	for (n=0; n < ntiles; n++) {
+		h = tile_heat[n];
+		heat_cold[n] = tile_has_diff[n] && h < HEAT_HOT;
+		if (tile_has_diff[n]) {
+			h += (65535 - h) >> HEAT_SHIFT;
+		} else {
+			h -= h >> HEAT_SHIFT;
+		}
+		tile_heat[n] = (unsigned short) h;
+	}
+}
+
+/*
+ * For the input latency (stats.c): the number of tiles changed in this
+ * poll that were not hot before it, so not a clock, a blinking cursor
+ * or video.  With x >= 0 only the tiles within r pixels of x, y count.
+ */
+int heat_cold_diffs(int x, int y, int r) {
+	int tx, ty, tx1 = 0, ty1 = 0, tx2 = ntiles_x, ty2 = ntiles_y;
+	int cnt = 0;
+
+	if (! heat_cold || tile_heat_n != ntiles) {
+		return 0;
+	}
+	if (x >= 0) {
+		tx1 = nfix((x - r) / tile_x, ntiles_x);
+		ty1 = nfix((y - r) / tile_y, ntiles_y);
+		tx2 = nfix((x + r) / tile_x, ntiles_x) + 1;
+		ty2 = nfix((y + r) / tile_y, ntiles_y) + 1;
+	}
+	for (ty=ty1; ty < ty2; ty++) {
+		for (tx=tx1; tx < tx2; tx++) {
+			cnt += heat_cold[ty * ntiles_x + tx];
+		}
+	}
+	return cnt;
+}
+
+/*
+ * The heat map for -query heatmap: "WxH:" in tiles, then a row of hex
+ * digits (0 idle .. f changing every poll) per tile row, comma
+ * separated, and whether -heatpoll is skipping the row ('-' prefix).
+ * Returns malloc'ed memory.
+ */
+char *heat_map_str(void) {
+	char *str, *s;
+	int r, t, h;
+
+	if (! tile_heat || tile_heat_n != ntiles) {
+		return strdup("0x0:");
+	}
+	str = (char *) malloc((size_t) (32 + ntiles_y * (ntiles_x + 2)));
+	if (! str) {
+		return strdup("0x0:");
+	}
+	sprintf(str, "%dx%d:", ntiles_x, ntiles_y);
+	s = str + strlen(str);
+	for (r=0; r < ntiles_y; r++) {
+		if (r) {
+			*s++ = ',';
+		}
+		if (heat_poll > 1 && heat_row_skip[r]) {
+			*s++ = '-';
+		}
+		for (t=0; t < ntiles_x; t++) {
+			h = (tile_heat[r * ntiles_x + t] * 15 + 32767) / 65535;
+			*s++ = "0123456789abcdef"[h];
+		}
+	}
+	*s = '\0';
+	return str;
+}
+
+int scanlines[NSCAN] = {
+	 0, 16,  8, 24,  4, 20, 12, 28,
+	10, 26, 18,  2, 22,  6, 30, 14,
+	 1, 17,  9, 25,  7, 23, 15, 31,
+	19,  3, 27, 11, 29, 13,  5, 21
+};
+
+void scan_timing_reset(void) {
+	int i;
+
+	for (i=0; i < SCAN_PHASE_MAX; i++) {
+		scan_phase_time[i] = 0.0;
+		scan_phase_calls[i] = 0;
+	}
+	scan_tiles_fetched = 0;
+}
+
+static void phase_add(int phase, double *t0) {
+	double now = dnow();
+
+	scan_phase_time[phase] += now - *t0;
+	scan_phase_calls[phase]++;
+	*t0 = now;
+}
+
+/*
+ * toplevel for the scanning, rescanning, and applying the heuristics.
+ * returns number of changed tiles.
+ */
+int scan_for_updates(int count_only) {
+	int i, tile_count, tile_diffs;
+	int old_copy_tile, xd_rects = 0;
+	double phase_t0 = 0.0;
+	double frac1 = 0.1;   /* tweak parameter to try a 2nd scan_display() */
+	double frac2 = 0.35;  /* or 3rd */
+	double frac3 = 0.02;  /* do scan_display() again after copy_tiles() */
+	static double last_poll = 0.0;
+
+	if (unixpw_in_progress) return 0;
+ 
+	if (slow_fb > 0.0) {
+		double now = dnow();
+		if (now < last_poll + slow_fb) {
+			return 0;
+		}
+		last_poll = now;
+	}
+
+	for (i=0; i < ntiles; i++) {
 		tile_has_diff[i] = 0;
 		tile_has_xdamage_diff[i] = 0;
 		tile_tried[i] = 0;
 		tile_copied[i] = 0;
 	}
+	memset(tile_diff_bits, 0, TILE_BITS_WORDS * sizeof(unsigned long long));
 	for (i=0; i < ntiles_y; i++) {
 		/* could be useful, currently not used */
 		tile_row_has_xdamage_diff[i] = 0;
@@ -3468,10 +4547,30 @@ int scan_for_updates(int count_only) {
 		return 0; \
 	}
 
-	/* scan with the initial y to the jitter value from scanlines: */
 	scan_in_progress = 1;
-	tile_count = scan_display(scanlines[scan_count], 0);
-	SCAN_FATAL(tile_count);
+	PHASE_BEGIN;
+	if (xdamage_rects_ok()) {
+		/*
+		 * -xd_rects: no scanline sweep, the DAMAGE rectangles
+		 * say which tiles to fetch and compare.
+		 */
+		xd_rects = 1;
+		collect_xdamage(scan_count, 1);
+		tile_count = xdamage_mark_tiles();
+	} else if (! count_only && (tile_count = shmfb_mark_tiles()) >= 0) {
+		/*
+		 * the -rawfb producer posts what it drew (shmfb.c),
+		 * these tiles are handled like the -xd_rects ones.
+		 */
+		xd_rects = 1;
+	} else {
+		/* scan with the initial y to the jitter value from scanlines: */
+		heat_scan = ! count_only && heat_plan();
+		tile_count = scan_display(scanlines[scan_count], 0);
+		heat_scan = 0;
+		SCAN_FATAL(tile_count);
+	}
+	PHASE_END(SCAN_PHASE_SCAN);
 
 	/*
 	 * we do the XDAMAGE here too since after scan_display()
@@ -3480,7 +4579,7 @@ int scan_for_updates(int count_only) {
 	 * in the *next* call, usually too late and wasteful since
 	 * the unchanged tiles are read in again).
 	 */
-	if (use_xdamage) {
+	if (use_xdamage && ! xd_rects) {
 #ifdef MACOSX
 		if (macosx_console) {
 			;
@@ -3507,7 +4606,7 @@ int scan_for_updates(int count_only) {
 				continue;
 			}
 			if (tile_has_xdamage_diff[i]) {
-				tile_has_diff[i] = 1;
+				TILE_DIFF(i, 1);
 				if (tile_has_xdamage_diff[i] == 1) {
 					tile_has_xdamage_diff[i] = 2;
 					tile_count++;
@@ -3515,15 +4614,25 @@ int scan_for_updates(int count_only) {
 			}
 		}
 	}
+	heat_update();
 	if (dpy && use_xdamage == 1) {
 		static time_t last_xd_check = 0;
 		if (time(NULL) > last_xd_check + 2) {
 			int cp = (scan_count + 3) % NSCAN;
 			xd_do_check = 1;
+			PHASE_BEGIN;
 			tile_count = scan_display(scanlines[cp], 0);
+			PHASE_END(SCAN_PHASE_SCAN);
 			xd_do_check = 0;
 			SCAN_FATAL(tile_count);
 			last_xd_check = time(NULL);
+			if (xd_rects && xd_samples > 50 &&
+			    xd_misses > (2 * xd_samples) / 100) {
+				rfbLog("-xd_rects: DAMAGE missed changes %d/%d, "
+				    "using scanline polling.\n", xd_misses,
+				    xd_samples);
+				xdamage_rects = 0;
+			}
 			if (xd_samples > 200) {
 				static int bad = 0;
 				if (xd_misses > (20 * xd_samples) / 100) {
@@ -3544,6 +4653,9 @@ int scan_for_updates(int count_only) {
 		}
 	}
 
+	/* -videodetect: hold back video regions past their frame rate */
+	tile_count -= video_cap(xd_rects);
+
 	nap_set(tile_count);
 
 	if (fs_factor && frac1 >= fs_frac) {
@@ -3558,12 +4670,15 @@ int scan_for_updates(int count_only) {
 		 */
 
 		/* this check is done to skip the extra scan_display() call */
-		if (! fs_factor || tile_count <= fs_frac * ntiles) {
+		if (xd_rects) {
+			;
+		} else if (! fs_factor || tile_count <= fs_frac * ntiles) {
 			int cp, tile_count_old = tile_count;
 			
 			/* choose a different y shift for the 2nd scan: */
 			cp = (NSCAN - scan_count) % NSCAN;
 
+			PHASE_BEGIN;
 			tile_count = scan_display(scanlines[cp], 1);
 			SCAN_FATAL(tile_count);
 
@@ -3573,6 +4688,8 @@ int scan_for_updates(int count_only) {
 				tile_count = scan_display(scanlines[cp], 1);
 				SCAN_FATAL(tile_count);
 			}
+			PHASE_END(SCAN_PHASE_SCAN);
+			tile_count -= video_recap();
 		}
 		scan_in_progress = 0;
 
@@ -3591,11 +4708,35 @@ int scan_for_updates(int count_only) {
 		 * Use -fs 1.0 to disable on slow links.
 		 */
 		if (fs_factor && tile_count > fs_frac * ntiles) {
-			int cs;
+			int cs, nomark;
 			fb_copy_in_progress = 1;
+			PHASE_BEGIN;
+			/*
+			 * -scrolldetect and -tilecache mark around their
+			 * CopyRects below
+			 */
+			nomark = scrolldet_begin() | tilecache_ok();
+			copy_screen_nomark = nomark;
 			cs = copy_screen();
+			copy_screen_nomark = 0;
+			PHASE_END(SCAN_PHASE_COPY);
 			fb_copy_in_progress = 0;
 			SCAN_FATAL(cs);
+			if (nomark) {
+				/* all of it changed, less what was copied */
+				for (i=0; i < ntiles; i++) {
+					TILE_DIFF(i, 1);
+					tile_region[i].first_line = 0;
+					tile_region[i].last_line = tile_y - 1;
+					tile_region[i].first_x = -1;
+				}
+				scrolldet_end();
+				tilecache_copy();
+				hint_updates();
+			}
+			if (scan_timing) {
+				scan_tiles_fetched += ntiles;
+			}
 			if (use_threads && pointer_mode != 1) {
 				pointer_event(-1, 0, 0, NULL);
 			}
@@ -3624,9 +4765,18 @@ int scan_for_updates(int count_only) {
 
 	if (unixpw_in_progress) return 0;
 
-	if (old_copy_tile) {
+	PHASE_BEGIN;
+	scrolldet_begin();
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+	if (scan_threads_ok()) {
+		/* the -rawfb is read in place, runs need no tile_row[] */
+		old_copy_tile = -1;
+		tile_diffs = scan_threads_run(SCAN_JOB_COPY, 0, 0);
+	}
+#endif
+	if (old_copy_tile == 1) {
 		tile_diffs = copy_all_tiles();
-	} else {
+	} else if (old_copy_tile == 0) {
 		tile_diffs = copy_all_tile_runs();
 	}
 	SCAN_FATAL(tile_diffs);
@@ -3637,8 +4787,9 @@ int scan_for_updates(int count_only) {
 	 */
 	tile_diffs = copy_tiles_backward_pass();
 	SCAN_FATAL(tile_diffs);
+	PHASE_END(SCAN_PHASE_COPY);
 
-	if (tile_diffs > frac3 * ntiles) {
+	if (tile_diffs > frac3 * ntiles && ! xd_rects) {
 		/*
 		 * we spent a lot of time in those copy_tiles, run
 		 * another scan, maybe more of the screen changed.
@@ -3649,20 +4800,24 @@ int scan_for_updates(int count_only) {
 		tile_count = scan_display(scanlines[cp], 1);
 		SCAN_FATAL(tile_count);
 		scan_in_progress = 0;
+		PHASE_END(SCAN_PHASE_SCAN);
 
 		tile_diffs = copy_tiles_additional_pass();
 		SCAN_FATAL(tile_diffs);
+		PHASE_END(SCAN_PHASE_COPY);
 	}
 
 	/* Given enough tile diffs, try the islands: */
 	if (grow_fill && tile_diffs > 4) {
 		tile_diffs = grow_islands();
+		PHASE_END(SCAN_PHASE_ISLANDS);
 	}
 	SCAN_FATAL(tile_diffs);
 
 	/* Given enough tile diffs, try the gaps: */
 	if (gaps_fill && tile_diffs > 4) {
 		tile_diffs = fill_tile_gaps();
+		PHASE_END(SCAN_PHASE_GAPS);
 	}
 	SCAN_FATAL(tile_diffs);
 
@@ -3675,6 +4830,12 @@ int scan_for_updates(int count_only) {
 		pointer_event(-1, 0, 0, NULL);
 	}
 
+	/* -scrolldetect: CopyRect what moved, before the marking below */
+	scrolldet_end();
+
+	/* -tilecache: CopyRect tiles the viewers already have elsewhere */
+	tilecache_copy();
+
 	if (blackouts) {
 		/* ignore any diffs in completely covered tiles */
 		int x, y, n;
@@ -3682,13 +4843,24 @@ int scan_for_updates(int count_only) {
 			for (x=0; x < ntiles_x; x++) {
 				n = x + y * ntiles_x;
 				if (tile_blackout[n].cover == 2) {
-					tile_has_diff[n] = 0;
+					TILE_DIFF(n, 0);
 				}
 			}
 		}
 	}
 
+	PHASE_BEGIN;
 	hint_updates();	/* use x0rfbserver hints algorithm */
+	PHASE_END(SCAN_PHASE_HINTS);
+
+	if (scan_timing) {
+		/* every tile read from the display, changed or not */
+		for (i=0; i < ntiles; i++) {
+			if (tile_tried[i]) {
+				scan_tiles_fetched++;
+			}
+		}
+	}
 
 	/* Work around threaded rfbProcessClientMessage() calls timeouts */
 	if (use_threads) {
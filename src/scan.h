@@ -38,6 +38,21 @@ so, delete this exception statement from your version.
 extern int nap_ok;
 extern int scanlines[];
 
+/* phases of scan_for_updates() timed when scan_timing is set */
+enum {
+	SCAN_PHASE_SCAN = 0,
+	SCAN_PHASE_COPY,
+	SCAN_PHASE_ISLANDS,
+	SCAN_PHASE_GAPS,
+	SCAN_PHASE_HINTS,
+	SCAN_PHASE_MAX
+};
+
+extern int scan_timing;
+extern double scan_phase_time[];
+extern int scan_phase_calls[];
+extern long scan_tiles_fetched;
+
 extern void initialize_tiles(void);
 extern void free_tiles(void);
 extern void shm_delete(XShmSegmentInfo *shm);
@@ -53,6 +68,9 @@ extern int copy_snap(void);
 extern void nap_sleep(int ms, int split);
 extern void set_offset(void);
 extern int scan_for_updates(int count_only);
+extern void scan_timing_reset(void);
+extern char *heat_map_str(void);
+extern int heat_cold_diffs(int x, int y, int r);
 extern void rotate_curs(char *dst_0, char *src_0, int Dx, int Dy, int Bpp);
 extern void rotate_coords(int x, int y, int *xo, int *yo, int dxi, int dyi);
 extern void rotate_coords_inverse(int x, int y, int *xo, int *yo, int dxi, int dyi);
@@ -41,6 +41,7 @@ so, delete this exception statement from your version.
 #include "cleanup.h"
 #include "userinput.h"
 #include "scan.h"
+#include "stats.h"
 #include "user.h"
 #include "rates.h"
 #include "pointer.h"
@@ -62,6 +63,9 @@ so, delete this exception statement from your version.
 #include "xrecord.h"
 #include "pm.h"
 #include "xi2_devices.h"
+#include "shmfb.h"
+#include "evloop.h"
+#include "selection.h"
 
 #include <rfb/rfbclient.h>
 
@@ -105,11 +109,13 @@ static void check_filexfer(void);
 static void record_last_fb_update(void);
 static void check_cursor_changes(void);
 static int choose_delay(double dt);
+static int rawfb_zerocopy_ok(void);
 
 int rawfb_reset = -1;
 int rawfb_dev_video = 0;
 int rawfb_vnc_reflect = 0;
 int rawfb_double_buffer = 0;
+int rawfb_zerocopy = 0;	/* screen->frameBuffer is the -rawfb mapping */
 
 /*
  * X11 and rfb display/screen related routines
@@ -1658,6 +1664,7 @@ XImage *initialize_raw_fb(int reset) {
 			return NULL;
 		}
 		if (last_mode == RAWFB_MMAP) {
+			shmfb_detach();
 			munmap(raw_fb_addr, raw_fb_mmap);
 		}
 		if (raw_fb_fd >= 0) {
@@ -1691,6 +1698,7 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 				rfbLogPerror("mmap");
 				clean_up_exit(1);
 			}
+			shmfb_attach(raw_fb_addr, (size_t) raw_fb_mmap);
 		}
 		return NULL;
 	}
@@ -1701,6 +1709,7 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 	}
 #endif
 
+	shmfb_detach();
 	if (raw_fb_addr || raw_fb_seek) {
 		if (raw_fb_shm) {
 			shmdt(raw_fb_addr);
@@ -1717,6 +1726,7 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 				close(raw_fb_fd);
 			}
 			raw_fb_fd = -1;
+			raw_fb_nopread = 0;
 		}
 		raw_fb_addr = NULL;
 		raw_fb_mmap = 0;
@@ -2156,6 +2166,15 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 		rfbLog("rawfb: shm: %d W: %d H: %d B: %d addr: %p\n",
 		    shmid, w, h, b, raw_fb_addr);
 		last_mode = RAWFB_SHM;
+		{
+			struct shmid_ds ds;
+			size_t segsz = 0;
+			if (shmctl(shmid, IPC_STAT, &ds) == 0) {
+				segsz = (size_t) ds.shm_segsz;
+			}
+			/* producer damage header, moves raw_fb_offset */
+			shmfb_attach(raw_fb_addr, segsz);
+		}
 #else
 		rfbLogEnable(1);
 		rfbLog("x11vnc was compiled without shm support.\n");
@@ -2201,6 +2220,19 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 		}
 		raw_fb_fd = fd;
 
+		if (do_mmap && ! do_macosx && ! do_reflect) {
+			/* a producer damage header goes before the pixels */
+			char hbuf[64];
+			int hs = 0;
+			if (pread(fd, hbuf, sizeof(hbuf), 0) ==
+			    (ssize_t) sizeof(hbuf)) {
+				hs = shmfb_header_size(hbuf, sizeof(hbuf));
+			}
+			if (hs > raw_fb_offset) {
+				raw_fb_offset = hs;
+			}
+		}
+
 		if (raw_fb_native_bpp < 8) {
 			size = w*h*raw_fb_native_bpp/8 + raw_fb_offset;
 		} else if (xform24to32) {
@@ -2257,6 +2289,7 @@ if (db) fprintf(stderr, "initialize_raw_fb reset\n");
 
 			} else {
 				raw_fb_mmap = size;
+				shmfb_attach(raw_fb_addr, (size_t) size);
 
 				rfbLog("rawfb: mmap file: %s\n", q);
 				if (vsize != 0) {
@@ -3208,6 +3241,33 @@ static rfbBool set_xlate_wrapper(rfbClientPtr cl) {
 	return rfbSetTranslateFunction(cl);	
 }
 
+/*
+ * -zerocopy needs a map: or shm: -rawfb already in the served pixel
+ * format, and nothing that draws into or transforms the framebuffer.
+ */
+static int rawfb_zerocopy_ok(void) {
+	if (! raw_fb_zerocopy || ! raw_fb || ! raw_fb_addr || raw_fb_seek) {
+		return 0;
+	}
+	if (rawfb_vnc_reflect || rawfb_dev_video || rawfb_double_buffer) {
+		return 0;
+	}
+	if (xform24to32 || raw_fb_native_bpp < 8 || use_snapfb) {
+		return 0;
+	}
+	if (scaling || rotating || cmap8to24 || nofb) {
+		return 0;
+	}
+	if (blackout_str || blackouts || ncache > 0 || use_multipointer) {
+		return 0;
+	}
+	if (unixpw) {
+		/* the login prompt is rfbDrawString()'ed into the fb */
+		return 0;
+	}
+	return 1;
+}
+
 /*
  * initialize the rfb framebuffer/screen
  */
@@ -3739,6 +3799,31 @@ void initialize_screen(int *argc, char **argv, XImage *fb) {
 	} else {
 		screen->frameBuffer = rfb_fb;
 	}
+	rawfb_zerocopy = 0;
+	if (rawfb_zerocopy_ok()) {
+		/*
+		 * -zerocopy: the encoders read the mapping in place,
+		 * main_fb is no longer kept up to date (see scan.c).
+		 */
+		int bpl = raw_fb_bytes_per_line;
+		char *addr = raw_fb_addr + raw_fb_offset;
+
+		if (clipshift) {
+			if (wdpy_x != cdpy_x) {
+				bpl = wdpy_x * (fb_bpp/8);
+			}
+			addr += bpl * coff_y + (fb_bpp/8) * coff_x;
+		}
+		screen->frameBuffer = addr;
+		screen->paddedWidthInBytes = bpl;
+		rawfb_zerocopy = 1;
+		if (! quiet) {
+			rfbLog("zerocopy: serving the -rawfb mapping in place.\n");
+		}
+	} else if (raw_fb_zerocopy && ! quiet) {
+		rfbLog("zerocopy: not possible with this -rawfb and these"
+		    " options.\n");
+	}
 	if (verbose) {
 		fprintf(stderr, " rfb_fb:      %p\n", rfb_fb);
 		fprintf(stderr, " main_fb:     %p\n", main_fb);
@@ -4355,7 +4440,13 @@ static int choose_delay(double dt) {
 
 	now = dnow();
 
-	if (now > last_link + 30.0 || link == LR_UNSET) {
+	if (pacing) {
+		/* slow clients are held back by pace_clients() */
+		if (now > last_link + 2.0 || link == LR_UNSET) {
+			link = pace_link_rate(&latency, &netrate);
+			last_link = now;
+		}
+	} else if (now > last_link + 30.0 || link == LR_UNSET) {
 		link = link_rate(&latency, &netrate);
 		last_link = now;
 	}
@@ -4642,7 +4733,7 @@ void watch_loop(void) {
 			continue;
 		}
 
-		if (! urgent_update) {
+		if (! urgent_update && event_checks_due()) {
 			if (do_copy_screen) {
 				do_copy_screen = 0;
 				copy_screen();
@@ -4651,6 +4742,7 @@ void watch_loop(void) {
 			check_new_clients();
 			check_ncache(0, 0);
 			check_xevents(0);
+			check_sel_send();
 			check_autorepeat();
 			check_pm();
 			check_filexfer();
@@ -4707,9 +4799,17 @@ void watch_loop(void) {
 			}
 		}
 
+		stats_sample();
+		bw_limit_clients();
+		pace_clients();
+
 		if (! screen || ! screen->clientHead) {
 			/* waiting for a client */
-			usleep(200 * 1000);
+			if (event_loop) {
+				event_wait(200, 0);
+			} else {
+				usleep(200 * 1000);
+			}
 			continue;
 		}
 
@@ -4822,6 +4922,7 @@ void watch_loop(void) {
 				tile_diffs = scan_for_updates(0);
 			}
 			dt = dtime(&tm);
+			stats_scan(dt, tile_diffs);
 			if (! nap_ok) {
 				last_dt = dt;
 			}
@@ -4863,6 +4964,9 @@ void watch_loop(void) {
 
 		if (urgent_update) {
 			;
+		} else if (event_loop) {
+			/* sleep until something happens or wait is up */
+			event_wait(wait, tile_diffs);
 		} else if (wait > 2*waitms) {
 			/* bog case, break it up */
 			nap_sleep(wait, 10);
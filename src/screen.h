@@ -64,5 +64,6 @@ extern rfbBool vnc_reflect_send_cuttext(char *str, int len);
 extern int rawfb_reset;
 extern int rawfb_dev_video;
 extern int rawfb_vnc_reflect;
+extern int rawfb_zerocopy;
 
 #endif /* _X11VNC_SCREEN_H */
@@ -0,0 +1,460 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- scrolldet.c -- */
+
+#include "x11vnc.h"
+#include "scrolldet.h"
+#include "screen.h"
+#include "unixpw.h"
+#include "util.h"
+
+/*
+ * -scrolldetect: find scrolls in the framebuffer contents instead of
+ * snooping on the X protocol like -scrollcopyrect does (which needs
+ * RECORD and toolkits that still scroll with XCopyArea).
+ *
+ * Before scan_for_updates() copies the changed tiles into main_fb,
+ * scrolldet_begin() hashes each line of every tile column, and each
+ * column of every tile row, of the box around them.  After the copy
+ * scrolldet_end() hashes the box again and looks for the shift that
+ * maps the most old lines onto new ones.  The parts of the box that
+ * are just the old contents moved are scheduled as a CopyRect and
+ * their tiles dropped from the update, so only the newly exposed
+ * strip is sent as pixel data.
+ */
+
+int scroll_detect = 0;	/* -scrolldetect */
+
+int scrolldet_begin(void);
+int scrolldet_pending(void);
+int scrolldet_end(void);
+
+static int scrolldet_ok(void);
+static void hash_box(unsigned long long *hv, unsigned long long *hh);
+static int distinct(unsigned long long *h, int k, int len);
+static int best_shift(unsigned long long *ov, unsigned long long *nv,
+    int nstrips, int len);
+static sraRegionPtr shift_region(unsigned long long *ov,
+    unsigned long long *nv, int nstrips, int len, int shift, int vertical);
+static int clear_tiles(sraRegionPtr region);
+
+
+#define SCROLL_MIN_RUN   8	/* shortest run of lines worth copying */
+#define SCROLL_MIN_VOTES 8	/* fewest distinct lines that must agree */
+
+static int pending = 0;
+static char *box_fb = NULL;
+static int box_dpy_x, box_dpy_y;
+static int box_x1, box_y1, box_x2, box_y2;	/* pixels */
+static int box_tx1, box_ty1, box_ntx, box_nty;	/* tiles */
+
+/* line hashes: [tile column][line] then [tile row][column] */
+static unsigned long long *old_hash = NULL, *new_hash = NULL;
+static size_t hash_size = 0;
+
+/* best_shift() work space */
+static int *votes = NULL, votes_size = 0;
+static unsigned long long *tab_key = NULL;
+static int *tab_val = NULL, tab_size = 0;
+
+static int scrolldet_ok(void) {
+	if (! scroll_detect || ! screen || ! main_fb || client_count == 0) {
+		return 0;
+	}
+	/* the CopyRect has to apply to the clients' fb as is */
+	if (rfb_fb != main_fb || rotating || scaling || cmap8to24) {
+		return 0;
+	}
+	if (ncache > 0 || rawfb_zerocopy || unixpw_in_progress) {
+		return 0;
+	}
+	if (bpp != 8 && bpp != 16 && bpp != 32) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Called before the changed tiles are copied into main_fb, so the
+ * hashes are of what the viewers have (or are about to be sent).
+ */
+int scrolldet_begin(void) {
+	int x, y, n, W, H;
+	int tx1 = ntiles_x, tx2 = -1, ty1 = ntiles_y, ty2 = -1;
+	size_t need;
+
+	pending = 0;
+	if (! scrolldet_ok()) {
+		return 0;
+	}
+	for (y=0; y < ntiles_y; y++) {
+		for (x=0; x < ntiles_x; x++) {
+			n = x + y * ntiles_x;
+			if (! tile_has_diff[n]) {
+				continue;
+			}
+			if (x < tx1) tx1 = x;
+			if (x > tx2) tx2 = x;
+			if (y < ty1) ty1 = y;
+			if (y > ty2) ty2 = y;
+		}
+	}
+	if (tx2 < 0) {
+		return 0;
+	}
+
+	box_x1 = tx1 * tile_x;
+	box_y1 = ty1 * tile_y;
+	box_x2 = (tx2 + 1) * tile_x;
+	box_y2 = (ty2 + 1) * tile_y;
+	if (box_x2 > dpy_x) box_x2 = dpy_x;
+	if (box_y2 > dpy_y) box_y2 = dpy_y;
+	W = box_x2 - box_x1;
+	H = box_y2 - box_y1;
+	if (W * H < scrollcopyrect_min_area) {
+		return 0;
+	}
+	box_tx1 = tx1;
+	box_ty1 = ty1;
+	box_ntx = tx2 - tx1 + 1;
+	box_nty = ty2 - ty1 + 1;
+
+	need = (size_t) box_ntx * H + (size_t) box_nty * W;
+	if (need > hash_size) {
+		if (old_hash) free(old_hash);
+		if (new_hash) free(new_hash);
+		old_hash = (unsigned long long *) malloc(need * sizeof(*old_hash));
+		new_hash = (unsigned long long *) malloc(need * sizeof(*new_hash));
+		if (! old_hash || ! new_hash) {
+			if (old_hash) free(old_hash);
+			if (new_hash) free(new_hash);
+			old_hash = new_hash = NULL;
+			hash_size = 0;
+			return 0;
+		}
+		hash_size = need;
+	}
+
+	box_fb = main_fb;
+	box_dpy_x = dpy_x;
+	box_dpy_y = dpy_y;
+	hash_box(old_hash, old_hash + (size_t) box_ntx * H);
+	pending = 1;
+	return 1;
+}
+
+int scrolldet_pending(void) {
+	return pending;
+}
+
+/*
+ * One pass over the box: hv gets a hash per line of each tile column
+ * and hh one per column of each tile row.
+ */
+static void hash_box(unsigned long long *hv, unsigned long long *hh) {
+	int pixelsize = bpp/8;
+	int W = box_x2 - box_x1, H = box_y2 - box_y1;
+	int x, y, c;
+	unsigned int p;
+	unsigned long long v, *h;
+
+	for (x=0; x < box_nty * W; x++) {
+		hh[x] = FNV_INIT;
+	}
+	for (y=0; y < H; y++) {
+		char *src = main_fb + (box_y1 + y) * main_bytes_per_line
+		    + box_x1 * pixelsize;
+
+		h = hh + ((box_y1 + y) / tile_y - box_ty1) * W;
+		v = FNV_INIT;
+		c = 0;
+		for (x=0; x < W; x++) {
+			if (pixelsize == 4) {
+				p = ((unsigned int *) src)[x];
+			} else if (pixelsize == 2) {
+				p = ((unsigned short *) src)[x];
+			} else {
+				p = ((unsigned char *) src)[x];
+			}
+			v = FNV_MIX(v, p);
+			h[x] = FNV_MIX(h[x], p);
+			if ((x + 1) % tile_x == 0 || x == W - 1) {
+				hv[c * H + y] = v;
+				v = FNV_INIT;
+				c++;
+			}
+		}
+	}
+}
+
+/*
+ * Whether line k differs from its neighbours: blank runs match at
+ * every shift and must not vote.
+ */
+static int distinct(unsigned long long *h, int k, int len) {
+	if (k > 0 && h[k] == h[k-1]) {
+		return 0;
+	}
+	if (k < len - 1 && h[k] == h[k+1]) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Each changed, distinct new line k of a strip that appears exactly
+ * once among the old ones, at k', votes for the shift k - k'.  Returns
+ * the shift most of them agree on, 0 if there is none.
+ */
+static int best_shift(unsigned long long *ov, unsigned long long *nv,
+    int nstrips, int len) {
+	int s, k, i, d, best, total = 0, mask;
+
+	if (len < 2 * SCROLL_MIN_RUN) {
+		return 0;
+	}
+	if (votes_size < 2 * len) {
+		if (votes) free(votes);
+		votes = (int *) malloc(2 * len * sizeof(int));
+		votes_size = votes ? 2 * len : 0;
+	}
+	if (tab_size < 2 * len) {
+		if (tab_key) free(tab_key);
+		if (tab_val) free(tab_val);
+		for (tab_size = 64; tab_size < 2 * len; tab_size *= 2) {
+			;
+		}
+		tab_key = (unsigned long long *) malloc(tab_size
+		    * sizeof(*tab_key));
+		tab_val = (int *) malloc(tab_size * sizeof(int));
+		if (! tab_key || ! tab_val) {
+			tab_size = 0;
+		}
+	}
+	if (! votes_size || ! tab_size) {
+		return 0;
+	}
+	memset(votes, 0, 2 * len * sizeof(int));
+	mask = tab_size - 1;
+
+	for (s=0; s < nstrips; s++) {
+		unsigned long long *o = ov + (size_t) s * len;
+		unsigned long long *n = nv + (size_t) s * len;
+
+		/* index the distinct old lines by hash, -1: not unique */
+		for (i=0; i < tab_size; i++) {
+			tab_val[i] = -2;
+		}
+		for (k=0; k < len; k++) {
+			if (! distinct(o, k, len)) {
+				continue;
+			}
+			i = (int) (o[k] & mask);
+			while (tab_val[i] != -2 && tab_key[i] != o[k]) {
+				i = (i + 1) & mask;
+			}
+			if (tab_val[i] == -2) {
+				tab_key[i] = o[k];
+				tab_val[i] = k;
+			} else {
+				tab_val[i] = -1;
+			}
+		}
+		for (k=0; k < len; k++) {
+			if (n[k] == o[k] || ! distinct(n, k, len)) {
+				continue;
+			}
+			i = (int) (n[k] & mask);
+			while (tab_val[i] != -2) {
+				if (tab_key[i] == n[k]) {
+					if (tab_val[i] >= 0) {
+						votes[k - tab_val[i] + len]++;
+						total++;
+					}
+					break;
+				}
+				i = (i + 1) & mask;
+			}
+		}
+	}
+
+	best = 0;
+	for (d=1; d < 2 * len; d++) {
+		if (votes[d] > votes[best]) {
+			best = d;
+		}
+	}
+	if (votes[best] < SCROLL_MIN_VOTES || 2 * votes[best] < total) {
+		return 0;
+	}
+	return best - len;
+}
+
+/*
+ * The destination region for shift: runs of at least SCROLL_MIN_RUN
+ * lines in changed strips where new[k] == old[k - shift].
+ */
+static sraRegionPtr shift_region(unsigned long long *ov,
+    unsigned long long *nv, int nstrips, int len, int shift, int vertical) {
+	sraRegionPtr region = sraRgnCreate(), r;
+	int s, k, start, ok, x1, y1, x2, y2;
+
+	for (s=0; s < nstrips; s++) {
+		unsigned long long *o = ov + (size_t) s * len;
+		unsigned long long *n = nv + (size_t) s * len;
+
+		for (k=0; k < len; k++) {
+			if (n[k] != o[k]) {
+				break;
+			}
+		}
+		if (k == len) {
+			continue;	/* strip did not change */
+		}
+
+		start = -1;
+		for (k=0; k <= len; k++) {
+			ok = (k < len && k - shift >= 0 && k - shift < len
+			    && n[k] == o[k - shift]);
+			if (ok && start < 0) {
+				start = k;
+			} else if (! ok && start >= 0) {
+				if (k - start < SCROLL_MIN_RUN) {
+					start = -1;
+					continue;
+				}
+				if (vertical) {
+					x1 = box_x1 + s * tile_x;
+					x2 = x1 + tile_x;
+					y1 = box_y1 + start;
+					y2 = box_y1 + k;
+					if (x2 > box_x2) x2 = box_x2;
+				} else {
+					y1 = box_y1 + s * tile_y;
+					y2 = y1 + tile_y;
+					x1 = box_x1 + start;
+					x2 = box_x1 + k;
+					if (y2 > box_y2) y2 = box_y2;
+				}
+				r = sraRgnCreateRect(x1, y1, x2, y2);
+				sraRgnOr(region, r);
+				sraRgnDestroy(r);
+				start = -1;
+			}
+		}
+	}
+	return region;
+}
+
+/*
+ * Changed tiles entirely inside the copied region need no pixel
+ * update; marking them would even cancel the CopyRect there.
+ */
+static int clear_tiles(sraRegionPtr region) {
+	int x, y, n, x1, y1, x2, y2, count = 0;
+	sraRegionPtr r;
+
+	for (y = box_ty1; y < box_ty1 + box_nty; y++) {
+		for (x = box_tx1; x < box_tx1 + box_ntx; x++) {
+			n = x + y * ntiles_x;
+			if (! tile_has_diff[n]) {
+				continue;
+			}
+			x1 = x * tile_x;
+			y1 = y * tile_y;
+			x2 = x1 + tile_x;
+			y2 = y1 + tile_y;
+			if (x2 > dpy_x) x2 = dpy_x;
+			if (y2 > dpy_y) y2 = dpy_y;
+			r = sraRgnCreateRect(x1, y1, x2, y2);
+			sraRgnSubtract(r, region);
+			if (sraRgnEmpty(r)) {
+				TILE_DIFF(n, 0);
+				count++;
+			}
+			sraRgnDestroy(r);
+		}
+	}
+	return count;
+}
+
+/*
+ * Called once main_fb has the new contents, before the changed tiles
+ * are marked modified.  Returns the number of tiles the CopyRect took
+ * out of the update.
+ */
+int scrolldet_end(void) {
+	sraRegionPtr region = NULL;
+	int W = box_x2 - box_x1, H = box_y2 - box_y1;
+	int d, dx = 0, dy = 0, count = 0;
+
+	if (! pending) {
+		return 0;
+	}
+	pending = 0;
+	if (! scrolldet_ok() || main_fb != box_fb || dpy_x != box_dpy_x
+	    || dpy_y != box_dpy_y) {
+		return 0;
+	}
+	hash_box(new_hash, new_hash + (size_t) box_ntx * H);
+
+	d = best_shift(old_hash, new_hash, box_ntx, H);
+	if (d) {
+		dy = d;
+		region = shift_region(old_hash, new_hash, box_ntx, H, d, 1);
+	} else {
+		unsigned long long *oh = old_hash + (size_t) box_ntx * H;
+		unsigned long long *nh = new_hash + (size_t) box_ntx * H;
+
+		d = best_shift(oh, nh, box_nty, W);
+		if (d) {
+			dx = d;
+			region = shift_region(oh, nh, box_nty, W, d, 0);
+		}
+	}
+	if (! region) {
+		return 0;
+	}
+	if (! sraRgnEmpty(region)) {
+		rfbScheduleCopyRegion(screen, region, dx, dy);
+		last_copyrect = dnow();
+		count = clear_tiles(region);
+		if (debug_scroll) {
+			rfbLog("scrolldetect: dx=%d dy=%d in %dx%d+%d+%d,"
+			    " %d tiles copied\n", dx, dy, W, H, box_x1,
+			    box_y1, count);
+		}
+	}
+	sraRgnDestroy(region);
+	return count;
+}
@@ -65,21 +65,245 @@ int check_sel_direction(char *dir, char *label, char *sel, int len);
 void cutbuffer_send(void);
 void selection_send(XEvent *ev);
 void resend_selection(char *type);
+int sel_incr_event(XEvent *ev);
+int sel_incr_busy(void);
+void check_sel_send(void);
 
 
 /*
  * Our callbacks instruct us to check for changes in the cutbuffer
  * and PRIMARY and CLIPBOARD selection on the local X11 display.
  *
- * TODO: check if malloc does not cause performance issues (esp. WRT
- * SelectionNotify handling).
+ * The values are kept in heap buffers sized to their content and are
+ * compared by length and a 64 bit hash.  A value too big for a single
+ * property moves with the ICCCM INCR protocol, one chunk for each
+ * PropertyNotify, so neither direction holds up the main loop.
  */
-static char cutbuffer_str[PROP_MAX+1];
-static char primary_str[PROP_MAX+1];
-static char clipboard_str[PROP_MAX+1];
-static int cutbuffer_len = 0;
-static int primary_len   = 0;
-static int clipboard_len = 0;
+typedef struct sel_buf {
+	char *str;
+	int len;
+	int size;
+	unsigned long long hash;
+} sel_buf_t;
+
+static sel_buf_t cutbuffer_sel;
+static sel_buf_t primary_sel;
+static sel_buf_t clipboard_sel;
+static sel_buf_t sel_in;	/* a new value is read into here, then swapped */
+static sel_buf_t cut_in;	/* the same for CUT_BUFFER0, apart from INCR */
+
+/* an INCR transfer idle for this many seconds is given up */
+#define INCR_TIMEOUT 10.0
+#define INCR_SENDS 8
+
+/* INCR from the selection owner into a property on selwin */
+static struct {
+	Atom selection;
+	Atom prop;
+	double last;
+	int toobig;
+} incr_in = {None, None, 0.0, 0};
+
+/* INCR from us to X11 clients requesting our large selection */
+static struct incr_send {
+	Window win;
+	Atom prop;
+	Atom target;
+	char *str;
+	int len;
+	int off;
+	double last;
+} incr_out[INCR_SENDS];
+
+/* the changed value check_sel_send() hands to the VNC clients */
+static sel_buf_t *sel_pending = NULL;
+static char *sel_pending_label = "";
+
+static Atom incr_atom(void);
+static int incr_chunk_size(void);
+static int sel_reserve(sel_buf_t *b, int len);
+static int sel_append(sel_buf_t *b, char *data, int len);
+static unsigned long long sel_hash(char *str, int len);
+static int read_sel_prop(Window w, Atom prop, Bool del, sel_buf_t *b,
+    Atom *type);
+static void sel_toobig(int toobig);
+static void sel_done(Atom selection);
+static void incr_recv_next(void);
+static void incr_send_start(XSelectionRequestEvent *req, Atom prop,
+    char *str, int len);
+static void incr_send_next(int i);
+static void incr_send_end(int i);
+
+static Atom incr_atom(void) {
+	static Atom atom = None;
+#if !NO_X11
+	if (atom == None) {
+		atom = XInternAtom(dpy, "INCR", False);
+	}
+#endif
+	return atom;
+}
+
+/*
+ * Largest piece we write with one XChangeProperty(); bigger selections
+ * go out with INCR.
+ */
+static int incr_chunk_size(void) {
+	long max = PROP_MAX;
+#if !NO_X11
+	long req = XMaxRequestSize(dpy) * 4 - 100;
+	if (req > 0 && req < max) {
+		max = req;
+	}
+#endif
+	return (int) max;
+}
+
+static int sel_reserve(sel_buf_t *b, int len) {
+	char *str;
+	int size;
+
+	if (len < b->size) {
+		return 1;
+	}
+	size = b->size ? b->size : 4096;
+	while (size <= len) {
+		size *= 2;
+	}
+	str = (char *) realloc(b->str, size);
+	if (! str) {
+		return 0;
+	}
+	b->str = str;
+	b->size = size;
+	return 1;
+}
+
+static int sel_append(sel_buf_t *b, char *data, int len) {
+	if (b->len + (long) len > SEL_MAX || ! sel_reserve(b, b->len + len)) {
+		return 0;
+	}
+	memcpy(b->str + b->len, data, len);
+	b->len += len;
+	b->str[b->len] = '\0';
+	return 1;
+}
+
+static unsigned long long sel_hash(char *str, int len) {
+	return fnv_bytes(FNV_INIT, str, len);
+}
+
+/*
+ * Append the value of property prop on window w to b (NULL to just
+ * read it), fetching PROP_MAX bytes per round trip.  With del the
+ * property is deleted once read.  Returns the number of bytes read,
+ * or -1 if they did not fit under SEL_MAX (b then holds the start).
+ *
+ * n.b.: our caller already has the X_LOCK.
+ */
+static int read_sel_prop(Window w, Atom prop, Bool del, sel_buf_t *b,
+    Atom *type) {
+#if NO_X11
+	if (!w || !prop || !del || !b) {}
+	*type = None;
+	return 0;
+#else
+	int format, dlen, got = 0, toobig = 0;
+	long offset = 0;
+	unsigned long nitems = 0, bytes_after = 0;
+	unsigned char *data = NULL;
+
+	*type = None;
+	do {
+		if (XGetWindowProperty(dpy, w, prop, offset, PROP_MAX/4, del,
+		    AnyPropertyType, type, &format, &nitems, &bytes_after,
+		    &data) != Success) {
+			break;
+		}
+		dlen = nitems * (format/8);
+		if (b && ! toobig && ! sel_append(b, (char *) data, dlen)) {
+			toobig = 1;
+		}
+		if (data) {
+			XFree_wr(data);
+			data = NULL;
+		}
+		got += dlen;
+		offset += dlen/4;
+	} while (bytes_after > 0 && dlen > 0);
+
+	return toobig ? -1 : got;
+#endif	/* NO_X11 */
+}
+
+/* warn about too big selections, but not on every poll */
+static void sel_toobig(int toobig) {
+	static int err = 0;
+
+	if (! toobig) {
+		err = 0;
+	} else if (err) {
+		err--;
+	} else {
+		err = 4;
+		rfbLog("warning: truncating large PRIMARY/CLIPBOARD"
+		    " selection > %ld bytes.\n", SEL_MAX);
+	}
+}
+
+/*
+ * sel_in holds a complete new value of PRIMARY or CLIPBOARD: keep it
+ * and queue it for the VNC clients if it differs from what we had.
+ */
+static void sel_done(Atom selection) {
+	static int sent_one = 0;
+	sel_buf_t *b, tmp;
+	unsigned long long hash;
+	char *label;
+
+	if (selection == XA_PRIMARY) {
+		b = &primary_sel;
+		label = "PRIMARY  ";
+	} else {
+		b = &clipboard_sel;
+		label = "CLIPBOARD";
+	}
+	if (! sel_reserve(&sel_in, 0)) {
+		return;
+	}
+	/* STRING has no NULs, stop at the first one like before */
+	sel_in.str[sel_in.len] = '\0';
+	sel_in.len = strlen(sel_in.str);
+
+	if (debug_sel) {
+		rfbLog("selection_send:  %s '%s'\n", label, sel_in.str);
+	}
+
+	/* look for changes in the new value */
+	hash = sel_hash(sel_in.str, sel_in.len);
+	if (sent_one && sel_in.len == b->len && hash == b->hash) {
+		/* evidently no change */
+		if (debug_sel) {
+			rfbLog("selection_send:  no change.\n");
+		}
+		return;
+	}
+	/* force a send the first time in */
+	sent_one = 1;
+
+	tmp = *b;
+	*b = sel_in;
+	b->hash = hash;
+	sel_in = tmp;
+	sel_in.len = 0;
+
+	if (b->len == 0) {
+		/* do not bother sending a null string out */
+		return;
+	}
+	sel_pending = b;
+	sel_pending_label = "selection_send";
+}
 
 /*
  * An X11 (not VNC) client on the local display has requested the selection
@@ -189,6 +413,12 @@ void selection_request(XEvent *ev, char *type) {
 			    ret, sizeof(targets[0]), sizeof(targets)/sizeof(targets[0]));
 		}
 
+	} else if ((int) length > incr_chunk_size() &&
+	    req_event->requestor != rootwin &&
+	    req_event->requestor != selwin) {
+		/* too big for one request, hand it over in pieces */
+		incr_send_start(req_event, notify_event.property, str, length);
+
 	} else {
 		/* data request */
 		int ret;
@@ -291,7 +521,7 @@ int check_sel_direction(char *dir, char *label, char *sel, int len) {
 
 /*
  * CUT_BUFFER0 property on the local display has changed, we read and
- * store it and send it out to any connected VNC clients.
+ * store it and queue it for any connected VNC clients.
  *
  * n.b.: our caller already has the X_LOCK.
  */
@@ -301,66 +531,45 @@ void cutbuffer_send(void) {
 	return;
 #else
 	Atom type;
-	int format, slen, dlen, len;
-	unsigned long nitems = 0, bytes_after = 0;
-	unsigned char* data = NULL;
-
-	cutbuffer_str[0] = '\0';
-	slen = 0;
+	sel_buf_t tmp;
 
 	RAWFB_RET_VOID
 
-	/* read the property value into cutbuffer_str: */
-	do {
-		if (XGetWindowProperty(dpy, DefaultRootWindow(dpy),
-		    XA_CUT_BUFFER0, nitems/4, PROP_MAX/16, False,
-		    AnyPropertyType, &type, &format, &nitems, &bytes_after,
-		    &data) == Success) {
-
-			dlen = nitems * (format/8);
-			if (slen + dlen > PROP_MAX) {
-				/* too big */
-				rfbLog("warning: truncating large CUT_BUFFER0"
-				   " selection > %d bytes.\n", PROP_MAX);
-				XFree_wr(data);
-				break;
-			}
-			memcpy(cutbuffer_str+slen, data, dlen);
-			slen += dlen;
-			cutbuffer_str[slen] = '\0';
-			XFree_wr(data);
-		}
-	} while (bytes_after > 0);
+	if (! sel_reserve(&cut_in, 0)) {
+		return;
+	}
+	cut_in.len = 0;
+	cut_in.str[0] = '\0';
 
-	cutbuffer_str[PROP_MAX] = '\0';
+	/* read the property value into cut_in: */
+	if (read_sel_prop(DefaultRootWindow(dpy), XA_CUT_BUFFER0, False,
+	    &cut_in, &type) < 0) {
+		rfbLog("warning: truncating large CUT_BUFFER0"
+		   " selection > %ld bytes.\n", SEL_MAX);
+	}
+	cut_in.len = strlen(cut_in.str);
 
 	if (debug_sel) {
-		rfbLog("cutbuffer_send: '%s'\n", cutbuffer_str);
+		rfbLog("cutbuffer_send: '%s'\n", cut_in.str);
 	}
 
-	if (! all_clients_initialized()) {
-		rfbLog("cutbuffer_send: no send: uninitialized clients\n");
-		return; /* some clients initializing, cannot send */ 
-	}
-	if (unixpw_in_progress) {
-		return;
-	}
+	tmp = cutbuffer_sel;
+	cutbuffer_sel = cut_in;
+	cutbuffer_sel.hash = sel_hash(cutbuffer_sel.str, cutbuffer_sel.len);
+	cut_in = tmp;
+	cut_in.len = 0;
 
-	/* now send it to any connected VNC clients (rfbServerCutText) */
-	if (!screen) {
-		return;
-	}
-	cutbuffer_len = len = strlen(cutbuffer_str);
-	if (check_sel_direction("send", "cutbuffer_send", cutbuffer_str, len)) {
-		rfbSendServerCutText(screen, cutbuffer_str, len);
-	}
+	sel_pending = &cutbuffer_sel;
+	sel_pending_label = "cutbuffer_send";
 #endif	/* NO_X11 */
 }
 
 /* 
  * "callback" for our SelectionNotify polling.  We try to determine if
- * the PRIMARY selection has changed (checking length and first CHKSZ bytes)
- * and if it has we store it and send it off to any connected VNC clients.
+ * the PRIMARY selection has changed (checking length and hash) and if
+ * it has we store it and queue it for any connected VNC clients.  If
+ * the owner answers with INCR the value arrives in pieces via
+ * sel_incr_event() and is checked once complete.
  *
  * n.b.: our caller already has the X_LOCK.
  *
@@ -369,8 +578,6 @@ void cutbuffer_send(void) {
  *
  * Also: XFIXES has XFixesSelectSelectionInput().
  */
-#define CHKSZ 32
-
 void selection_send(XEvent *ev) {
 #if NO_X11
 	RAWFB_RET_VOID
@@ -378,23 +585,14 @@ void selection_send(XEvent *ev) {
 	return;
 #else
 	Atom type;
-	int format, slen, dlen, oldlen, newlen, toobig = 0, len;
-	static int err = 0, sent_one = 0;
-	char before[CHKSZ], after[CHKSZ];
-	unsigned long nitems = 0, bytes_after = 0;
-	unsigned char* data = NULL;
-	char *selection_str;
+	int len;
 
 	RAWFB_RET_VOID
-	/*
-	 * remember info about our last value of PRIMARY (or CUT_BUFFER0)
-	 * so we can check for any changes below.
-	 */
+
 	if (ev->xselection.selection == XA_PRIMARY) {
 		if (! watch_primary) {
 			return;
 		}
-		selection_str = primary_str;
 		if (debug_sel) {
 			rfbLog("selection_send: event PRIMARY   prop: %d  requestor: 0x%x  atom: %d\n",
 			    ev->xselection.property, ev->xselection.requestor, ev->xselection.selection);
@@ -403,7 +601,6 @@ void selection_send(XEvent *ev) {
 		if (! watch_clipboard) {
 			return;
 		}
-		selection_str = clipboard_str;
 		if (debug_sel) {
 			rfbLog("selection_send: event CLIPBOARD prop: %d  requestor: 0x%x atom: %d\n",
 			    ev->xselection.property, ev->xselection.requestor, ev->xselection.selection);
@@ -411,100 +608,277 @@ void selection_send(XEvent *ev) {
 	} else {
 		return;
 	}
-	
-	oldlen = strlen(selection_str);
-	strncpy(before, selection_str, CHKSZ);
-
-	selection_str[0] = '\0';
-	slen = 0;
+	if (incr_in.prop != None) {
+		/* an INCR transfer is still coming in */
+		return;
+	}
+	if (! sel_reserve(&sel_in, 0)) {
+		return;
+	}
+	sel_in.len = 0;
+	sel_in.str[0] = '\0';
 
 	/* read in the current value of PRIMARY or CLIPBOARD: */
-	do {
-		if (XGetWindowProperty(dpy, ev->xselection.requestor,
-		    ev->xselection.property, nitems/4, PROP_MAX/16, True,
-		    AnyPropertyType, &type, &format, &nitems, &bytes_after,
-		    &data) == Success) {
-
-			dlen = nitems * (format/8);
-			if (slen + dlen > PROP_MAX) {
-				/* too big */
-				toobig = 1;
-				XFree_wr(data);
-				if (err) {	/* cut down on messages */
-					break;
-				} else {
-					err = 5;
-				}
-				rfbLog("warning: truncating large PRIMARY"
-				    "/CLIPBOARD selection > %d bytes.\n",
-				    PROP_MAX);
-				break;
-			}
-if (debug_sel) fprintf(stderr, "selection_send: data: '%s' dlen: %d nitems: %lu ba: %lu\n", data, dlen, nitems, bytes_after);
-			memcpy(selection_str+slen, data, dlen);
-			slen += dlen;
-			selection_str[slen] = '\0';
-			XFree_wr(data);
+	len = read_sel_prop(ev->xselection.requestor,
+	    ev->xselection.property, True, &sel_in, &type);
+
+	if (type != None && type == incr_atom()) {
+		/* deleting the property above asked for the first chunk */
+		incr_in.selection = ev->xselection.selection;
+		incr_in.prop = ev->xselection.property;
+		incr_in.last = dnow();
+		incr_in.toobig = 0;
+		sel_in.len = 0;
+		sel_in.str[0] = '\0';
+		if (debug_sel) {
+			rfbLog("selection_send: INCR transfer started.\n");
 		}
-	} while (bytes_after > 0);
+		return;
+	}
 
-	if (! toobig) {
-		err = 0;
-	} else if (err) {
-		err--;
+	sel_toobig(len < 0);
+	sel_done(ev->xselection.selection);
+#endif	/* NO_X11 */
+}
+
+/*
+ * Called for every PropertyNotify; returns 1 if it belonged to one of
+ * our INCR transfers.
+ *
+ * n.b.: our caller already has the X_LOCK.
+ */
+int sel_incr_event(XEvent *ev) {
+	int i;
+
+	if (ev->type != PropertyNotify) {
+		return 0;
 	}
+	if (incr_in.prop != None && ev->xproperty.window == selwin &&
+	    ev->xproperty.atom == incr_in.prop) {
+		if (ev->xproperty.state == PropertyNewValue) {
+			incr_recv_next();
+		}
+		return 1;
+	}
+	for (i=0; i < INCR_SENDS; i++) {
+		struct incr_send *s = &incr_out[i];
 
-	if (! sent_one) {
-		/* try to force a send first time in */
-		oldlen = -1;
-		sent_one = 1;
+		if (s->win == None || ev->xproperty.window != s->win ||
+		    ev->xproperty.atom != s->prop) {
+			continue;
+		}
+		/* the requestor took the last chunk */
+		if (ev->xproperty.state == PropertyDelete) {
+			incr_send_next(i);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+int sel_incr_busy(void) {
+	return incr_in.prop != None;
+}
+
+/*
+ * The next chunk of an incoming INCR transfer is in the property;
+ * deleting it asks the owner for more, a zero length one ends it.
+ */
+static void incr_recv_next(void) {
+	Atom type;
+	int n;
+
+	n = read_sel_prop(selwin, incr_in.prop, True,
+	    incr_in.toobig ? NULL : &sel_in, &type);
+	incr_in.last = dnow();
+	if (n < 0) {
+		incr_in.toobig = 1;
+	}
+	if (n != 0) {
+		return;
 	}
 	if (debug_sel) {
-		rfbLog("selection_send:  %s '%s'\n",
-		    ev->xselection.selection == XA_PRIMARY ? "PRIMARY  " : "CLIPBOARD",
-		    selection_str);
+		rfbLog("selection_send: INCR transfer done: %d bytes.\n",
+		    sel_in.len);
 	}
+	incr_in.prop = None;
+	sel_toobig(incr_in.toobig);
+	sel_done(incr_in.selection);
+}
 
-	/* look for changes in the new value */
-	newlen = strlen(selection_str);
-	strncpy(after, selection_str, CHKSZ);
+static void incr_send_start(XSelectionRequestEvent *req, Atom prop,
+    char *str, int len) {
+#if NO_X11
+	if (!req || !prop || !str || !len) {}
+	return;
+#else
+	struct incr_send *s = NULL;
+	long llen = (long) len;
+	int i, oldest = 0;
+
+	for (i=0; i < INCR_SENDS; i++) {
+		if (incr_out[i].win == None) {
+			s = &incr_out[i];
+			break;
+		}
+		if (incr_out[i].last < incr_out[oldest].last) {
+			oldest = i;
+		}
+	}
+	if (! s) {
+		incr_send_end(oldest);
+		s = &incr_out[oldest];
+	}
 
-	if (oldlen == newlen && strncmp(before, after, CHKSZ) == 0) {
-		/* evidently no change */
+	/* our copy, xcut_str_* may change before the requestor is done */
+	s->str = (char *) malloc(len);
+	if (! s->str) {
+		return;
+	}
+	memcpy(s->str, str, len);
+	s->win = req->requestor;
+	s->prop = prop;
+	s->target = req->target;
+	s->len = len;
+	s->off = 0;
+	s->last = dnow();
+
+	XSelectInput_wr(dpy, s->win, PropertyChangeMask);
+	XChangeProperty(dpy, s->win, s->prop, incr_atom(), 32,
+	    PropModeReplace, (unsigned char *) &llen, 1);
+	if (debug_sel) {
+		rfbLog("INCR: start %d bytes to 0x%lx\n", len, s->win);
+	}
+#endif	/* NO_X11 */
+}
+
+/*
+ * Write the next chunk of an outgoing INCR transfer, the zero length
+ * one after the data ends it.
+ */
+static void incr_send_next(int i) {
+#if NO_X11
+	if (!i) {}
+	return;
+#else
+	struct incr_send *s = &incr_out[i];
+	XErrorHandler old_handler;
+	int n = s->len - s->off, chunk = incr_chunk_size();
+
+	if (n > chunk) {
+		n = chunk;
+	}
+
+	/* the window may have gone away, so trap errors */
+	trapped_xerror = 0;
+	old_handler = XSetErrorHandler(trap_xerror);
+
+	XChangeProperty(dpy, s->win, s->prop, s->target, 8,
+	    PropModeReplace, (unsigned char *) s->str + s->off, n);
+	XSync(dpy, False);
+
+	XSetErrorHandler(old_handler);
+
+	s->off += n;
+	s->last = dnow();
+	if (trapped_xerror) {
+		rfbLog("selection_request: ignored XError during INCR to"
+		    " 0x%lx.\n", s->win);
+		incr_send_end(i);
+	} else if (n == 0) {
 		if (debug_sel) {
-			rfbLog("selection_send:  no change.\n");
+			rfbLog("INCR: done %d bytes to 0x%lx\n", s->len,
+			    s->win);
 		}
-		return;
+		incr_send_end(i);
 	}
-	if (newlen == 0) {
-		/* do not bother sending a null string out */
+	trapped_xerror = 0;
+#endif	/* NO_X11 */
+}
+
+static void incr_send_end(int i) {
+#if NO_X11
+	if (!i) {}
+	return;
+#else
+	struct incr_send *s = &incr_out[i];
+	XErrorHandler old_handler;
+
+	if (s->win == None) {
 		return;
 	}
+	trapped_xerror = 0;
+	old_handler = XSetErrorHandler(trap_xerror);
+	XSelectInput_wr(dpy, s->win, NoEventMask);
+	XSync(dpy, False);
+	XSetErrorHandler(old_handler);
+	trapped_xerror = 0;
 
-	if (! all_clients_initialized()) {
-		rfbLog("selection_send: no send: uninitialized clients\n");
-		return; /* some clients initializing, cannot send */ 
+	free(s->str);
+	s->str = NULL;
+	s->win = None;
+#endif	/* NO_X11 */
+}
+
+/*
+ * Called from the main loop, without the X_LOCK, to hand a changed
+ * selection to the VNC clients (once, however often it changed since
+ * the last call) and to give up on INCR transfers that stalled.
+ */
+void check_sel_send(void) {
+	sel_buf_t *b;
+	double now = dnow();
+	int i;
+
+	RAWFB_RET_VOID
+
+	for (i=0; i < INCR_SENDS; i++) {
+		if (incr_out[i].win != None &&
+		    now > incr_out[i].last + INCR_TIMEOUT) {
+			rfbLog("selection_request: INCR to 0x%lx timed"
+			    " out.\n", incr_out[i].win);
+			X_LOCK;
+			incr_send_end(i);
+			X_UNLOCK;
+		}
+	}
+	if (incr_in.prop != None && now > incr_in.last + INCR_TIMEOUT) {
+		rfbLog("selection_send: INCR from the selection owner timed"
+		    " out.\n");
+#if !NO_X11
+		if (selwin != None) {
+			/* do not leave a stale chunk on selwin */
+			X_LOCK;
+			XDeleteProperty(dpy, selwin, incr_in.prop);
+			X_UNLOCK;
+		}
+#endif
+		incr_in.prop = None;
+		sel_in.len = 0;
 	}
 
-	if (unixpw_in_progress) {
+	b = sel_pending;
+	if (! b) {
 		return;
 	}
-
-	/* now send it to any connected VNC clients (rfbServerCutText) */
-	if (!screen) {
+	if (! screen || unixpw_in_progress) {
+		sel_pending = NULL;
 		return;
 	}
-
-	len = newlen;
-	if (ev->xselection.selection == XA_PRIMARY) {
-		primary_len = len;
-	} else if (clipboard_atom && ev->xselection.selection == clipboard_atom)  {
-		clipboard_len = len;
+	if (! all_clients_initialized()) {
+		/* some clients initializing, cannot send yet */
+		if (debug_sel) {
+			rfbLog("%s: no send: uninitialized clients\n",
+			    sel_pending_label);
+		}
+		return;
 	}
-	if (check_sel_direction("send", "selection_send", selection_str, len)) {
-		rfbSendServerCutText(screen, selection_str, len);
+	sel_pending = NULL;
+
+	/* now send it to any connected VNC clients (rfbServerCutText) */
+	if (check_sel_direction("send", sel_pending_label, b->str, b->len)) {
+		rfbSendServerCutText(screen, b->str, b->len);
 	}
-#endif	/* NO_X11 */
 }
 
 void resend_selection(char *type) {
@@ -513,8 +887,7 @@ void resend_selection(char *type) {
 	if (!type) {}
 	return;
 #else
-	char *selection_str = "";
-	int len = 0;
+	sel_buf_t *b = NULL;
 
 	RAWFB_RET_VOID
 
@@ -530,19 +903,18 @@ void resend_selection(char *type) {
 	}
 
 	if (!strcmp(type, "cutbuffer")) {
-		selection_str = cutbuffer_str;
-		len = cutbuffer_len;
+		b = &cutbuffer_sel;
 	} else if (!strcmp(type, "clipboard")) {
-		selection_str = clipboard_str;
-		len = clipboard_len;
+		b = &clipboard_sel;
 	} else if (!strcmp(type, "primary")) {
-		selection_str = primary_str;
-		len = primary_len;
+		b = &primary_sel;
 	}
-	if (check_sel_direction("send", "selection_send", selection_str, len)) {
-		rfbSendServerCutText(screen, selection_str, len);
+	if (! b || ! b->str) {
+		return;
+	}
+	if (check_sel_direction("send", "selection_send", b->str, b->len)) {
+		rfbSendServerCutText(screen, b->str, b->len);
 	}
 #endif	/* NO_X11 */
 }
 
-
@@ -51,5 +51,8 @@ extern int check_sel_direction(char *dir, char *label, char *sel, int len);
 extern void cutbuffer_send(void);
 extern void selection_send(XEvent *ev);
 extern void resend_selection(char *type);
+extern int sel_incr_event(XEvent *ev);
+extern int sel_incr_busy(void);
+extern void check_sel_send(void);
 
 #endif /* _X11VNC_SELECTION_H */
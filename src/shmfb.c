@@ -0,0 +1,214 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- shmfb.c -- */
+
+#include "x11vnc.h"
+#include "shmfb.h"
+#include "xwrappers.h"
+#include "x11vnc_shmfb.h"
+
+/*
+ * Damage rectangles posted by the program drawing into a -rawfb shm:
+ * or map: segment, see include/x11vnc_shmfb.h for the layout.  When
+ * the segment starts with the header scan_for_updates() takes the
+ * changed tiles from the rect ring instead of from scan_display().
+ */
+
+int shmfb_damage = 1;	/* -nofbdamage turns it off */
+
+int shmfb_header_size(char *buf, size_t len);
+void shmfb_attach(char *addr, size_t len);
+void shmfb_detach(void);
+int shmfb_mark_tiles(void);
+
+static int mark_rect(x11vnc_shmfb_rect_t *r);
+
+static x11vnc_shmfb_header_t *shmfb_hdr = NULL;
+/* ring_size as checked by shmfb_header_size(), the producer may change it */
+static unsigned int checked_ring = 0, shmfb_ring = 0;
+static unsigned long long last_seq = 0, last_frame = 0;
+static int synced = 0;
+
+/*
+ * Returns the header_size if buf (len bytes from the start of the
+ * segment) holds a valid header, 0 otherwise.
+ */
+int shmfb_header_size(char *buf, size_t len) {
+	x11vnc_shmfb_header_t hdr;
+
+	if (! shmfb_damage || ! buf || len < sizeof(hdr)) {
+		return 0;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != X11VNC_SHMFB_MAGIC) {
+		return 0;
+	}
+	if (hdr.version != X11VNC_SHMFB_VERSION) {
+		rfbLog("rawfb: damage header version %u, want %u, ignoring"
+		    " it.\n", hdr.version, X11VNC_SHMFB_VERSION);
+		return 0;
+	}
+	if (hdr.ring_size == 0 || hdr.ring_size > 1000000 ||
+	    hdr.header_size < X11VNC_SHMFB_HEADER_SIZE(hdr.ring_size)) {
+		rfbLog("rawfb: bad damage header, ring: %u size: %u\n",
+		    hdr.ring_size, hdr.header_size);
+		return 0;
+	}
+	checked_ring = hdr.ring_size;
+	return (int) hdr.header_size;
+}
+
+/*
+ * Called by initialize_raw_fb() with each new mapping; len is the
+ * mapped size if known, else 0.
+ */
+void shmfb_attach(char *addr, size_t len) {
+	int size;
+
+	shmfb_detach();
+	if (len == 0) {
+		len = sizeof(x11vnc_shmfb_header_t);
+	}
+	size = shmfb_header_size(addr, len);
+	if (size == 0) {
+		return;
+	}
+	if (raw_fb_offset < size) {
+		raw_fb_offset = size;
+	}
+	shmfb_hdr = (x11vnc_shmfb_header_t *) addr;
+	shmfb_ring = checked_ring;
+	rfbLog("rawfb: producer damage header, %u rects, pixels at +%d\n",
+	    shmfb_ring, raw_fb_offset);
+}
+
+void shmfb_detach(void) {
+	shmfb_hdr = NULL;
+	synced = 0;
+}
+
+static int mark_rect(x11vnc_shmfb_rect_t *r) {
+	int x1 = r->x, y1 = r->y, x2 = r->x + r->w, y2 = r->y + r->h;
+	int tx, ty, tx1, tx2, ty1, ty2, n, count = 0;
+
+	if (clipshift) {
+		x1 -= coff_x;
+		x2 -= coff_x;
+		y1 -= coff_y;
+		y2 -= coff_y;
+	}
+	x1 = nfix(x1, dpy_x);
+	y1 = nfix(y1, dpy_y);
+	x2 = nfix(x2, dpy_x+1);
+	y2 = nfix(y2, dpy_y+1);
+	if (x2 <= x1 || y2 <= y1) {
+		return 0;
+	}
+	tx1 = x1 / tile_x;
+	tx2 = (x2 - 1) / tile_x;
+	ty1 = y1 / tile_y;
+	ty2 = (y2 - 1) / tile_y;
+	for (ty = ty1; ty <= ty2; ty++) {
+		for (tx = tx1; tx <= tx2; tx++) {
+			n = tx + ty * ntiles_x;
+			if (! tile_has_diff[n]) {
+				TILE_DIFF(n, 1);
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * Set tile_has_diff[] for the rects posted since the last call and
+ * return the number of tiles marked.  Returns -1 when the caller must
+ * poll instead: no header, the first look, the ring overflowed, or
+ * the producer restarted.
+ */
+int shmfb_mark_tiles(void) {
+	x11vnc_shmfb_rect_t *rects, r;
+	unsigned long long frame, seq, s;
+	unsigned int ring;
+	int count = 0;
+
+	if (! shmfb_hdr || ! shmfb_damage || ! tile_has_diff) {
+		return -1;
+	}
+	ring = shmfb_ring;
+	rects = x11vnc_shmfb_rects(shmfb_hdr);
+
+	frame = shmfb_hdr->frame;
+	seq = shmfb_hdr->rect_seq;
+	X11VNC_SHMFB_BARRIER();
+
+	if (synced && frame == last_frame && seq == last_seq) {
+		return 0;
+	}
+	/*
+	 * while rect_seq == s the producer may be writing slot s % ring,
+	 * i.e. entry s - ring: only fewer than ring new entries are safe.
+	 */
+	if (! synced || frame < last_frame || seq < last_seq ||
+	    seq - last_seq >= ring) {
+		if (synced && debug_tiles) {
+			rfbLog("shmfb: lost %llu rects, polling.\n",
+			    seq - last_seq);
+		}
+		synced = 1;
+		last_seq = seq;
+		last_frame = frame;
+		return -1;
+	}
+
+	for (s = last_seq; s < seq; s++) {
+		r = rects[s % ring];
+		count += mark_rect(&r);
+	}
+
+	/* entries overwritten while we read them? */
+	X11VNC_SHMFB_BARRIER();
+	s = shmfb_hdr->rect_seq;
+	last_frame = frame;
+	if (s - last_seq >= ring) {
+		last_seq = s;
+		return -1;
+	}
+	last_seq = seq;
+
+	if (debug_tiles > 1) {
+		fprintf(stderr, "shmfb_mark_tiles: frame %llu %d\n", frame,
+		    count);
+	}
+	return count;
+}
@@ -0,0 +1,669 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- simd.c -- */
+
+#include "x11vnc.h"
+#include "simd.h"
+
+/*
+ * Vectorized helpers for the hot framebuffer loops (tile comparison,
+ * etc).  The kernel is chosen once at runtime from what the CPU
+ * supports; a plain C version is always available as the fallback.
+ * Build with -DNO_SIMD=1 (or run with -nosimd) to use only that.
+ */
+
+void simd_init(void);
+char *simd_kernel_name(void);
+
+static int diff_span_c(char *dst, char *src, int len, int *first, int *last);
+static int diff_span_init(char *dst, char *src, int len, int *first,
+    int *last);
+static void scale_acc32_c(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy);
+static void scale_acc32_init(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy);
+static void cmap8to32_c(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut);
+static void cmap8to32_init(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut);
+static void cmap_hi8_c(unsigned int *p, int n, unsigned int *lut);
+static void cmap_hi8_init(unsigned int *p, int n, unsigned int *lut);
+static void transpose32_c(char *dst, int dbl, int rev, char *src, int sbl,
+    int w, int h);
+static void transpose32_edges(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h, int w4, int h4);
+static void transpose32_init(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h);
+static void pack24to32_c(char *dst, char *src, int n);
+static void pack24to32_init(char *dst, char *src, int n);
+
+int (*fb_diff_span)(char *dst, char *src, int len, int *first, int *last)
+    = diff_span_init;
+void (*fb_scale_acc32)(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy) = scale_acc32_init;
+void (*fb_cmap8to32)(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut) = cmap8to32_init;
+void (*fb_cmap_hi8)(unsigned int *p, int n, unsigned int *lut)
+    = cmap_hi8_init;
+void (*fb_transpose32)(char *dst, int dbl, int rev, char *src, int sbl,
+    int w, int h) = transpose32_init;
+void (*fb_pack24to32)(char *dst, char *src, int n) = pack24to32_init;
+
+static char *kernel_name = "c";
+
+#if !defined(NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ >= 5 || defined(__clang__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+static int diff_span_sse2(char *dst, char *src, int len, int *first,
+    int *last);
+static int diff_span_avx2(char *dst, char *src, int len, int *first,
+    int *last);
+static void scale_acc32_sse2(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy);
+static void cmap8to32_avx2(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut);
+static void cmap_hi8_avx2(unsigned int *p, int n, unsigned int *lut);
+static void transpose32_sse2(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h);
+static void pack24to32_ssse3(char *dst, char *src, int n);
+static void pack24to32_avx2(char *dst, char *src, int n);
+#else
+#define SIMD_X86 0
+#endif
+
+/*
+ * fb_diff_span() compares len bytes of dst and src.  Returns 0 if they
+ * are identical, otherwise 1 with *first and *last set to the offsets
+ * of the first and last differing bytes.  Only the bytes up to the
+ * first difference, and back from the end to the last one, are read.
+ */
+
+static int diff_span_c(char *dst, char *src, int len, int *first, int *last) {
+	int i = 0, lo = -1, hi = -1;
+	unsigned long a, b;
+
+	/* word at a time until the first difference: */
+	while (i + (int) sizeof(a) <= len) {
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		if (a != b) {
+			break;
+		}
+		i += sizeof(a);
+	}
+	for (; i < len; i++) {
+		if (dst[i] != src[i]) {
+			lo = i;
+			break;
+		}
+	}
+	if (lo < 0) {
+		return 0;
+	}
+
+	/* and back from the end for the last one: */
+	i = len;
+	while (i - (int) sizeof(a) > lo) {
+		memcpy(&a, dst + i - sizeof(a), sizeof(a));
+		memcpy(&b, src + i - sizeof(b), sizeof(b));
+		if (a != b) {
+			break;
+		}
+		i -= sizeof(a);
+	}
+	for (i--; i >= lo; i--) {
+		if (dst[i] != src[i]) {
+			hi = i;
+			break;
+		}
+	}
+
+	*first = lo;
+	*last  = hi;
+	return 1;
+}
+
+/*
+ * fb_scale_acc32() does one source line of the 32bpp -scale box filter:
+ * for dest pixels i1 <= i < i2 the 4 byte channels of its source pixels
+ * are summed with the tx weights, brought down to 7 fraction bits, and
+ * added times the line's weight wy to acc[4*(i-i1) + channel].  With
+ * all weights SCALE_ONE based nothing overflows 32 bits.
+ */
+
+static void scale_acc32_c(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy) {
+	int i, k, c;
+
+	for (i = i1; i < i2; i++) {
+		unsigned char *p = (unsigned char *) src + 4 * tx->first[i];
+		unsigned short *w = tx->w + tx->woff[i];
+		unsigned int s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+		c = tx->count[i];
+		for (k = 0; k < c; k++) {
+			s0 += w[k] * p[0];
+			s1 += w[k] * p[1];
+			s2 += w[k] * p[2];
+			s3 += w[k] * p[3];
+			p += 4;
+		}
+		acc[0] += ((s0 + 64) >> 7) * wy;
+		acc[1] += ((s1 + 64) >> 7) * wy;
+		acc[2] += ((s2 + 64) >> 7) * wy;
+		acc[3] += ((s3 + 64) >> 7) * wy;
+		acc += 4;
+	}
+}
+
+/*
+ * fb_cmap8to32() sets dst[i] = lut[src[i]] for n pixels, fb_cmap_hi8()
+ * sets p[i] to its top byte or'd with lut[top byte].  The lut has 256
+ * entries.  Four pixels per round so the loads and stores overlap.
+ */
+
+static void cmap8to32_c(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut) {
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		unsigned int a = lut[src[i]], b = lut[src[i+1]];
+		unsigned int c = lut[src[i+2]], d = lut[src[i+3]];
+		dst[i] = a;
+		dst[i+1] = b;
+		dst[i+2] = c;
+		dst[i+3] = d;
+	}
+	for (; i < n; i++) {
+		dst[i] = lut[src[i]];
+	}
+}
+
+static void cmap_hi8_c(unsigned int *p, int n, unsigned int *lut) {
+	int i;
+
+	for (i = 0; i < n; i++) {
+		unsigned int hi = p[i] & 0xff000000;
+		p[i] = hi | lut[hi >> 24];
+	}
+}
+
+static void transpose32_c(char *dst, int dbl, int rev, char *src, int sbl,
+    int w, int h) {
+	int i, j, dy = rev ? -4 : 4;
+
+	for (j = 0; j < h; j++) {
+		char *s = src + sbl * j, *d = dst + dy * j;
+		for (i = 0; i < w; i++) {
+			memcpy(d, s, 4);
+			s += 4;
+			d += dbl;
+		}
+	}
+}
+
+/* the columns past w4 and the rows past h4 a blocked kernel left over */
+static void transpose32_edges(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h, int w4, int h4) {
+	if (w4 < w) {
+		transpose32_c(dst + dbl * w4, dbl, rev, src + 4 * w4, sbl,
+		    w - w4, h);
+	}
+	if (h4 < h) {
+		transpose32_c(dst + (rev ? -4 : 4) * h4, dbl, rev,
+		    src + sbl * h4, sbl, w4, h - h4);
+	}
+}
+
+/*
+ * A 4 byte load per pixel with the neighbour's byte masked or shifted
+ * off; the last pixel, whose 4th byte may be past the end, bytewise.
+ */
+static void pack24to32_c(char *dst, char *src, int n) {
+	unsigned char *s;
+	unsigned int v;
+	int i;
+
+	for (i = 0; i + 1 < n; i++) {
+		memcpy(&v, src + 3 * i, 4);
+		v = rfbEndianTest ? v & 0xffffff : v >> 8;
+		memcpy(dst + 4 * i, &v, 4);
+	}
+	if (i < n) {
+		s = (unsigned char *) src + 3 * i;
+		if (rfbEndianTest) {
+			v = s[0] | (s[1] << 8) | (s[2] << 16);
+		} else {
+			v = (s[0] << 16) | (s[1] << 8) | s[2];
+		}
+		memcpy(dst + 4 * i, &v, 4);
+	}
+}
+
+#if SIMD_X86
+
+/*
+ * Two source pixels per pmaddwd: their channels interleaved as 16 bit
+ * values against (w[k], w[k+1]) pairs.  Same arithmetic as the C one.
+ */
+TARGET_SSE2
+static void scale_acc32_sse2(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(64);
+	__m128i vwy = _mm_set1_epi32(wy);
+	int i, k, c;
+
+	for (i = i1; i < i2; i++) {
+		char *p = src + 4 * tx->first[i];
+		unsigned short *w = tx->w + tx->woff[i];
+		__m128i s = zero, a, b, v;
+		int pa, pb;
+
+		c = tx->count[i];
+		for (k = 0; k + 1 < c; k += 2) {
+			memcpy(&pa, p, 4);
+			memcpy(&pb, p + 4, 4);
+			a = _mm_cvtsi32_si128(pa);
+			b = _mm_cvtsi32_si128(pb);
+			v = _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, b), zero);
+			s = _mm_add_epi32(s, _mm_madd_epi16(v,
+			    _mm_set1_epi32(w[k] | (w[k+1] << 16))));
+			p += 8;
+		}
+		if (k < c) {
+			memcpy(&pa, p, 4);
+			a = _mm_cvtsi32_si128(pa);
+			v = _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, zero), zero);
+			s = _mm_add_epi32(s, _mm_madd_epi16(v,
+			    _mm_set1_epi32(w[k])));
+		}
+		/* (s + 64) >> 7 fits in the low 16 bits, times wy: */
+		s = _mm_srli_epi32(_mm_add_epi32(s, round), 7);
+		s = _mm_madd_epi16(s, vwy);
+		a = _mm_loadu_si128((__m128i *) acc);
+		_mm_storeu_si128((__m128i *) acc, _mm_add_epi32(a, s));
+		acc += 4;
+	}
+}
+
+TARGET_SSE2
+static int diff_span_sse2(char *dst, char *src, int len, int *first,
+    int *last) {
+	int i = 0, lo = -1, hi = -1;
+	unsigned int m;
+	__m128i a, b;
+
+	while (i + 16 <= len) {
+		a = _mm_loadu_si128((__m128i *) (dst + i));
+		b = _mm_loadu_si128((__m128i *) (src + i));
+		m = 0xffff ^ (unsigned int) _mm_movemask_epi8(
+		    _mm_cmpeq_epi8(a, b));
+		if (m) {
+			lo = i + __builtin_ctz(m);
+			break;
+		}
+		i += 16;
+	}
+	if (lo < 0) {
+		for (; i < len; i++) {
+			if (dst[i] != src[i]) {
+				lo = i;
+				break;
+			}
+		}
+		if (lo < 0) {
+			return 0;
+		}
+	}
+
+	i = len;
+	while (i - 16 >= lo) {
+		a = _mm_loadu_si128((__m128i *) (dst + i - 16));
+		b = _mm_loadu_si128((__m128i *) (src + i - 16));
+		m = 0xffff ^ (unsigned int) _mm_movemask_epi8(
+		    _mm_cmpeq_epi8(a, b));
+		if (m) {
+			hi = i - 16 + (31 - __builtin_clz(m));
+			break;
+		}
+		i -= 16;
+	}
+	if (hi < 0) {
+		for (i--; i >= lo; i--) {
+			if (dst[i] != src[i]) {
+				hi = i;
+				break;
+			}
+		}
+	}
+
+	*first = lo;
+	*last  = hi;
+	return 1;
+}
+
+TARGET_AVX2
+static int diff_span_avx2(char *dst, char *src, int len, int *first,
+    int *last) {
+	int i = 0, lo = -1, hi = -1;
+	unsigned int m;
+	__m256i a, b, c, d;
+
+	/* 64 bytes per iteration while nothing differs: */
+	while (i + 64 <= len) {
+		a = _mm256_loadu_si256((__m256i *) (dst + i));
+		b = _mm256_loadu_si256((__m256i *) (src + i));
+		c = _mm256_loadu_si256((__m256i *) (dst + i + 32));
+		d = _mm256_loadu_si256((__m256i *) (src + i + 32));
+		a = _mm256_xor_si256(a, b);
+		c = _mm256_xor_si256(c, d);
+		if (! _mm256_testz_si256(_mm256_or_si256(a, c),
+		    _mm256_or_si256(a, c))) {
+			break;
+		}
+		i += 64;
+	}
+	while (i + 32 <= len) {
+		a = _mm256_loadu_si256((__m256i *) (dst + i));
+		b = _mm256_loadu_si256((__m256i *) (src + i));
+		m = ~ (unsigned int) _mm256_movemask_epi8(
+		    _mm256_cmpeq_epi8(a, b));
+		if (m) {
+			lo = i + __builtin_ctz(m);
+			break;
+		}
+		i += 32;
+	}
+	if (lo < 0) {
+		for (; i < len; i++) {
+			if (dst[i] != src[i]) {
+				lo = i;
+				break;
+			}
+		}
+		if (lo < 0) {
+			return 0;
+		}
+	}
+
+	i = len;
+	while (i - 32 >= lo) {
+		a = _mm256_loadu_si256((__m256i *) (dst + i - 32));
+		b = _mm256_loadu_si256((__m256i *) (src + i - 32));
+		m = ~ (unsigned int) _mm256_movemask_epi8(
+		    _mm256_cmpeq_epi8(a, b));
+		if (m) {
+			hi = i - 32 + (31 - __builtin_clz(m));
+			break;
+		}
+		i -= 32;
+	}
+	if (hi < 0) {
+		for (i--; i >= lo; i--) {
+			if (dst[i] != src[i]) {
+				hi = i;
+				break;
+			}
+		}
+	}
+
+	*first = lo;
+	*last  = hi;
+	return 1;
+}
+
+/*
+ * Eight table entries per vpgatherdd.  SSE2 has no gather and a 256
+ * entry table is too big for byte shuffles, so it uses the C ones.
+ */
+TARGET_AVX2
+static void cmap8to32_avx2(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut) {
+	__m256i idx;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) (src + i)));
+		_mm256_storeu_si256((__m256i *) (dst + i),
+		    _mm256_i32gather_epi32((int *) lut, idx, 4));
+	}
+	for (; i < n; i++) {
+		dst[i] = lut[src[i]];
+	}
+}
+
+TARGET_AVX2
+static void cmap_hi8_avx2(unsigned int *p, int n, unsigned int *lut) {
+	__m256i mask = _mm256_set1_epi32((int) 0xff000000);
+	__m256i v, g;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((__m256i *) (p + i));
+		g = _mm256_i32gather_epi32((int *) lut,
+		    _mm256_srli_epi32(v, 24), 4);
+		_mm256_storeu_si256((__m256i *) (p + i),
+		    _mm256_or_si256(_mm256_and_si256(v, mask), g));
+	}
+	for (; i < n; i++) {
+		unsigned int hi = p[i] & 0xff000000;
+		p[i] = hi | lut[hi >> 24];
+	}
+}
+
+/*
+ * 4x4 blocks: four source rows in, unpacked into four columns, each
+ * stored as a row of the destination (reversed first under rev).
+ * Used on avx2 cpus as well: in the narrow strips rotate_fb() hands
+ * it an 8x8 version was no faster.
+ */
+TARGET_SSE2
+static void transpose32_sse2(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h) {
+	int i, j, w4 = w & ~3, h4 = h & ~3;
+	__m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+	for (j = 0; j < h4; j += 4) {
+		char *s = src + sbl * j;
+		char *d = dst + (rev ? -4 * (j + 3) : 4 * j);
+		for (i = 0; i < w4; i += 4) {
+			r0 = _mm_loadu_si128((__m128i *) (s + 4 * i));
+			r1 = _mm_loadu_si128((__m128i *) (s + 4 * i + sbl));
+			r2 = _mm_loadu_si128((__m128i *) (s + 4 * i + 2 * sbl));
+			r3 = _mm_loadu_si128((__m128i *) (s + 4 * i + 3 * sbl));
+			t0 = _mm_unpacklo_epi32(r0, r1);
+			t1 = _mm_unpacklo_epi32(r2, r3);
+			t2 = _mm_unpackhi_epi32(r0, r1);
+			t3 = _mm_unpackhi_epi32(r2, r3);
+			r0 = _mm_unpacklo_epi64(t0, t1);
+			r1 = _mm_unpackhi_epi64(t0, t1);
+			r2 = _mm_unpacklo_epi64(t2, t3);
+			r3 = _mm_unpackhi_epi64(t2, t3);
+			if (rev) {
+				r0 = _mm_shuffle_epi32(r0, 0x1b);
+				r1 = _mm_shuffle_epi32(r1, 0x1b);
+				r2 = _mm_shuffle_epi32(r2, 0x1b);
+				r3 = _mm_shuffle_epi32(r3, 0x1b);
+			}
+			_mm_storeu_si128((__m128i *) (d + dbl * i), r0);
+			_mm_storeu_si128((__m128i *) (d + dbl * (i + 1)), r1);
+			_mm_storeu_si128((__m128i *) (d + dbl * (i + 2)), r2);
+			_mm_storeu_si128((__m128i *) (d + dbl * (i + 3)), r3);
+		}
+	}
+	transpose32_edges(dst, dbl, rev, src, sbl, w, h, w4, h4);
+}
+
+/*
+ * pshufb spreads 12 bytes (4 pixels) of a 16 byte load over 16 with
+ * zeros in every 4th; the loads stop while 16 bytes are still there.
+ */
+TARGET_SSSE3
+static void pack24to32_ssse3(char *dst, char *src, int n) {
+	__m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+	    6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i a, b;
+	int i;
+
+	for (i = 0; i + 10 <= n; i += 8) {
+		a = _mm_loadu_si128((__m128i *) (src + 3 * i));
+		b = _mm_loadu_si128((__m128i *) (src + 3 * i + 12));
+		_mm_storeu_si128((__m128i *) (dst + 4 * i),
+		    _mm_shuffle_epi8(a, shuf));
+		_mm_storeu_si128((__m128i *) (dst + 4 * i + 16),
+		    _mm_shuffle_epi8(b, shuf));
+	}
+	pack24to32_c(dst + 4 * i, src + 3 * i, n - i);
+}
+
+/*
+ * The same with 8 pixels per 32 byte load: vpermd moves bytes 12-27
+ * into the high lane since vpshufb cannot cross lanes.
+ */
+TARGET_AVX2
+static void pack24to32_avx2(char *dst, char *src, int n) {
+	__m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+	    6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1,
+	    6, 7, 8, -1, 9, 10, 11, -1);
+	__m256i perm = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	__m256i a, b;
+	int i;
+
+	for (i = 0; i + 19 <= n; i += 16) {
+		a = _mm256_loadu_si256((__m256i *) (src + 3 * i));
+		b = _mm256_loadu_si256((__m256i *) (src + 3 * i + 24));
+		a = _mm256_permutevar8x32_epi32(a, perm);
+		b = _mm256_permutevar8x32_epi32(b, perm);
+		_mm256_storeu_si256((__m256i *) (dst + 4 * i),
+		    _mm256_shuffle_epi8(a, shuf));
+		_mm256_storeu_si256((__m256i *) (dst + 4 * i + 32),
+		    _mm256_shuffle_epi8(b, shuf));
+	}
+	pack24to32_ssse3(dst + 4 * i, src + 3 * i, n - i);
+}
+
+#endif	/* SIMD_X86 */
+
+/*
+ * Pick the kernels for this cpu.  main() calls it before any threads
+ * start; the function pointers' initial values also call it, for
+ * users of these kernels outside of x11vnc (x11vnc_bench).
+ */
+void simd_init(void) {
+	static int done = 0;
+
+	if (done) {
+		return;
+	}
+	done = 1;
+
+	fb_diff_span = diff_span_c;
+	fb_scale_acc32 = scale_acc32_c;
+	fb_cmap8to32 = cmap8to32_c;
+	fb_cmap_hi8 = cmap_hi8_c;
+	fb_transpose32 = transpose32_c;
+	fb_pack24to32 = pack24to32_c;
+	kernel_name = "c";
+
+#if SIMD_X86
+	if (use_simd && ! getenv("X11VNC_NO_SIMD")) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			fb_diff_span = diff_span_avx2;
+			fb_scale_acc32 = scale_acc32_sse2;
+			fb_cmap8to32 = cmap8to32_avx2;
+			fb_cmap_hi8 = cmap_hi8_avx2;
+			fb_transpose32 = transpose32_sse2;
+			fb_pack24to32 = pack24to32_avx2;
+			kernel_name = "avx2";
+		} else if (__builtin_cpu_supports("sse2")) {
+			fb_diff_span = diff_span_sse2;
+			fb_scale_acc32 = scale_acc32_sse2;
+			fb_transpose32 = transpose32_sse2;
+			if (__builtin_cpu_supports("ssse3")) {
+				fb_pack24to32 = pack24to32_ssse3;
+			}
+			kernel_name = "sse2";
+		}
+	}
+#endif
+	if (! quiet) {
+		rfbLog("simd_init: using %s framebuffer kernels.\n",
+		    kernel_name);
+	}
+}
+
+char *simd_kernel_name(void) {
+	simd_init();
+	return kernel_name;
+}
+
+static int diff_span_init(char *dst, char *src, int len, int *first,
+    int *last) {
+	simd_init();
+	return fb_diff_span(dst, src, len, first, last);
+}
+
+static void scale_acc32_init(unsigned int *acc, char *src, scale_taps_t *tx,
+    int i1, int i2, int wy) {
+	simd_init();
+	fb_scale_acc32(acc, src, tx, i1, i2, wy);
+}
+
+static void cmap8to32_init(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut) {
+	simd_init();
+	fb_cmap8to32(dst, src, n, lut);
+}
+
+static void cmap_hi8_init(unsigned int *p, int n, unsigned int *lut) {
+	simd_init();
+	fb_cmap_hi8(p, n, lut);
+}
+
+static void transpose32_init(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h) {
+	simd_init();
+	fb_transpose32(dst, dbl, rev, src, sbl, w, h);
+}
+
+static void pack24to32_init(char *dst, char *src, int n) {
+	simd_init();
+	fb_pack24to32(dst, src, n);
+}
@@ -0,0 +1,84 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+#ifndef _X11VNC_SIMD_H
+#define _X11VNC_SIMD_H
+
+/* -- simd.h -- */
+
+extern void simd_init(void);
+extern char *simd_kernel_name(void);
+extern int (*fb_diff_span)(char *dst, char *src, int len, int *first,
+    int *last);
+
+/*
+ * -8to24 colormap lookups through a 256 entry table: pixel indexes to
+ * 32 bit TrueColor, and in place on pixels keeping the index in their
+ * top byte.
+ */
+extern void (*fb_cmap8to32)(unsigned int *dst, unsigned char *src, int n,
+    unsigned int *lut);
+extern void (*fb_cmap_hi8)(unsigned int *p, int n, unsigned int *lut);
+
+/*
+ * -rotate 90 degree family, 32bpp: pixel (i, j) of a w x h block at
+ * src (sbl bytes per line) goes to dst + dbl*i + 4*j, or to
+ * dst + dbl*i - 4*j if rev.  dbl may be negative.
+ */
+extern void (*fb_transpose32)(char *dst, int dbl, int rev, char *src,
+    int sbl, int w, int h);
+
+/*
+ * -24to32: n packed 3 byte pixels to 4 bytes each, the 0 byte above
+ * them in host order (after on little endian, before on big endian).
+ */
+extern void (*fb_pack24to32)(char *dst, char *src, int n);
+
+/*
+ * Fixed point weights of a box filter along one axis (-scale): dest
+ * pixel i averages the count[i] source pixels from first[i], with the
+ * weights w[woff[i]...], which add up to SCALE_ONE.
+ */
+#define SCALE_SHIFT 14
+#define SCALE_ONE (1 << SCALE_SHIFT)
+
+typedef struct scale_taps {
+	double factor;		/* the cache key: factor, N -> n */
+	int N, n;
+	int *first, *count, *woff;
+	unsigned short *w;
+} scale_taps_t;
+
+extern void (*fb_scale_acc32)(unsigned int *acc, char *src,
+    scale_taps_t *tx, int i1, int i2, int wy);
+
+#endif /* _X11VNC_SIMD_H */
@@ -62,6 +62,7 @@ int openssl_sock6 = -1;
 int openssl_port_num = 0;
 int https_sock = -1;
 int https_sock6 = -1;
+int ssl_inproc_ready_fd = -1;	/* readable: a -sslinproc handshake is done */
 pid_t openssl_last_helper_pid = 0;
 char *openssl_last_ip = NULL;
 
@@ -675,6 +676,10 @@ void accept_openssl(int mode, int presock);
 static void lose_ram(void);
 #define ABSIZE 16384
 
+static int  ssl_inproc_ok(int mode);
+static void ssl_inproc_accept(int sock, char *name);
+static void ssl_inproc_check(void);
+
 static int vencrypt_selected = 0;
 static int anontls_selected = 0;
 
@@ -718,6 +723,10 @@ static void ssl_xfer(int csock, int s_in, int s_out, int is_https) {
 	}
 }
 
+static int ssl_inproc_ok(int mode) {return 0;}
+static void ssl_inproc_accept(int sock, char *name) {}
+static void ssl_inproc_check(void) {}
+
 #else 	/* LIBVNCSERVER_HAVE_LIBSSL or HAVE_LIBSSL */
 
 /*
@@ -1024,6 +1033,12 @@ void openssl_init(int isclient) {
 		rfbLog("\n");
 		rfbLog("Initializing SSL (%s connect mode).\n", isclient ? "client":"server");
 	}
+	if (ssl_inproc && (vencrypt_mode != VENCRYPT_NONE ||
+	    anontls_mode != ANONTLS_NONE)) {
+		rfbLog("openssl_init: -sslinproc cannot do VeNCrypt or ANONTLS,"
+		    " using helper processes.\n");
+		ssl_inproc = 0;
+	}
 	if (first) {
 		if (db) fprintf(stderr, "\nSSL_load_error_strings()\n");
 
@@ -2685,6 +2700,572 @@ static void init_prng(void) {
 	}
 }
 #endif	/* FORK_OK */
+
+/*
+ * -sslinproc: SSL sessions handled inside x11vnc instead of by a forked
+ * ssl_helper per viewer.  One I/O thread drives all of the sessions
+ * with non-blocking OpenSSL calls and poll(2): first the handshake,
+ * then relaying between the viewer socket and one end of a socketpair
+ * whose other end libvncserver owns as the client socket.  The main
+ * loop (check_openssl()) creates the rfbClient once the handshake is
+ * done, same as it does when a helper connects back.  Only standard
+ * SSL tunneling is handled here; -https and the VeNCrypt/ANONTLS
+ * dialogs still go through the helper process.
+ */
+
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+
+#include <poll.h>
+
+#define TLS_HANDSHAKE	1
+#define TLS_READY	2	/* handshake done, main loop to attach */
+#define TLS_ATTACH	3	/* main loop is creating the client */
+#define TLS_RELAY	4
+#define TLS_DEAD	5
+
+typedef struct tls_sess {
+	SSL *ssl;
+	int net;		/* viewer socket */
+	int loc;		/* our end of the socketpair, or -1 */
+	int state;
+	double start;
+	double last_in;
+	char *name;
+	int peerport;
+	int net_ev;		/* poll events OpenSSL is waiting for */
+	int pidx;		/* index into the pollfd array, or -1 */
+	int net_eof, loc_eof, loc_shut;
+	char to_loc[ABSIZE];	/* decrypted, for libvncserver */
+	int nloc, oloc;
+	char to_net[ABSIZE];	/* from libvncserver, to be encrypted */
+	int nnet, onet;
+	struct tls_sess *next;
+} tls_sess_t;
+
+static tls_sess_t *tls_sessions = NULL;
+static int tls_nsessions = 0;
+static int tls_wake[2] = {-1, -1};
+static int tls_ready[2] = {-1, -1};	/* I/O thread -> main loop */
+static pthread_t tls_thread;
+static int tls_thread_up = 0;
+static pthread_mutex_t tls_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void tls_nonblock(int fd) {
+	int fl = fcntl(fd, F_GETFL);
+	if (fl != -1) {
+		fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+	}
+}
+
+static void tls_poke(int fd) {
+	char c = 0;
+	ssize_t n;
+	if (fd >= 0) {
+		do {
+			n = write(fd, &c, 1);
+		} while (n < 0 && errno == EINTR);
+		/* EAGAIN: the pipe is full, a wakeup is already pending */
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			rfbLogPerror("tls_poke: write");
+		}
+	}
+}
+
+/* wake the I/O thread up */
+static void tls_wakeup(void) {
+	tls_poke(tls_wake[1]);
+}
+
+static void tls_free(tls_sess_t *s) {
+	if (s->ssl) {
+		if (s->state == TLS_RELAY) {
+			SSL_shutdown(s->ssl);
+		}
+		SSL_free(s->ssl);
+	}
+	if (s->net >= 0) {
+		close(s->net);
+	}
+	if (s->loc >= 0) {
+		close(s->loc);
+	}
+	if (s->name) {
+		free(s->name);
+	}
+	free(s);
+}
+
+static void tls_errors(void) {
+	unsigned long err;
+	int cnt = 0;
+	while ((err = ERR_get_error()) != 0) {
+		rfbLog("SSL: %s\n", ERR_error_string(err, NULL));
+		if (cnt++ > 100) {
+			break;
+		}
+	}
+}
+
+/* returns 0 when the session should be dropped */
+static int tls_handshake(tls_sess_t *s) {
+	int rc = SSL_accept(s->ssl);
+	int err = SSL_get_error(s->ssl, rc);
+
+	if (err == SSL_ERROR_NONE) {
+		rfbLog("SSL: ssl_inproc: SSL_accept() succeeded for: %s:%d\n",
+		    s->name, s->peerport);
+		s->state = TLS_READY;
+		s->net_ev = 0;
+		/* end the -eventloop nap, ssl_inproc_check() attaches it */
+		tls_poke(tls_ready[1]);
+		return 1;
+	} else if (err == SSL_ERROR_WANT_READ) {
+		s->net_ev = POLLIN;
+		return 1;
+	} else if (err == SSL_ERROR_WANT_WRITE) {
+		s->net_ev = POLLOUT;
+		return 1;
+	}
+	rfbLog("SSL: ssl_inproc: SSL_accept() failed for: %s:%d err=%d\n",
+	    s->name, s->peerport, err);
+	tls_errors();
+	return 0;
+}
+
+/*
+ * Move data both ways until nothing more can be done without
+ * blocking.  Returns 0 when the session is finished.
+ */
+static int tls_relay(tls_sess_t *s) {
+	int n, err, progress = 1;
+	int rd_ev = 0, wr_ev = 0;
+
+	while (progress) {
+		progress = 0;
+
+		/* viewer -> libvncserver */
+		if (s->nloc == 0 && !s->net_eof) {
+			rd_ev = 0;
+			n = SSL_read(s->ssl, s->to_loc, ABSIZE);
+			if (n > 0) {
+				s->nloc = n;
+				s->oloc = 0;
+				s->last_in = dnow();
+				progress = 1;
+			} else {
+				err = SSL_get_error(s->ssl, n);
+				if (err == SSL_ERROR_WANT_READ) {
+					rd_ev = POLLIN;
+				} else if (err == SSL_ERROR_WANT_WRITE) {
+					rd_ev = POLLOUT;
+				} else if (err == SSL_ERROR_ZERO_RETURN) {
+					s->net_eof = 1;
+					progress = 1;
+				} else {
+					return 0;
+				}
+			}
+		}
+		if (s->nloc > 0) {
+			n = write(s->loc, s->to_loc + s->oloc, s->nloc);
+			if (n > 0) {
+				s->oloc += n;
+				s->nloc -= n;
+				progress = 1;
+			} else if (n < 0 && errno != EAGAIN &&
+			    errno != EWOULDBLOCK && errno != EINTR) {
+				return 0;
+			}
+		}
+		if (s->net_eof && s->nloc == 0 && !s->loc_shut) {
+			shutdown(s->loc, SHUT_WR);
+			s->loc_shut = 1;
+		}
+
+		/* libvncserver -> viewer */
+		if (s->nnet == 0 && !s->loc_eof) {
+			n = read(s->loc, s->to_net, ABSIZE);
+			if (n > 0) {
+				s->nnet = n;
+				s->onet = 0;
+				progress = 1;
+			} else if (n == 0) {
+				s->loc_eof = 1;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR) {
+				return 0;
+			}
+		}
+		if (s->nnet > 0) {
+			wr_ev = 0;
+			n = SSL_write(s->ssl, s->to_net + s->onet, s->nnet);
+			if (n > 0) {
+				s->onet += n;
+				s->nnet -= n;
+				progress = 1;
+			} else {
+				err = SSL_get_error(s->ssl, n);
+				if (err == SSL_ERROR_WANT_READ) {
+					wr_ev = POLLIN;
+				} else if (err == SSL_ERROR_WANT_WRITE) {
+					wr_ev = POLLOUT;
+				} else {
+					return 0;
+				}
+			}
+		}
+		if (s->loc_eof && s->nnet == 0) {
+			/* libvncserver closed the client */
+			return 0;
+		}
+	}
+	s->net_ev = rd_ev | wr_ev;
+	return 1;
+}
+
+static void *tls_io_thread(void *arg) {
+	struct pollfd *pfd = NULL;
+	int npfd = 0;
+
+	if (arg) {}
+
+	while (1) {
+		tls_sess_t *s, **sp;
+		int n = 1, timeout = 1000;
+		double now;
+		char buf[64];
+
+		pthread_mutex_lock(&tls_mutex);
+		if (npfd < 2 * tls_nsessions + 1) {
+			int want = 2 * tls_nsessions + 16;
+			struct pollfd *p = (struct pollfd *) realloc(pfd,
+			    want * sizeof(struct pollfd));
+			if (p == NULL) {
+				/* keep the old array, try again shortly */
+				pthread_mutex_unlock(&tls_mutex);
+				rfbLog("ssl_inproc: out of memory for %d"
+				    " sessions.\n", tls_nsessions);
+				usleep(100 * 1000);
+				continue;
+			}
+			pfd = p;
+			npfd = want;
+		}
+		pfd[0].fd = tls_wake[0];
+		pfd[0].events = POLLIN;
+		for (s = tls_sessions; s; s = s->next) {
+			s->pidx = -1;
+			if (s->state != TLS_HANDSHAKE &&
+			    s->state != TLS_RELAY) {
+				continue;
+			}
+			if (s->state == TLS_HANDSHAKE) {
+				timeout = 250;
+			}
+			s->pidx = n;
+			pfd[n].fd = s->net;
+			pfd[n].events = s->net_ev;
+			if (s->state == TLS_RELAY && !s->net_eof &&
+			    s->nloc == 0) {
+				pfd[n].events |= POLLIN;
+			}
+			n++;
+			pfd[n].fd = s->loc;
+			pfd[n].events = 0;
+			if (s->state == TLS_RELAY) {
+				if (s->nnet == 0 && !s->loc_eof) {
+					pfd[n].events |= POLLIN;
+				}
+				if (s->nloc > 0) {
+					pfd[n].events |= POLLOUT;
+				}
+			}
+			n++;
+		}
+		pthread_mutex_unlock(&tls_mutex);
+
+		if (poll(pfd, n, timeout) < 0 && errno != EINTR) {
+			rfbLogPerror("ssl_inproc: poll");
+			usleep(100 * 1000);
+			continue;
+		}
+		if (pfd[0].revents & POLLIN) {
+			while (read(tls_wake[0], buf, sizeof(buf)) > 0) {
+				;
+			}
+		}
+
+		now = dnow();
+		pthread_mutex_lock(&tls_mutex);
+		sp = &tls_sessions;
+		while ((s = *sp) != NULL) {
+			int ok = 1, ready = (s->pidx < 0);
+
+			if (s->pidx > 0 && (pfd[s->pidx].revents ||
+			    pfd[s->pidx+1].revents)) {
+				ready = 1;
+			}
+			if (s->state == TLS_HANDSHAKE) {
+				int tmo = 20;
+				if (getenv("SSL_INIT_TIMEOUT")) {
+					tmo = atoi(getenv("SSL_INIT_TIMEOUT"));
+				}
+				if (ready) {
+					ok = tls_handshake(s);
+				}
+				if (ok && s->state == TLS_HANDSHAKE &&
+				    now > s->start + tmo) {
+					rfbLog("SSL: ssl_inproc: handshake "
+					    "timeout for: %s:%d\n", s->name,
+					    s->peerport);
+					ok = 0;
+				}
+			} else if (s->state == TLS_RELAY) {
+				if (ready) {
+					ok = tls_relay(s);
+				}
+				if (ok && ssl_timeout_secs > 0 &&
+				    now > s->last_in + ssl_timeout_secs) {
+					rfbLog("SSL: ssl_inproc: read timeout "
+					    "for: %s:%d\n", s->name,
+					    s->peerport);
+					ok = 0;
+				}
+			} else if (s->state == TLS_DEAD) {
+				ok = 0;
+			}
+			if (! ok) {
+				if (s->state == TLS_RELAY) {
+					rfbLog("SSL: ssl_inproc: closing "
+					    "%s:%d\n", s->name, s->peerport);
+				}
+				*sp = s->next;
+				tls_nsessions--;
+				tls_free(s);
+				continue;
+			}
+			sp = &s->next;
+		}
+		pthread_mutex_unlock(&tls_mutex);
+	}
+	return NULL;
+}
+
+static int ssl_inproc_ok(int mode) {
+	if (! ssl_inproc || enc_str != NULL || vnc_redirect) {
+		return 0;
+	}
+	if (mode != OPENSSL_VNC && mode != OPENSSL_VNC6) {
+		return 0;
+	}
+	if (tls_thread_up) {
+		return 1;
+	}
+	if (pipe(tls_wake) != 0) {
+		rfbLogPerror("ssl_inproc: pipe");
+		ssl_inproc = 0;
+		return 0;
+	}
+	if (pipe(tls_ready) != 0) {
+		rfbLogPerror("ssl_inproc: pipe");
+		close(tls_wake[0]);
+		close(tls_wake[1]);
+		tls_wake[0] = tls_wake[1] = -1;
+		ssl_inproc = 0;
+		return 0;
+	}
+	tls_nonblock(tls_wake[0]);
+	tls_nonblock(tls_wake[1]);
+	tls_nonblock(tls_ready[0]);
+	tls_nonblock(tls_ready[1]);
+	if (pthread_create(&tls_thread, NULL, tls_io_thread, NULL) != 0) {
+		rfbLog("ssl_inproc: could not create I/O thread, using"
+		    " helper processes.\n");
+		close(tls_wake[0]);
+		close(tls_wake[1]);
+		close(tls_ready[0]);
+		close(tls_ready[1]);
+		tls_wake[0] = tls_wake[1] = -1;
+		tls_ready[0] = tls_ready[1] = -1;
+		ssl_inproc = 0;
+		return 0;
+	}
+	pthread_detach(tls_thread);
+	tls_thread_up = 1;
+	ssl_inproc_ready_fd = tls_ready[0];
+	return 1;
+}
+
+static void ssl_inproc_accept(int sock, char *name) {
+	unsigned char *sid = (unsigned char *) "x11vnc SID";
+	tls_sess_t *s;
+
+	s = (tls_sess_t *) calloc(sizeof(tls_sess_t), 1);
+	s->net = sock;
+	s->loc = -1;
+	s->name = strdup(name ? name : "unknown");
+	s->peerport = get_remote_port(sock);
+	s->start = s->last_in = dnow();
+
+	s->ssl = SSL_new(ctx);
+	if (s->ssl == NULL || ! SSL_set_fd(s->ssl, sock)) {
+		rfbLog("SSL: ssl_inproc: SSL_new/SSL_set_fd failed.\n");
+		tls_errors();
+		tls_free(s);
+		if (ssl_no_fail) {
+			clean_up_exit(1);
+		}
+		return;
+	}
+	SSL_set_session_id_context(s->ssl, sid, strlen((char *)sid));
+	SSL_set_mode(s->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+	    SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_set_accept_state(s->ssl);
+	tls_nonblock(sock);
+
+	rfbLog("SSL: ssl_inproc: handshake with %s:%d\n", s->name,
+	    s->peerport);
+
+	s->state = TLS_HANDSHAKE;
+	s->net_ev = POLLIN;
+	s->pidx = -1;
+
+	pthread_mutex_lock(&tls_mutex);
+	s->next = tls_sessions;
+	tls_sessions = s;
+	tls_nsessions++;
+	pthread_mutex_unlock(&tls_mutex);
+	tls_wakeup();
+}
+
+static void tls_peer_cert(tls_sess_t *s) {
+	X509 *x;
+
+	if (certret_str) {
+		free(certret_str);
+		certret_str = NULL;
+	}
+	if (SSL_get_verify_result(s->ssl) != X509_V_OK) {
+		return;
+	}
+	x = SSL_get_peer_certificate(s->ssl);
+	if (x == NULL) {
+		rfbLog("SSL: ssl_inproc: accepted client %s x509 peer cert"
+		    " is null\n", s->name);
+		return;
+	}
+#if HAVE_X509_PRINT_EX_FP
+	{
+		BIO *bio = BIO_new(BIO_s_mem());
+		char *p;
+		long len;
+
+		if (bio) {
+			X509_print_ex(bio, x, 0, XN_FLAG_MULTILINE);
+			len = BIO_get_mem_data(bio, &p);
+			if (len > 0) {
+				certret_str = (char *) calloc(len+1, 1);
+				memcpy(certret_str, p, len);
+				rfbLog("SSL: ssl_inproc: accepted client %s x509"
+				    " cert is:\n%s", s->name, certret_str);
+			}
+			BIO_free(bio);
+		}
+	}
+#else
+	if (users_list && strstr(users_list, "sslpeer=")) {
+		rfbLog("** -users sslpeer= will not work! **\n");
+	}
+#endif
+	X509_free(x);
+}
+
+/*
+ * Called from check_openssl(): turn finished handshakes into clients.
+ */
+static void ssl_inproc_check(void) {
+	rfbClientPtr client;
+	tls_sess_t *s;
+	int sv[2];
+	char buf[64];
+
+	if (! tls_thread_up) {
+		return;
+	}
+	while (read(tls_ready[0], buf, sizeof(buf)) > 0) {
+		;
+	}
+	while (1) {
+		pthread_mutex_lock(&tls_mutex);
+		for (s = tls_sessions; s; s = s->next) {
+			if (s->state == TLS_READY) {
+				s->state = TLS_ATTACH;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&tls_mutex);
+		if (s == NULL) {
+			break;
+		}
+
+		/* the I/O thread leaves TLS_ATTACH sessions alone. */
+		client = NULL;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+			rfbLogPerror("ssl_inproc: socketpair");
+		} else {
+			tls_peer_cert(s);
+			client = create_new_client(sv[0], 0);
+			if (client == NULL) {
+				rfbLog("SSL: ssl_inproc: rfbNewClient failed.\n");
+				close(sv[0]);
+				close(sv[1]);
+			} else {
+				if (client->host) {
+					free(client->host);
+				}
+				client->host = strdup(s->name);
+			}
+		}
+
+		pthread_mutex_lock(&tls_mutex);
+		if (client) {
+			tls_nonblock(sv[1]);
+			s->loc = sv[1];
+			s->state = TLS_RELAY;
+		} else {
+			s->state = TLS_DEAD;
+		}
+		pthread_mutex_unlock(&tls_mutex);
+		tls_wakeup();
+
+		if (client == NULL) {
+			if (ssl_no_fail) {
+				clean_up_exit(1);
+			}
+			continue;
+		}
+		if (use_threads) {
+			rfbStartOnHoldClient(client);
+		}
+		/* try to get RFB proto done now. */
+		progress_client();
+	}
+}
+
+#else	/* LIBVNCSERVER_HAVE_LIBPTHREAD */
+
+static int ssl_inproc_ok(int mode) {
+	if (ssl_inproc) {
+		rfbLog("ssl_inproc: not built with pthreads, using helper"
+		    " processes.\n");
+		ssl_inproc = 0;
+	}
+	return 0;
+}
+static void ssl_inproc_accept(int sock, char *name) {}
+static void ssl_inproc_check(void) {}
+
+#endif	/* LIBVNCSERVER_HAVE_LIBPTHREAD */
 #endif	/* LIBVNCSERVER_HAVE_LIBSSL or HAVE_LIBSSL  */
 
 void check_openssl(void) {
@@ -2699,6 +3280,8 @@ void check_openssl(void) {
 		return;
 	}
 
+	ssl_inproc_check();
+
 	if (time(NULL) > last_waitall + 120) {
 		last_waitall = time(NULL);
 		ssl_helper_pid(0, -2);	/* waitall */
@@ -3433,6 +4016,11 @@ void accept_openssl(int mode, int presock) {
 		return;
 	}
 
+	if (ssl_inproc_ok(mode)) {
+		ssl_inproc_accept(sock, openssl_last_ip);
+		return;
+	}
+
 	/* now make a listening socket for child to connect back to us by: */
 
 	cport = find_free_port(20000, 22000);
@@ -48,6 +48,7 @@ extern int openssl_sock6;
 extern int openssl_port_num;
 extern int https_sock;
 extern int https_sock6;
+extern int ssl_inproc_ready_fd;
 extern pid_t openssl_last_helper_pid;
 extern char *openssl_last_ip;
 extern char *certret_str;
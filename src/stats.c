@@ -0,0 +1,532 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- stats.c -- */
+
+#include "x11vnc.h"
+#include "stats.h"
+#include "scan.h"
+
+#include <sys/resource.h>
+
+/*
+ * Runtime counters for embedders (libx11vnc) and -remote queries.
+ * stats_sample() is called from the main loop, folds the libvncserver
+ * per-client counters into 64 bit totals and, about once a second,
+ * publishes a snapshot that other threads read with stats_get().
+ *
+ * Input latency: a client's key press or pointer button change is
+ * stamped (modifier keys and pure pointer motion are not followed), the
+ * next poll that changes tiles which were not hot before it (see
+ * heat_cold_diffs(), for a click only near the pointer) is taken as its
+ * effect, and the time until the client's fb update count moves after
+ * that poll goes into a histogram.  Input without such a change within
+ * LATENCY_NOCHANGE is dropped.  Only one event per client is followed
+ * at a time.
+ */
+
+void stats_input(rfbClientPtr client, int x, int y);
+void stats_pointer(rfbClientPtr client, int mask, int x, int y);
+void stats_scan(double dt, int tile_diffs);
+void stats_sample(void);
+void stats_client_gone(rfbClientPtr client);
+void stats_get(stats_snapshot_t *snap);
+char *stats_encoding_name(int enc);
+
+static void fold_client(rfbClientPtr cl, unsigned long long *delta,
+    double now);
+static double cpu_seconds(void);
+static double rss_mb(void);
+static unsigned int fbu_count(rfbClientPtr cl);
+static void latency_pass(double now);
+static void latency_add(ClientData *cd, double ms);
+static void latency_pcts(unsigned int *hist, unsigned long long *count,
+    double *p50, double *p95, double *p99);
+static double hist_pct(unsigned int *hist, unsigned long long count,
+    double frac);
+
+enum {
+	ST_SENT = 0,
+	ST_RAW,
+	ST_RCVD,
+	ST_FBU
+};
+
+static stats_snapshot_t snapshot;
+
+/* totals from clients that have gone away */
+static unsigned long long gone_total[4];
+
+/* accumulated since the last sample */
+static unsigned long long polls = 0, changed_polls = 0;
+static double scan_time = 0.0, scan_max = 0.0;
+static int scan_count = 0;
+
+/* latency bucket upper bounds in msec, the last bucket takes the rest */
+static const double lat_edges[LATENCY_NBUCKETS - 1] = {
+	1, 2, 3, 4, 5, 6, 8, 10, 12, 15, 20, 25, 30, 40, 50, 60, 80,
+	100, 120, 150, 200, 250, 300, 400, 500, 600, 800, 1000, 1500,
+	2000, 3000
+};
+static unsigned int lat_all[LATENCY_NBUCKETS];
+
+/* input that no poll found changes for in this long changed nothing */
+#define LATENCY_NOCHANGE 1.0
+
+/* a click's effect must be within this many pixels of the pointer */
+#define LATENCY_NEAR 128
+
+#if LIBVNCSERVER_HAVE_LIBPTHREAD
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define STATS_LOCK   pthread_mutex_lock(&stats_mutex)
+#define STATS_UNLOCK pthread_mutex_unlock(&stats_mutex)
+#else
+#define STATS_LOCK
+#define STATS_UNLOCK
+#endif
+
+/*
+ * called from keyboard() for key presses, x < 0: the effect may be
+ * anywhere on the screen.
+ */
+void stats_input(rfbClientPtr client, int x, int y) {
+#if LIBVNCSERVER_HAS_STATS
+	ClientData *cd;
+
+	if (view_only || ! client || ! client->clientData || client->viewOnly) {
+		return;
+	}
+	cd = (ClientData *) client->clientData;
+	/* client thread under -threads, the lat_* fields are STATS_LOCK'ed */
+	STATS_LOCK;
+	if (cd->lat_input == 0.0) {
+		cd->lat_input = dnow();
+		cd->lat_x = x;
+		cd->lat_y = y;
+	}
+	STATS_UNLOCK;
+#endif
+}
+
+/*
+ * called from pointer_event(), only button presses and releases start
+ * a measurement.
+ */
+void stats_pointer(rfbClientPtr client, int mask, int x, int y) {
+#if LIBVNCSERVER_HAS_STATS
+	ClientData *cd;
+
+	if (! client || ! client->clientData) {
+		return;
+	}
+	cd = (ClientData *) client->clientData;
+	if (mask == cd->lat_mask) {
+		return;
+	}
+	cd->lat_mask = mask;
+	stats_input(client, x, y);
+#endif
+}
+
+/*
+ * called by watch_loop() after each scan_for_updates(0)
+ */
+void stats_scan(double dt, int tile_diffs) {
+	polls++;
+	if (tile_diffs > 0) {
+		changed_polls++;
+	}
+	if (tile_diffs > 0 && screen) {
+		rfbClientIteratorPtr iter;
+		rfbClientPtr cl;
+		double now = dnow();
+
+		STATS_LOCK;
+		iter = rfbGetClientIterator(screen);
+		while( (cl = rfbClientIteratorNext(iter)) ) {
+			ClientData *cd = (ClientData *) cl->clientData;
+
+			if (! cd || cd->lat_input == 0.0 || cd->lat_tiles > 0.0) {
+				continue;
+			}
+			if (heat_cold_diffs(cd->lat_x, cd->lat_y,
+			    LATENCY_NEAR) > 0) {
+				cd->lat_tiles = now;
+				cd->lat_fbu = fbu_count(cl);
+			}
+		}
+		rfbReleaseClientIterator(iter);
+		STATS_UNLOCK;
+	}
+	scan_time += dt;
+	if (dt > scan_max) {
+		scan_max = dt;
+	}
+	scan_count++;
+}
+
+/*
+ * Read the libvncserver counters for one client and add what moved
+ * since the last call to its running totals.  The counters are plain
+ * ints and wrap on long sessions, so only differences are used.
+ */
+static void fold_client(rfbClientPtr cl, unsigned long long *delta,
+    double now) {
+	ClientData *cd = (ClientData *) cl->clientData;
+	unsigned int cur[4];
+	int i, moved = 0;
+
+	if (! cd) {
+		return;
+	}
+#if LIBVNCSERVER_HAS_STATS
+	cur[ST_SENT] = (unsigned int) rfbStatGetSentBytes(cl);
+	cur[ST_RAW]  = (unsigned int) rfbStatGetSentBytesIfRaw(cl);
+	cur[ST_RCVD] = (unsigned int) rfbStatGetRcvdBytes(cl);
+	cur[ST_FBU]  = (unsigned int) rfbStatGetMessageCountSent(cl,
+	    rfbFramebufferUpdate);
+#else
+	for (i=0; i < 4; i++) {
+		cur[i] = 0;
+	}
+#endif
+	for (i=0; i < 4; i++) {
+		unsigned int d = cur[i] - cd->stats_last[i];
+		cd->stats_last[i] = cur[i];
+		cd->stats_total[i] += d;
+		if (delta) {
+			delta[i] = d;
+		}
+		if (d) {
+			moved = 1;
+		}
+	}
+	if (moved || cd->stats_active == 0.0) {
+		cd->stats_active = now;
+	}
+}
+
+static double cpu_seconds(void) {
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0) {
+		return 0.0;
+	}
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0
+	    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+static unsigned int fbu_count(rfbClientPtr cl) {
+#if LIBVNCSERVER_HAS_STATS
+	return (unsigned int) rfbStatGetMessageCountSent(cl,
+	    rfbFramebufferUpdate);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Every pass of watch_loop(), right after rfbPE() has sent what it
+ * could: finish the measurements whose fb update has gone out.
+ */
+static void latency_pass(double now) {
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+
+	STATS_LOCK;
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		ClientData *cd = (ClientData *) cl->clientData;
+
+		if (! cd || cd->lat_input == 0.0) {
+			continue;
+		}
+		if (cd->lat_tiles == 0.0) {
+			if (now > cd->lat_input + LATENCY_NOCHANGE) {
+				cd->lat_input = 0.0;
+			}
+			continue;
+		}
+		if (fbu_count(cl) != cd->lat_fbu) {
+			latency_add(cd, 1000.0 * (now - cd->lat_input));
+			cd->lat_input = 0.0;
+			cd->lat_tiles = 0.0;
+		}
+	}
+	rfbReleaseClientIterator(iter);
+	STATS_UNLOCK;
+}
+
+static void latency_add(ClientData *cd, double ms) {
+	int i;
+
+	for (i=0; i < LATENCY_NBUCKETS - 1; i++) {
+		if (ms <= lat_edges[i]) {
+			break;
+		}
+	}
+	cd->lat_hist[i]++;
+	lat_all[i]++;
+}
+
+/*
+ * Percentile from a histogram, linear within the bucket.  The last
+ * bucket is open ended and reports its lower bound.
+ */
+static double hist_pct(unsigned int *hist, unsigned long long count,
+    double frac) {
+	unsigned long long want = (unsigned long long) (frac * count), n = 0;
+	double lo, hi;
+	int i;
+
+	for (i=0; i < LATENCY_NBUCKETS; i++) {
+		if (n + hist[i] > want) {
+			break;
+		}
+		n += hist[i];
+	}
+	if (i >= LATENCY_NBUCKETS - 1) {
+		return lat_edges[LATENCY_NBUCKETS - 2];
+	}
+	lo = i ? lat_edges[i-1] : 0.0;
+	hi = lat_edges[i];
+	return lo + (hi - lo) * (want - n + 0.5) / hist[i];
+}
+
+static void latency_pcts(unsigned int *hist, unsigned long long *count,
+    double *p50, double *p95, double *p99) {
+	unsigned long long n = 0;
+	int i;
+
+	for (i=0; i < LATENCY_NBUCKETS; i++) {
+		n += hist[i];
+	}
+	*count = n;
+	if (n == 0) {
+		*p50 = *p95 = *p99 = 0.0;
+		return;
+	}
+	*p50 = hist_pct(hist, n, 0.50);
+	*p95 = hist_pct(hist, n, 0.95);
+	*p99 = hist_pct(hist, n, 0.99);
+}
+
+static double rss_mb(void) {
+	struct rusage ru;
+	FILE *in;
+	long size, res;
+
+	in = fopen("/proc/self/statm", "r");
+	if (in) {
+		int n = fscanf(in, "%ld %ld", &size, &res);
+		fclose(in);
+		if (n == 2) {
+			return (res * (double) getpagesize()) / (1024 * 1024);
+		}
+	}
+	/* no /proc: fall back to the peak, in kB on Linux and BSD */
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef MACOSX
+		return ru.ru_maxrss / (1024.0 * 1024.0);
+#else
+		return ru.ru_maxrss / 1024.0;
+#endif
+	}
+	return 0.0;
+}
+
+/*
+ * Called every pass of watch_loop(); does real work once a second.
+ */
+void stats_sample(void) {
+	static double last = 0.0, last_cpu = 0.0;
+	static unsigned long long last_changed = 0;
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	unsigned long long sum[4], delta[4], total[4], changed;
+	unsigned long long dropped = 0;
+	double now = dnow(), dt, cpu;
+	int i, n = 0, nfbu = 0;
+
+	if (screen) {
+		latency_pass(now);
+	}
+	if (now < last + 1.0) {
+		return;
+	}
+	dt = now - last;
+	cpu = cpu_seconds();
+	changed = changed_polls - last_changed;
+	for (i=0; i < 4; i++) {
+		sum[i] = 0;
+	}
+
+	STATS_LOCK;
+	for (i=0; i < 4; i++) {
+		total[i] = gone_total[i];
+	}
+	if (screen) {
+		iter = rfbGetClientIterator(screen);
+		while( (cl = rfbClientIteratorNext(iter)) ) {
+			ClientData *cd = (ClientData *) cl->clientData;
+			stats_client_t *sc;
+
+			if (! cd) {
+				continue;
+			}
+			fold_client(cl, delta, now);
+			for (i=0; i < 4; i++) {
+				sum[i] += delta[i];
+				total[i] += cd->stats_total[i];
+			}
+			if (cl->state == RFB_NORMAL) {
+				nfbu++;
+				/*
+				 * Changes found by the poller that were
+				 * merged into a later update (client had no
+				 * request outstanding, -defer, etc.) count
+				 * as dropped frames.
+				 */
+				if (last > 0.0 && changed > delta[ST_FBU]) {
+					dropped += changed - delta[ST_FBU];
+				}
+			}
+			if (n >= STATS_MAX_CLIENTS) {
+				continue;
+			}
+			sc = &snapshot.clients[n++];
+			sc->uid = cd->uid;
+			snprintf(sc->host, sizeof(sc->host), "%s",
+			    cd->hostname ? cd->hostname :
+			    (cl->host ? cl->host : "unknown"));
+			snprintf(sc->user, sizeof(sc->user), "%s",
+			    cd->username ? cd->username : "");
+			sc->port = cd->client_port;
+			sc->viewonly = cl->viewOnly ? 1 : 0;
+			sc->login_time = cd->login_time;
+			sc->last_activity = cd->stats_active;
+			sc->encoding = cl->preferredEncoding;
+			sc->bytes_sent = cd->stats_total[ST_SENT];
+			sc->bytes_raw  = cd->stats_total[ST_RAW];
+			sc->bytes_rcvd = cd->stats_total[ST_RCVD];
+			sc->fb_updates = cd->stats_total[ST_FBU];
+			latency_pcts(cd->lat_hist, &sc->lat_count,
+			    &sc->lat_p50, &sc->lat_p95, &sc->lat_p99);
+		}
+		rfbReleaseClientIterator(iter);
+	}
+	snapshot.nclients = n;
+
+	if (last > 0.0 && dt > 0.0) {
+		double fps = nfbu ? sum[ST_FBU] / (nfbu * dt) : 0.0;
+
+		snapshot.fps = fps;
+		if (snapshot.time == 0.0) {
+			snapshot.fps_avg = fps;
+		} else {
+			/* ~30 second time constant */
+			snapshot.fps_avg += (fps - snapshot.fps_avg) / 30.0;
+		}
+		snapshot.poll_rate = changed / dt;
+		snapshot.kbps_out = (sum[ST_SENT] * 8.0) / (1000.0 * dt);
+		snapshot.kbps_in  = (sum[ST_RCVD] * 8.0) / (1000.0 * dt);
+		snapshot.cpu = 100.0 * (cpu - last_cpu) / dt;
+		snapshot.time = now;
+	}
+	snapshot.scan_ms = scan_count ? 1000.0 * scan_time / scan_count : 0.0;
+	snapshot.scan_ms_max = 1000.0 * scan_max;
+	snapshot.rss_mb = rss_mb();
+	snapshot.fb_updates = total[ST_FBU];
+	snapshot.bytes_sent = total[ST_SENT];
+	snapshot.bytes_raw  = total[ST_RAW];
+	snapshot.bytes_rcvd = total[ST_RCVD];
+	snapshot.cmp_ratio = total[ST_SENT] ?
+	    (double) total[ST_RAW] / total[ST_SENT] : 0.0;
+	snapshot.polls = polls;
+	snapshot.changed_polls = changed_polls;
+	snapshot.dropped += dropped;
+	latency_pcts(lat_all, &snapshot.lat_count, &snapshot.lat_p50,
+	    &snapshot.lat_p95, &snapshot.lat_p99);
+	STATS_UNLOCK;
+
+	scan_time = scan_max = 0.0;
+	scan_count = 0;
+	last_changed = changed_polls;
+	last_cpu = cpu;
+	last = now;
+}
+
+/*
+ * called from client_gone() so the totals survive the ClientData.
+ */
+void stats_client_gone(rfbClientPtr client) {
+	ClientData *cd;
+	int i;
+
+	if (! client || ! client->clientData) {
+		return;
+	}
+	cd = (ClientData *) client->clientData;
+
+	STATS_LOCK;
+	fold_client(client, NULL, dnow());
+	for (i=0; i < 4; i++) {
+		gone_total[i] += cd->stats_total[i];
+	}
+	STATS_UNLOCK;
+}
+
+void stats_get(stats_snapshot_t *snap) {
+	if (! snap) {
+		return;
+	}
+	STATS_LOCK;
+	*snap = snapshot;
+	STATS_UNLOCK;
+}
+
+char *stats_encoding_name(int enc) {
+	switch (enc) {
+	case rfbEncodingRaw:		return "Raw";
+	case rfbEncodingCopyRect:	return "CopyRect";
+	case rfbEncodingRRE:		return "RRE";
+	case rfbEncodingCoRRE:		return "CoRRE";
+	case rfbEncodingHextile:	return "Hextile";
+	case rfbEncodingZlib:		return "Zlib";
+	case rfbEncodingTight:		return "Tight";
+	case rfbEncodingZlibHex:	return "ZlibHex";
+	case rfbEncodingUltra:		return "Ultra";
+	case rfbEncodingZRLE:		return "ZRLE";
+	case rfbEncodingZYWRLE:		return "ZYWRLE";
+	}
+	return "unknown";
+}
@@ -0,0 +1,94 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+#ifndef _X11VNC_STATS_H
+#define _X11VNC_STATS_H
+
+/* -- stats.h -- */
+
+#define STATS_MAX_CLIENTS 64
+
+typedef struct stats_client {
+	int uid;
+	char host[256];
+	int port;
+	char user[64];
+	int viewonly;
+	time_t login_time;
+	double last_activity;		/* dnow() when any counter last moved */
+	int encoding;			/* cl->preferredEncoding */
+	unsigned long long bytes_sent;	/* encoded bytes */
+	unsigned long long bytes_raw;	/* same updates sent as raw */
+	unsigned long long bytes_rcvd;
+	unsigned long long fb_updates;
+	unsigned long long lat_count;	/* input events answered */
+	double lat_p50;			/* input to fb update, msec */
+	double lat_p95;
+	double lat_p99;
+} stats_client_t;
+
+typedef struct stats_snapshot {
+	double time;			/* dnow() of the sample, 0.0 if none yet */
+	double fps;			/* fb updates per client per second */
+	double fps_avg;			/* exponential average of fps */
+	double poll_rate;		/* polls finding changes per second */
+	double scan_ms;			/* mean scan_for_updates() time */
+	double scan_ms_max;
+	double cpu;			/* percent of one cpu, user + sys */
+	double rss_mb;
+	double kbps_out;
+	double kbps_in;
+	double cmp_ratio;		/* raw bytes / encoded bytes */
+	unsigned long long fb_updates;	/* totals, including gone clients */
+	unsigned long long bytes_sent;
+	unsigned long long bytes_raw;
+	unsigned long long bytes_rcvd;
+	unsigned long long polls;
+	unsigned long long changed_polls;
+	unsigned long long dropped;
+	unsigned long long lat_count;	/* all clients, including gone ones */
+	double lat_p50;
+	double lat_p95;
+	double lat_p99;
+	int nclients;
+	stats_client_t clients[STATS_MAX_CLIENTS];
+} stats_snapshot_t;
+
+extern void stats_input(rfbClientPtr client, int x, int y);
+extern void stats_pointer(rfbClientPtr client, int mask, int x, int y);
+extern void stats_scan(double dt, int tile_diffs);
+extern void stats_sample(void);
+extern void stats_client_gone(rfbClientPtr client);
+extern void stats_get(stats_snapshot_t *snap);
+extern char *stats_encoding_name(int enc);
+
+#endif /* _X11VNC_STATS_H */
@@ -0,0 +1,396 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- tilecache.c -- */
+
+#include "x11vnc.h"
+#include "tilecache.h"
+#include "screen.h"
+#include "unixpw.h"
+#include "userinput.h"
+
+/*
+ * -tilecache: a content addressed index of the tiles the viewers
+ * already have.  After a poll has read the changed tiles into main_fb
+ * each of them is hashed, and if the same pixels are in a tile that
+ * did not change (on the screen, or in the -ncache area below it) it
+ * is sent as a CopyRect from there rather than as pixel data.  Unlike
+ * -ncache itself this does not care which window the pixels came
+ * from, so it also works where the window ids are of no help.
+ *
+ * The index maps a tile hash to the last place it was seen.  Entries
+ * are not removed when the place changes, the pixels there are just
+ * compared with the tile's before it is used (which also rules out
+ * hash collisions), so the index stays at a fixed two entries per tile.
+ */
+
+int tile_cache = 0;	/* -tilecache */
+
+int tilecache_ok(void);
+int tilecache_copy(void);
+
+static unsigned long long hash_tile(int x, int y, int *solid);
+static int same_tile(int x, int y, int sx, int sy);
+static void index_put(unsigned long long h, int x, int y);
+static int index_get(unsigned long long h, int *x, int *y);
+static int index_reset(void);
+static void index_offscreen(int nrows);
+
+
+#define TILECACHE_MIN_HITS 4	/* fewer are not worth the fb_push_wait() */
+#define TILECACHE_NREG	32	/* distinct CopyRect offsets per poll */
+#define TILECACHE_ROWS	4	/* -ncache area tile rows indexed per poll */
+#define TILECACHE_PROBE	8
+
+typedef struct tc_entry {
+	unsigned long long hash;
+	int x, y;		/* x < 0: empty */
+} tc_entry_t;
+
+static tc_entry_t *tc_index = NULL;
+static int tc_size = 0;
+static char *tc_fb = NULL;
+static int tc_dpy_x = 0, tc_dpy_y = 0, tc_ncache = 0;
+static int tc_next_row = 0;	/* round robin over the -ncache area */
+
+/* per tile work space for tilecache_copy() */
+static unsigned long long *tc_hash = NULL;
+static int *tc_hit = NULL, tc_ntiles = 0;
+
+int tilecache_ok(void) {
+	rfbClientIteratorPtr iter;
+	rfbClientPtr cl;
+	int ok = 1;
+
+	if (! tile_cache || ! screen || ! main_fb || client_count == 0) {
+		return 0;
+	}
+	if (rfb_fb != main_fb || rotating || scaling || cmap8to24) {
+		return 0;
+	}
+	if (rawfb_zerocopy || unixpw_in_progress) {
+		return 0;
+	}
+	if (bpp != 8 && bpp != 16 && bpp != 32) {
+		return 0;
+	}
+
+	/* batch_copyregion() sends to everyone, all must take CopyRect */
+	iter = rfbGetClientIterator(screen);
+	while( (cl = rfbClientIteratorNext(iter)) ) {
+		if (! cl->useCopyRect) {
+			ok = 0;
+		}
+	}
+	rfbReleaseClientIterator(iter);
+	return ok;
+}
+
+/*
+ * Hash of the full tile at x, y in main_fb.  *solid is set if it is
+ * a single color: those encode to next to nothing anyway.
+ */
+static unsigned long long hash_tile(int x, int y, int *solid) {
+	int pixelsize = bpp/8, len = tile_x * pixelsize;
+	int line, k;
+	char *src = main_fb + y * main_bytes_per_line + x * pixelsize;
+	unsigned long long h = FNV_INIT;
+	unsigned int p, p0;
+
+	memcpy(&p0, src, 4);
+	*solid = 1;
+	for (line = 0; line < tile_y; line++) {
+		for (k = 0; k + 4 <= len; k += 4) {
+			memcpy(&p, src + k, 4);
+			h = FNV_MIX(h, p);
+			if (p != p0) {
+				*solid = 0;
+			}
+		}
+		if (k < len) {
+			h = fnv_bytes(h, src + k, len - k);
+			*solid = 0;
+		}
+		src += main_bytes_per_line;
+	}
+	return h;
+}
+
+/*
+ * Whether the full tiles at x, y and sx, sy in main_fb have the same
+ * pixels; as cheap as hashing the source again and never wrong.
+ */
+static int same_tile(int x, int y, int sx, int sy) {
+	int pixelsize = bpp/8, len = tile_x * pixelsize;
+	char *a = main_fb + y * main_bytes_per_line + x * pixelsize;
+	char *b = main_fb + sy * main_bytes_per_line + sx * pixelsize;
+	int line;
+
+	for (line = 0; line < tile_y; line++) {
+		if (memcmp(a, b, len)) {
+			return 0;
+		}
+		a += main_bytes_per_line;
+		b += main_bytes_per_line;
+	}
+	return 1;
+}
+
+static void index_put(unsigned long long h, int x, int y) {
+	int i, k, mask = tc_size - 1;
+	tc_entry_t *e;
+
+	i = (int) (h & mask);
+	for (k=0; k < TILECACHE_PROBE; k++) {
+		e = &tc_index[(i + k) & mask];
+		if (e->x < 0 || e->hash == h) {
+			break;
+		}
+	}
+	if (k == TILECACHE_PROBE) {
+		/* full around here: the newest wins */
+		e = &tc_index[i];
+	}
+	e->hash = h;
+	e->x = x;
+	e->y = y;
+}
+
+static int index_get(unsigned long long h, int *x, int *y) {
+	int i, k, mask = tc_size - 1;
+	tc_entry_t *e;
+
+	i = (int) (h & mask);
+	for (k=0; k < TILECACHE_PROBE; k++) {
+		e = &tc_index[(i + k) & mask];
+		if (e->x < 0) {
+			return 0;
+		}
+		if (e->hash == h) {
+			*x = e->x;
+			*y = e->y;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * (Re)builds the index from the whole screen, e.g. after the first
+ * viewer connects or the framebuffer changed size.
+ */
+static int index_reset(void) {
+	int x, y, n, solid;
+	unsigned long long h;
+
+	n = 64;
+	while (n < 2 * ntiles * (1 + ncache)) {
+		n *= 2;
+	}
+	if (n != tc_size) {
+		if (tc_index) free(tc_index);
+		tc_index = (tc_entry_t *) malloc(n * sizeof(tc_entry_t));
+		if (! tc_index) {
+			tc_size = 0;
+			return 0;
+		}
+		tc_size = n;
+	}
+	for (n=0; n < tc_size; n++) {
+		tc_index[n].x = -1;
+	}
+	tc_fb = main_fb;
+	tc_dpy_x = dpy_x;
+	tc_dpy_y = dpy_y;
+	tc_ncache = ncache;
+	tc_next_row = 0;
+
+	for (y=0; y + tile_y <= dpy_y; y += tile_y) {
+		for (x=0; x + tile_x <= dpy_x; x += tile_x) {
+			h = hash_tile(x, y, &solid);
+			if (! solid) {
+				index_put(h, x, y);
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+ * -ncache keeps saved window contents below the screen and moves them
+ * around with CopyRects we do not see, so a few tile rows of that
+ * area are indexed again each poll.
+ */
+static void index_offscreen(int nrows) {
+	int x, y, r, rows, solid;
+	unsigned long long h;
+
+	if (ncache <= 0) {
+		return;
+	}
+	rows = (dpy_y * ncache) / tile_y;
+	for (r=0; r < nrows && r < rows; r++) {
+		if (tc_next_row >= rows) {
+			tc_next_row = 0;
+		}
+		y = dpy_y + tc_next_row * tile_y;
+		for (x=0; x + tile_x <= dpy_x; x += tile_x) {
+			h = hash_tile(x, y, &solid);
+			if (! solid) {
+				index_put(h, x, y);
+			}
+		}
+		tc_next_row++;
+	}
+}
+
+/*
+ * Called after the changed tiles are in main_fb and before they are
+ * marked modified.  Sends the CopyRects and returns the number of
+ * tiles they took out of the update.
+ */
+int tilecache_copy(void) {
+	sraRegionPtr reg[TILECACHE_NREG], r;
+	int dxs[TILECACHE_NREG], dys[TILECACHE_NREG];
+	int n, m, k, x, y, sx, sy, dx, dy, solid;
+	int nreg = 0, hits = 0, count = 0;
+	unsigned long long h;
+
+	if (! tilecache_ok()) {
+		return 0;
+	}
+	if (! tc_index || tc_fb != main_fb || tc_dpy_x != dpy_x
+	    || tc_dpy_y != dpy_y || tc_ncache != ncache) {
+		/* nothing useful to find in a fresh index this time */
+		index_reset();
+		return 0;
+	}
+	index_offscreen(TILECACHE_ROWS);
+
+	if (tc_ntiles != ntiles) {
+		if (tc_hash) free(tc_hash);
+		if (tc_hit) free(tc_hit);
+		tc_hash = (unsigned long long *) malloc(ntiles
+		    * sizeof(unsigned long long));
+		tc_hit = (int *) malloc(ntiles * sizeof(int));
+		if (! tc_hash || ! tc_hit) {
+			tc_ntiles = 0;
+			return 0;
+		}
+		tc_ntiles = ntiles;
+	}
+
+	for (n=0; n < ntiles; n++) {
+		tc_hit[n] = -1;		/* -1: skip, -2: index only */
+		if (! tile_has_diff[n]) {
+			continue;
+		}
+		x = (n % ntiles_x) * tile_x;
+		y = (n / ntiles_x) * tile_y;
+		if (x + tile_x > dpy_x || y + tile_y > dpy_y) {
+			continue;
+		}
+		h = hash_tile(x, y, &solid);
+		if (solid) {
+			continue;
+		}
+		tc_hash[n] = h;
+		tc_hit[n] = -2;
+
+		if (! index_get(h, &sx, &sy)) {
+			continue;
+		}
+		if (sy < dpy_y) {
+			/* the source must be what the viewers have now */
+			m = sx / tile_x + (sy / tile_y) * ntiles_x;
+			if (tile_has_diff[m]) {
+				continue;
+			}
+		}
+		if (! same_tile(x, y, sx, sy)) {
+			continue;	/* stale entry or hash collision */
+		}
+
+		dx = x - sx;
+		dy = y - sy;
+		for (k=0; k < nreg; k++) {
+			if (dxs[k] == dx && dys[k] == dy) {
+				break;
+			}
+		}
+		if (k == nreg) {
+			if (nreg == TILECACHE_NREG) {
+				continue;
+			}
+			dxs[k] = dx;
+			dys[k] = dy;
+			reg[k] = sraRgnCreate();
+			nreg++;
+		}
+		r = sraRgnCreateRect(x, y, x + tile_x, y + tile_y);
+		sraRgnOr(reg[k], r);
+		sraRgnDestroy(r);
+		tc_hit[n] = k;
+		hits++;
+	}
+
+	/*
+	 * Flush what is pending first so the viewers' copy of the source
+	 * tiles is current.  The fb part of batch_copyregion() moves equal
+	 * pixels onto equal pixels here.
+	 */
+	if (hits >= TILECACHE_MIN_HITS && fb_push_wait(0.1, FB_COPY|FB_MOD)) {
+		batch_copyregion(reg, dxs, dys, nreg, 0.1);
+		for (n=0; n < ntiles; n++) {
+			if (tc_hit[n] >= 0) {
+				TILE_DIFF(n, 0);
+				count++;
+			}
+		}
+		if (debug_tiles) {
+			rfbLog("tilecache: %d tiles in %d CopyRects\n", count,
+			    nreg);
+		}
+	}
+	for (k=0; k < nreg; k++) {
+		sraRgnDestroy(reg[k]);
+	}
+
+	/* the new contents are where they are now */
+	for (n=0; n < ntiles; n++) {
+		if (tc_hit[n] != -1) {
+			index_put(tc_hash[n], (n % ntiles_x) * tile_x,
+			    (n / ntiles_x) * tile_y);
+		}
+	}
+	return count;
+}
@@ -92,6 +92,8 @@ int check_wireframe(void);
 int fb_update_sent(int *count);
 int check_user_input(double dt, double dtr, int tile_diffs, int *cnt);
 void do_copyregion(sraRegionPtr region, int dx, int dy, int mode);
+void batch_copyregion(sraRegionPtr* region, int *dx, int *dy, int ncr,
+    double delay);
 
 int check_ncache(int reset, int mode);
 int find_rect(int idx, int x, int y, int w, int h);
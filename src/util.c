@@ -87,6 +87,7 @@ double rect_overlap(int x1, int y1, int x2, int y2, int X1, int Y1,
     int X2, int Y2);
 
 char *choose_title(char *display);
+unsigned long long fnv_bytes(unsigned long long h, char *buf, int len);
 
 
 /*
@@ -788,3 +789,15 @@ char *choose_title(char *display) {
 	X_UNLOCK;
 	return title;
 }
+
+/*
+ * fold len bytes into the FNV-1a hash h (FNV_INIT to start one)
+ */
+unsigned long long fnv_bytes(unsigned long long h, char *buf, int len) {
+	int i;
+
+	for (i=0; i < len; i++) {
+		h = FNV_MIX(h, (unsigned char) buf[i]);
+	}
+	return h;
+}
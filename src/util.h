@@ -68,10 +68,19 @@ extern void rfbCFD(long usec);
 extern double rect_overlap(int x1, int y1, int x2, int y2, int X1, int Y1,
     int X2, int Y2);
 extern char *choose_title(char *display);
+extern unsigned long long fnv_bytes(unsigned long long h, char *buf, int len);
 
 
 #define NONUL(x) ((x != NULL) ? (x) : "")
 
+/*
+ * 64 bit FNV-1a, used for the tile, scroll and selection hashes: start
+ * from FNV_INIT and fold in each value with h = FNV_MIX(h, value).
+ */
+#define FNV_INIT	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+#define FNV_MIX(h, v)	(((h) ^ (v)) * FNV_PRIME)
+
 /*
 	Put this in usleep2() for debug printout.
 	fprintf(stderr, "_mysleep: %08d %10.6f %s:%d\n", (x), dnow() - x11vnc_start, __FILE__, __LINE__); \
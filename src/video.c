@@ -0,0 +1,423 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- video.c -- */
+
+#include "x11vnc.h"
+#include "video.h"
+#include "userinput.h"
+#include "rates.h"
+
+/*
+ * -videodetect: find the rectangles of the screen that change on
+ * nearly every poll (a video player, a WebGL canvas) and treat them
+ * apart from the rest of the desktop:
+ *
+ *  - their tiles are read and sent at most -videofps times a second.
+ *    In between they are left out of the poll; main_fb is not updated
+ *    there, so the next poll finds them changed again.
+ *
+ *  - with -videoquality q an update is not allowed to mix video and
+ *    desktop: the display hook holds back the video part (for one
+ *    update at most, so a busy desktop cannot starve it), and the
+ *    update that carries it alone is encoded with Tight/ZYWRLE quality
+ *    q (if the viewer enabled JPEG at all).  The desktop stays at the
+ *    viewer's quality.
+ */
+
+int video_detect = 0;		/* -videodetect */
+double video_fps = 10.0;	/* -videofps */
+int video_quality = -1;		/* -videoquality, -1: leave it alone */
+
+int video_cap(int xd_rects);
+int video_recap(void);
+char *video_regions_str(void);
+
+static void video_score(void);
+static void video_find(void);
+static void video_hooks(void);
+static sraRegionPtr video_region(void);
+static void video_display_hook(rfbClientPtr cl);
+static void video_finished_hook(rfbClientPtr cl, int result);
+
+#define VIDEO_MAX	4		/* regions followed */
+#define VIDEO_MIN	3		/* tiles each way, smaller is no video */
+#define VIDEO_SHIFT	3		/* score decay: 1/8 per poll */
+#define VIDEO_HOT	(65535 * 3 / 4)	/* changed on about 3 of 4 polls */
+
+typedef struct video_box {
+	int tx1, ty1, tx2, ty2;		/* tiles, [tx1, tx2) x [ty1, ty2) */
+	double due;			/* next time its tiles may be sent */
+	int held;			/* left out of this poll */
+} video_box_t;
+
+static video_box_t vbox[VIDEO_MAX];
+static int nvbox = 0;
+
+static int video_clear(video_box_t *b);
+
+static unsigned short *vscore = NULL;
+static int *vstack = NULL;
+static unsigned char *vseen = NULL;
+static int vn = 0;
+
+static void (*video_prev_hook)(rfbClientPtr) = NULL;
+static void (*video_prev_finished)(rfbClientPtr, int) = NULL;
+
+static void video_score(void) {
+	int n, h;
+
+	for (n=0; n < ntiles; n++) {
+		h = vscore[n];
+		if (tile_has_diff[n]) {
+			h += (65535 - h) >> VIDEO_SHIFT;
+		} else {
+			h -= h >> VIDEO_SHIFT;
+		}
+		vscore[n] = (unsigned short) h;
+	}
+}
+
+/*
+ * Connected groups of hot tiles whose bounding box is big enough and
+ * at least half hot become the new vbox[].  A box overlapping one of
+ * the last poll keeps its due time.
+ */
+static void video_find(void) {
+	video_box_t nb[VIDEO_MAX];
+	int nnb = 0, n, m, k, sp, cnt, tx, ty;
+	int tx1, ty1, tx2, ty2;
+
+	memset(vseen, 0, (size_t) ntiles);
+
+	for (n=0; n < ntiles && nnb < VIDEO_MAX; n++) {
+		if (vseen[n] || vscore[n] < VIDEO_HOT) {
+			continue;
+		}
+		tx1 = tx2 = n % ntiles_x;
+		ty1 = ty2 = n / ntiles_x;
+		cnt = 0;
+		sp = 0;
+		vstack[sp++] = n;
+		vseen[n] = 1;
+		while (sp > 0) {
+			m = vstack[--sp];
+			tx = m % ntiles_x;
+			ty = m / ntiles_x;
+			cnt++;
+			if (tx < tx1) tx1 = tx;
+			if (tx > tx2) tx2 = tx;
+			if (ty < ty1) ty1 = ty;
+			if (ty > ty2) ty2 = ty;
+
+#define VPUSH(c, t) \
+	if ((c) && ! vseen[t] && vscore[t] >= VIDEO_HOT) { \
+		vseen[t] = 1; \
+		vstack[sp++] = (t); \
+	}
+			VPUSH(tx > 0, m - 1)
+			VPUSH(tx < ntiles_x - 1, m + 1)
+			VPUSH(ty > 0, m - ntiles_x)
+			VPUSH(ty < ntiles_y - 1, m + ntiles_x)
+#undef VPUSH
+		}
+		tx2++;
+		ty2++;
+		if (tx2 - tx1 < VIDEO_MIN || ty2 - ty1 < VIDEO_MIN) {
+			continue;
+		}
+		if (2 * cnt < (tx2 - tx1) * (ty2 - ty1)) {
+			continue;
+		}
+		nb[nnb].tx1 = tx1;
+		nb[nnb].ty1 = ty1;
+		nb[nnb].tx2 = tx2;
+		nb[nnb].ty2 = ty2;
+		nb[nnb].due = 0.0;
+		nb[nnb].held = 0;
+		for (k=0; k < nvbox; k++) {
+			if (vbox[k].tx1 < tx2 && tx1 < vbox[k].tx2 &&
+			    vbox[k].ty1 < ty2 && ty1 < vbox[k].ty2) {
+				nb[nnb].due = vbox[k].due;
+				break;
+			}
+		}
+		if (nvbox == 0 || k == nvbox) {
+			rfbLog("video region: %dx%d+%d+%d\n",
+			    (tx2 - tx1) * tile_x, (ty2 - ty1) * tile_y,
+			    tx1 * tile_x, ty1 * tile_y);
+		}
+		nnb++;
+	}
+	for (k=0; k < nnb; k++) {
+		vbox[k] = nb[k];
+	}
+	nvbox = nnb;
+}
+
+/*
+ * Called by scan_for_updates() once tile_has_diff[] is complete and
+ * before the copying.  Returns the number of tiles taken out of this
+ * poll by the -videofps cap.
+ */
+int video_cap(int xd_rects) {
+	int k, x, y, w, h, skipped = 0;
+	double now;
+
+	if (! video_detect || ntiles <= 0) {
+		nvbox = 0;
+		if (screen) {
+			video_hooks();
+		}
+		return 0;
+	}
+	if (vn != ntiles) {
+		if (vscore) free(vscore);
+		if (vstack) free(vstack);
+		if (vseen) free(vseen);
+		vscore = (unsigned short *) calloc((size_t) ntiles,
+		    sizeof(unsigned short));
+		vstack = (int *) malloc((size_t) ntiles * sizeof(int));
+		vseen = (unsigned char *) malloc((size_t) ntiles);
+		nvbox = 0;
+		if (! vscore || ! vstack || ! vseen) {
+			vn = 0;
+			return 0;
+		}
+		vn = ntiles;
+	}
+
+	video_score();
+	video_find();
+	video_hooks();
+
+	/*
+	 * -xd_rects and -rawfb shm: damage is not seen again if the
+	 * tiles are skipped, so no cap there.
+	 */
+	if (xd_rects || video_fps <= 0.0) {
+		return 0;
+	}
+
+	now = dnow();
+	for (k=0; k < nvbox; k++) {
+		video_box_t *b = &vbox[k];
+
+		if (now >= b->due) {
+			b->due += 1.0 / video_fps;
+			if (b->due < now) {
+				b->due = now + 1.0 / video_fps;
+			}
+			b->held = 0;
+			continue;
+		}
+		b->held = 1;
+		skipped += video_clear(b);
+
+		/* keep XDAMAGE pointing at it for the next poll */
+		x = b->tx1 * tile_x;
+		y = b->ty1 * tile_y;
+		w = (b->tx2 - b->tx1) * tile_x;
+		h = (b->ty2 - b->ty1) * tile_y;
+		mark_for_xdamage(x, y, w, h);
+	}
+	return skipped;
+}
+
+/*
+ * The rescans after video_cap() find the held tiles changed again;
+ * this takes them out once more.
+ */
+int video_recap(void) {
+	int k, skipped = 0;
+
+	if (! video_detect) {
+		return 0;
+	}
+	for (k=0; k < nvbox; k++) {
+		if (vbox[k].held) {
+			skipped += video_clear(&vbox[k]);
+		}
+	}
+	return skipped;
+}
+
+static int video_clear(video_box_t *b) {
+	int tx, ty, n, cnt = 0;
+
+	for (ty = b->ty1; ty < b->ty2; ty++) {
+		for (tx = b->tx1; tx < b->tx2; tx++) {
+			n = tx + ty * ntiles_x;
+			if (tile_has_diff[n]) {
+				TILE_DIFF(n, 0);
+				cnt++;
+			}
+		}
+	}
+	return cnt;
+}
+
+/*
+ * The display hooks are in place only while there are video regions.
+ * Other code sets screen->displayHook now and then (rates.c, the
+ * truecolor workaround); it is chained and put back afterwards.
+ */
+static void video_hooks(void) {
+	int on = nvbox > 0 && video_quality >= 0 && ! scaling && ! rotating;
+
+	if (on) {
+		if (screen->displayHook != video_display_hook) {
+			video_prev_hook = screen->displayHook;
+			screen->displayHook = video_display_hook;
+		}
+		/* left on: it puts back what the display hook held */
+		if (screen->displayFinishedHook != video_finished_hook) {
+			video_prev_finished = screen->displayFinishedHook;
+			screen->displayFinishedHook = video_finished_hook;
+		}
+	} else if (screen->displayHook == video_display_hook) {
+		screen->displayHook = video_prev_hook;
+		video_prev_hook = NULL;
+	}
+}
+
+static sraRegionPtr video_region(void) {
+	sraRegionPtr reg = sraRgnCreate(), r;
+	int k, x2, y2;
+
+	for (k=0; k < nvbox; k++) {
+		x2 = vbox[k].tx2 * tile_x;
+		y2 = vbox[k].ty2 * tile_y;
+		if (x2 > dpy_x) x2 = dpy_x;
+		if (y2 > dpy_y) y2 = dpy_y;
+		r = sraRgnCreateRect(vbox[k].tx1 * tile_x,
+		    vbox[k].ty1 * tile_y, x2, y2);
+		sraRgnOr(reg, r);
+		sraRgnDestroy(r);
+	}
+	return reg;
+}
+
+/*
+ * Runs at the start of rfbSendFramebufferUpdate().  An update with
+ * both desktop and video changes goes out with the desktop part only;
+ * an update with only video is sent at -videoquality.
+ */
+static void video_display_hook(rfbClientPtr cl) {
+	ClientData *cd = (ClientData *) cl->clientData;
+	sraRegionPtr vid;
+
+	if (video_prev_hook) {
+		video_prev_hook(cl);
+	}
+	if (! cd || nvbox == 0) {
+		return;
+	}
+
+	vid = video_region();
+	if (use_threads) LOCK(cl->updateMutex);
+	sraRgnAnd(vid, cl->modifiedRegion);
+	if (sraRgnEmpty(vid)) {
+		sraRgnDestroy(vid);
+	} else {
+		sraRegionPtr rest = sraRgnCreateRgn(cl->modifiedRegion);
+
+		sraRgnSubtract(rest, vid);
+		if (! sraRgnEmpty(rest) && cd->video_deferred) {
+			/* held back once already, both go out now */
+			sraRgnDestroy(vid);
+			cd->video_deferred = 0;
+		} else if (! sraRgnEmpty(rest)) {
+			/* desktop now, the video next time */
+			cd->video_deferred = 1;
+			sraRgnSubtract(cl->modifiedRegion, vid);
+			if (cd->video_held) {
+				sraRgnOr(cd->video_held, vid);
+				sraRgnDestroy(vid);
+			} else {
+				cd->video_held = vid;
+			}
+		} else {
+			sraRgnDestroy(vid);
+			cd->video_deferred = 0;
+			if (cl->tightQualityLevel > video_quality) {
+				quality_save(cl, &cd->video_quality_saved);
+				quality_set(cl, video_quality);
+				cd->video_lowq = 1;
+			}
+		}
+		sraRgnDestroy(rest);
+	}
+	if (use_threads) UNLOCK(cl->updateMutex);
+}
+
+static void video_finished_hook(rfbClientPtr cl, int result) {
+	ClientData *cd = (ClientData *) cl->clientData;
+
+	if (video_prev_finished) {
+		video_prev_finished(cl, result);
+	}
+	if (! cd) {
+		return;
+	}
+	if (cd->video_lowq) {
+		quality_restore(cl, &cd->video_quality_saved);
+		cd->video_lowq = 0;
+	}
+	if (cd->video_held) {
+		if (use_threads) LOCK(cl->updateMutex);
+		sraRgnOr(cl->modifiedRegion, cd->video_held);
+		if (use_threads) UNLOCK(cl->updateMutex);
+		sraRgnDestroy(cd->video_held);
+		cd->video_held = NULL;
+	}
+}
+
+/*
+ * For -query video_regions: WxH+X+Y of each region, comma separated.
+ */
+char *video_regions_str(void) {
+	char *str = (char *) malloc(VIDEO_MAX * 64 + 1);
+	int k;
+
+	if (! str) {
+		return NULL;
+	}
+	str[0] = '\0';
+	for (k=0; k < nvbox; k++) {
+		sprintf(str + strlen(str), "%s%dx%d+%d+%d", k ? "," : "",
+		    (vbox[k].tx2 - vbox[k].tx1) * tile_x,
+		    (vbox[k].ty2 - vbox[k].ty1) * tile_y,
+		    vbox[k].tx1 * tile_x, vbox[k].ty1 * tile_y);
+	}
+	return str;
+}
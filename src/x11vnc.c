@@ -162,6 +162,12 @@
 #include "pm.h"
 #include "solid.h"
 #include "xi2_devices.h"
+#include "shmfb.h"
+#include "scrolldet.h"
+#include "tilecache.h"
+#include "evloop.h"
+#include "video.h"
+#include "simd.h"
 
 /*
  * main routine for the x11vnc program
@@ -1491,6 +1497,7 @@ static void print_settings(int try_http, int bg, char *gui_str) {
 	fprintf(stderr, " ssl:        %s\n", openssl_pem ? openssl_pem:"null");
 	fprintf(stderr, " ssldir:     %s\n", ssl_certs_dir ? ssl_certs_dir:"null");
 	fprintf(stderr, " ssltimeout  %d\n", ssl_timeout_secs);
+	fprintf(stderr, " sslinproc:  %d\n", ssl_inproc);
 	fprintf(stderr, " sslverify:  %s\n", ssl_verify ? ssl_verify:"null");
 	fprintf(stderr, " stunnel:    %d\n", use_stunnel);
 	fprintf(stderr, " accept:     %s\n", accept_cmd ? accept_cmd
@@ -1584,6 +1591,8 @@ static void print_settings(int try_http, int bg, char *gui_str) {
 	    max_keyrepeat_str : "null");
 	fprintf(stderr, "  scr_parms: %s\n", scroll_copyrect_str ?
 	    scroll_copyrect_str : SCROLL_COPYRECT_PARMS);
+	fprintf(stderr, " scrolldet:  %d\n", scroll_detect);
+	fprintf(stderr, " tilecache:  %d\n", tile_cache);
 	fprintf(stderr, " fixscreen:  %s\n", screen_fixup_str ?
 	    screen_fixup_str : "null");
 	fprintf(stderr, " noxrecord:  %d\n", noxrecord);
@@ -1592,6 +1601,8 @@ static void print_settings(int try_http, int bg, char *gui_str) {
 	fprintf(stderr, " inputskip:  %d\n", ui_skip);
 	fprintf(stderr, " speeds:     %s\n", speeds_str
 	    ? speeds_str : "null");
+	fprintf(stderr, " bwlimit:    %d\n", bw_limit);
+	fprintf(stderr, " pacing:     %d\n", pacing);
 	fprintf(stderr, " wmdt:       %s\n", wmdt_str
 	    ? wmdt_str : "null");
 	fprintf(stderr, " debug_ptr:  %d\n", debug_pointer);
@@ -1605,11 +1616,18 @@ static void print_settings(int try_http, int bg, char *gui_str) {
 	fprintf(stderr, " readtimeout: %d\n", rfbMaxClientWait/1000);
 	fprintf(stderr, " take_naps:  %d\n", take_naps);
 	fprintf(stderr, " sb:         %d\n", screen_blank);
+	fprintf(stderr, " eventloop:  %d\n", event_loop);
+	fprintf(stderr, " eventidle:  %d\n", event_idle_ms);
+	fprintf(stderr, " heatpoll:   %d\n", heat_poll);
+	fprintf(stderr, " videodet:   %d\n", video_detect);
+	fprintf(stderr, " videofps:   %.2f\n", video_fps);
+	fprintf(stderr, " videoqual:  %d\n", video_quality);
 	fprintf(stderr, " fbpm:       %d\n", !watch_fbpm);
 	fprintf(stderr, " dpms:       %d\n", !watch_dpms);
 	fprintf(stderr, " xdamage:    %d\n", use_xdamage);
 	fprintf(stderr, "  xd_area:   %d\n", xdamage_max_area);
 	fprintf(stderr, "  xd_mem:    %.3f\n", xdamage_memory);
+	fprintf(stderr, "  xd_rects:  %d\n", xdamage_rects);
 	fprintf(stderr, " xcomposite: %d\n", use_xcomposite);
 #ifdef HAVE_XI2
 	fprintf(stderr, " multiptr:   %d\n", use_multipointer);
@@ -1621,6 +1639,11 @@ static void print_settings(int try_http, int bg, char *gui_str) {
 	fprintf(stderr, " gaps_fill:  %d\n", gaps_fill);
 	fprintf(stderr, " grow_fill:  %d\n", grow_fill);
 	fprintf(stderr, " tile_fuzz:  %d\n", tile_fuzz);
+	fprintf(stderr, " simd:       %d\n", use_simd);
+	fprintf(stderr, " scanthreads:%d\n", scan_threads);
+	fprintf(stderr, " zerocopy:   %d\n", raw_fb_zerocopy);
+	fprintf(stderr, " pipeline:   %d\n", scan_pipeline);
+	fprintf(stderr, " fbdamage:   %d\n", shmfb_damage);
 	fprintf(stderr, " snapfb:     %d\n", use_snapfb);
 	fprintf(stderr, " rawfb:      %s\n", raw_fb_str
 	    ? raw_fb_str : "null");
@@ -2782,6 +2805,13 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			got_tls++;
 			continue;
 		}
+		if (!strcmp(arg, "-sslinproc")) {
+			ssl_inproc = 1;
+			vencrypt_mode = VENCRYPT_NONE;
+			anontls_mode = ANONTLS_NONE;
+			got_tls++;
+			continue;
+		}
 		if (!strcmp(arg, "-dhparams")) {
 			CHECK_ARGC
 			dhparams_file = strdup(argv[++i]);
@@ -3582,6 +3612,14 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			scroll_copyrect_str = strdup(argv[++i]);
 			continue;
 		}
+		if (!strcmp(arg, "-scrolldetect")) {
+			scroll_detect = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-tilecache")) {
+			tile_cache = 1;
+			continue;
+		}
 		if (!strcmp(arg, "-fixscreen")) {
 			CHECK_ARGC
 			screen_fixup_str = strdup(argv[++i]);
@@ -3644,6 +3682,22 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			speeds_str = strdup(argv[++i]);
 			continue;
 		}
+		if (!strcmp(arg, "-bwlimit")) {
+			CHECK_ARGC
+			bw_limit = atoi(argv[++i]);
+			if (bw_limit < 0) {
+				bw_limit = 0;
+			}
+			continue;
+		}
+		if (!strcmp(arg, "-pacing")) {
+			pacing = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-nopacing")) {
+			pacing = 0;
+			continue;
+		}
 		if (!strcmp(arg, "-wmdt")) {
 			CHECK_ARGC
 			wmdt_str = strdup(argv[++i]);
@@ -3727,6 +3781,37 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			screen_blank = atoi(argv[++i]);
 			continue;
 		}
+		if (!strcmp(arg, "-eventloop")) {
+			event_loop = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-eventidle")) {
+			CHECK_ARGC
+			event_idle_ms = atoi(argv[++i]);
+			continue;
+		}
+		if (!strcmp(arg, "-heatpoll")) {
+			CHECK_ARGC
+			heat_poll = atoi(argv[++i]);
+			continue;
+		}
+		if (!strcmp(arg, "-videodetect")) {
+			video_detect = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-videofps")) {
+			CHECK_ARGC
+			video_fps = atof(argv[++i]);
+			continue;
+		}
+		if (!strcmp(arg, "-videoquality")) {
+			CHECK_ARGC
+			video_quality = atoi(argv[++i]);
+			if (video_quality > 9) {
+				video_quality = 9;
+			}
+			continue;
+		}
 		if (!strcmp(arg, "-nofbpm")) {
 			watch_fbpm = 1;
 			continue;
@@ -3796,6 +3881,10 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			}
 			continue;
 		}
+		if (!strcmp(arg, "-xd_rects")) {
+			xdamage_rects = 1;
+			continue;
+		}
 		if (!strcmp(arg, "-xcomposite")) {
 			use_xcomposite++;
 			continue;
@@ -3872,6 +3961,30 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 			tile_fuzz = atoi(argv[++i]);
 			continue;
 		}
+		if (!strcmp(arg, "-nosimd")) {
+			use_simd = 0;
+			continue;
+		}
+		if (!strcmp(arg, "-scanthreads")) {
+			CHECK_ARGC
+			scan_threads = atoi(argv[++i]);
+			if (scan_threads < 0) {
+				scan_threads = 0;
+			}
+			continue;
+		}
+		if (!strcmp(arg, "-zerocopy")) {
+			raw_fb_zerocopy = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-pipeline")) {
+			scan_pipeline = 1;
+			continue;
+		}
+		if (!strcmp(arg, "-nofbdamage")) {
+			shmfb_damage = 0;
+			continue;
+		}
 		if (!strcmp(arg, "-debug_tiles")
 		    || !strcmp(arg, "-dbt")) {
 			debug_tiles++;
@@ -5748,6 +5861,9 @@ int x11vnc_main_legacy(int argc, char* argv[]) {
 	 * is called since we are single-threaded until then.
 	 */
 
+	/* before any -scanthreads or -pipeline thread can call a kernel */
+	simd_init();
+
 	initialize_screen(&argc_vnc, argv_vnc, fb0);
 
 	if (waited_for_client) {
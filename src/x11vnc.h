@@ -142,6 +142,7 @@ so, delete this exception statement from your version.
  * -DSKIP_HELP=1   smaller.
  * -DSKIP_XKB=1    a little smaller.
  * -DSKIP_8to24=1  a little smaller.
+ * -DNO_SIMD=1  do not build the SSE2/AVX2 framebuffer kernels.
  * -DPOLL_8TO24_DELAY=N  
  * -DDEBUG_XEVENTS=1  enable printout for X events.
  *
@@ -203,6 +204,15 @@ so, delete this exception statement from your version.
 #define LIBVNCSERVER_HAS_TEXTCHAT 1
 #endif
 
+/* libvncserver >= 0.9.9 encodes Tight JPEG from turboQualityLevel */
+#ifndef LIBVNCSERVER_HAS_TURBO
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+#define LIBVNCSERVER_HAS_TURBO 1
+#else
+#define LIBVNCSERVER_HAS_TURBO 0
+#endif
+#endif
+
 #ifdef PRE_0_8_LIBVNCSERVER
 #undef  LIBVNCSERVER_WITH_TIGHTVNC_FILETRANSFER
 #undef  LIBVNCSERVER_HAS_STATS
@@ -517,6 +527,7 @@ extern XImage **tile_row;	/* for all possible row runs */
 extern XImage *snaprect;	/* for XShmGetImage (fs_factor) */
 extern XImage *snap;		/* the full snap fb */
 extern XImage *raw_fb_image;	/* the raw fb */
+extern XImage *capture_row[2];	/* -pipeline tile row buffers */
 
 #if !HAVE_XSHM
 /*
@@ -533,6 +544,7 @@ extern XShmSegmentInfo scanline_shm;
 extern XShmSegmentInfo fullscreen_shm;
 extern XShmSegmentInfo *tile_row_shm;	/* for all possible row runs */
 extern XShmSegmentInfo snaprect_shm;
+extern XShmSegmentInfo capture_row_shm[2];
 
 /* rfb screen info */
 extern rfbScreenInfoPtr screen;
@@ -605,6 +617,34 @@ extern int ntiles, ntiles_x, ntiles_y;
 extern unsigned char *tile_has_diff, *tile_tried, *tile_copied;
 extern unsigned char *tile_has_xdamage_diff, *tile_row_has_xdamage_diff;
 
+/*
+ * tile_diff_bits[] has bit n set when tile_has_diff[n] != 0, so the
+ * scan.c passes can find the changed tiles 64 at a time.  All writes
+ * to tile_has_diff[] go through TILE_DIFF() to keep it in step; the
+ * bit update is atomic since -scanthreads rows can share a word.
+ */
+extern unsigned long long *tile_diff_bits;
+#define TILE_BITS_WORDS	((ntiles + 63) / 64)
+
+#if defined(__GNUC__)
+#define TILE_BITS_OR(w, b)	__sync_fetch_and_or((w), (b))
+#define TILE_BITS_AND(w, b)	__sync_fetch_and_and((w), (b))
+#else
+#define TILE_BITS_OR(w, b)	(*(w) |= (b))
+#define TILE_BITS_AND(w, b)	(*(w) &= (b))
+#endif
+
+#define TILE_DIFF(n, v) \
+	do { \
+		int tn_ = (n); \
+		unsigned long long tb_ = 1ULL << (tn_ & 63); \
+		if ((tile_has_diff[tn_] = (v)) != 0) { \
+			TILE_BITS_OR(tile_diff_bits + (tn_ >> 6), tb_); \
+		} else { \
+			TILE_BITS_AND(tile_diff_bits + (tn_ >> 6), ~tb_); \
+		} \
+	} while (0)
+
 /* times of recent events */
 extern time_t last_event, last_input, last_client, last_open_xdisplay;
 extern time_t last_keyboard_input, last_pointer_input; 
@@ -684,6 +724,15 @@ typedef struct hint {
 
 /* struct with client specific data: */
 #define CILEN 10
+#define LATENCY_NBUCKETS 32
+
+/* a client's JPEG quality, kept while x11vnc lowers it */
+typedef struct {
+	int tight;	/* tightQualityLevel, 0-9, -1: no JPEG */
+	int turbo;	/* turboQualityLevel, 1-100 */
+	int subsamp;	/* turboSubsampLevel */
+} client_quality_t;
+
 typedef struct _ClientData {
 	int uid;
 	char *hostname;
@@ -708,6 +757,46 @@ typedef struct _ClientData {
 	int cmp_bytes_sent;
 	int raw_bytes_sent;
 
+	/* 64 bit running totals of the libvncserver counters, see stats.c */
+	unsigned int stats_last[4];
+	unsigned long long stats_total[4];
+	double stats_active;
+
+	/* input to fb update latency, see stats_input() */
+	double lat_input;	/* oldest input not answered yet, 0.0: none */
+	int lat_x, lat_y;	/* pointer at a click, -1: key, anywhere */
+	int lat_mask;		/* last button mask, see stats_pointer() */
+	double lat_tiles;	/* first poll finding changes after it */
+	unsigned int lat_fbu;	/* fb updates sent at that poll */
+	unsigned int lat_hist[LATENCY_NBUCKETS];
+
+	/* -videodetect display hook state, see video.c */
+	sraRegionPtr video_held;
+	client_quality_t video_quality_saved;
+	int video_lowq;
+	int video_deferred;	/* last update went without the video */
+
+	/* -bwlimit token bucket, see bw_limit_clients() */
+	double bw_tokens;
+	double bw_time;
+	double bw_ok_time;
+	unsigned int bw_sent;
+	int bw_held;
+	int bw_degraded;
+	client_quality_t bw_quality;
+	int bw_compress;
+
+	/* requestedRegion parked while held, see updates_gate() */
+	sraRegionPtr held_req;
+
+	/* send queue pacing, see pace_clients() */
+	double pace_time;
+	double pace_rate;	/* bytes/sec the socket drains, 0.0: unknown */
+	double pace_rtt;	/* seconds */
+	unsigned int pace_sent;
+	int pace_outq;
+	int pace_held;
+
         int ptr_id; /* pointer and keyboard device ids used in multipointer mode */ 
         int kbd_id;
         int ptr_buttonmask;
@@ -0,0 +1,610 @@
+/*
+   Copyright (C) 2002-2010 Karl J. Runge <runge@karlrunge.com> 
+   All rights reserved.
+
+This file is part of x11vnc.
+
+x11vnc is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version.
+
+x11vnc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with x11vnc; if not, write to the Free Software
+Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA
+or see <http://www.gnu.org/licenses/>.
+
+In addition, as a special exception, Karl J. Runge
+gives permission to link the code of its release of x11vnc with the
+OpenSSL project's "OpenSSL" library (or with modified versions of it
+that use the same license as the "OpenSSL" library), and distribute
+the linked executables.  You must obey the GNU General Public License
+in all respects for all of the code used other than "OpenSSL".  If you
+modify this file, you may extend this exception to your version of the
+file, but you are not obligated to do so.  If you do not wish to do
+so, delete this exception statement from your version.
+*/
+
+/* -- x11vnc_bench.c -- */
+
+/*
+ * Benchmark for the scan/tile pipeline of scan_for_updates().
+ *
+ * A memory mapped file is handed to initialize_raw_fb() as a
+ * "map:file@WxHx32" -rawfb and synthetic desktop activity is drawn
+ * into it between polls: scrolling terminal text, a video rectangle,
+ * a dragged window, or nothing at all.  For each pattern the time
+ * spent in the scan_display(), copy_tiles(), grow_islands(),
+ * fill_tile_gaps() and hint_updates() phases is reported along with
+ * how many tiles were read from the framebuffer versus how many
+ * actually changed.  No VNC port is opened.
+ *
+ *	x11vnc_bench [-geometry WxH] [-frames n] [-pattern name]
+ *	             [-fs f] [-gaps n] [-grow n] [-fuzz n] [-nosimd]
+ *	             [-scanthreads n] [-zerocopy] [-damage]
+ *
+ * -damage puts an x11vnc_shmfb.h header in front of the pixels and
+ * posts the drawn rectangles to it.
+ *
+ *	x11vnc_bench -cmap [-geometry WxH] [-frames n] [-nosimd]
+ *
+ * instead times the -8to24 colormap lookups on a full screen of 8bpp
+ * pixels: the old pixel at a time loops against fb_cmap8to32() and
+ * fb_cmap_hi8().
+ *
+ *	x11vnc_bench -24to32 [-geometry WxH] [-frames n] [-nosimd]
+ *
+ * times the -24to32 widening of packed 24bpp lines: the old byte at a
+ * time loop against fb_pack24to32().
+ */
+
+#include "x11vnc.h"
+#include "screen.h"
+#include "scan.h"
+#include "xdamage.h"
+#include "simd.h"
+#include "x11vnc_shmfb.h"
+
+#include <sys/mman.h>
+
+enum {
+	PAT_IDLE = 0,
+	PAT_SCROLL,
+	PAT_VIDEO,
+	PAT_DRAG,
+	PAT_MAX
+};
+
+static char *pat_names[PAT_MAX] = {"idle", "scroll", "video", "drag"};
+
+static unsigned int *frame;	/* the mapped -rawfb file */
+static unsigned int *shadow;	/* previous frame, for the ground truth */
+static int fb_w = 1280, fb_h = 1024;
+static unsigned int rnd_state = 0x12345678;
+static x11vnc_shmfb_header_t *damage_hdr = NULL;	/* -damage */
+
+static void usage(char *prog);
+static unsigned int rnd(void);
+static void post(int x, int y, int w, int h);
+static unsigned int bg_pixel(int x, int y);
+static void draw_background(void);
+static void draw_scroll(int n);
+static void draw_video(void);
+static void draw_drag(int n);
+static int tiles_differ(unsigned int *a, unsigned int *b, int bpl_b);
+static void settle(void);
+static void run_pattern(int pat, int nframes);
+static void run_cmap(int nframes);
+static void run_pack24(int nframes);
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-geometry WxH] [-frames n] "
+	    "[-pattern idle|scroll|video|drag|all]\n", prog);
+	fprintf(stderr, "       [-fs f] [-gaps n] [-grow n] [-fuzz n] "
+	    "[-nosimd] [-scanthreads n] [-zerocopy] [-damage]\n");
+	fprintf(stderr, "       %s -cmap [-geometry WxH] [-frames n] "
+	    "[-nosimd]\n", prog);
+	fprintf(stderr, "       %s -24to32 [-geometry WxH] [-frames n] "
+	    "[-nosimd]\n", prog);
+	exit(1);
+}
+
+/* xorshift, the same sequence every run */
+static unsigned int rnd(void) {
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/* tell x11vnc what was drawn, under -damage */
+static void post(int x, int y, int w, int h) {
+	if (damage_hdr) {
+		x11vnc_shmfb_damage(damage_hdr, x, y, w, h);
+	}
+}
+
+static unsigned int bg_pixel(int x, int y) {
+	return (((x * 64) / fb_w) << 16) | (((y * 128) / fb_h) << 8) | 0x40;
+}
+
+static void draw_background(void) {
+	int x, y;
+
+	for (y=0; y < fb_h; y++) {
+		unsigned int *p = frame + y * fb_w;
+		for (x=0; x < fb_w; x++) {
+			p[x] = bg_pixel(x, y);
+		}
+	}
+	post(0, 0, fb_w, fb_h);
+}
+
+/*
+ * A terminal covering 2/3 of the screen scrolling up one 16 pixel
+ * text line per frame, a new line of "glyphs" appearing at the bottom.
+ */
+static void draw_scroll(int n) {
+	int x0 = fb_w / 16, y0 = fb_h / 16;
+	int w = (2 * fb_w) / 3, h = (2 * fb_h) / 3;
+	int lh = 16, cw = 8, x, y;
+
+	h -= h % lh;
+	if (n == 0) {
+		for (y=y0; y < y0 + h; y++) {
+			for (x=x0; x < x0 + w; x++) {
+				frame[y * fb_w + x] = 0x000000;
+			}
+		}
+	}
+	for (y=y0; y < y0 + h - lh; y++) {
+		memmove(frame + y * fb_w + x0, frame + (y + lh) * fb_w + x0,
+		    w * 4);
+	}
+	for (x=x0; x + cw <= x0 + w; x += cw) {
+		unsigned int glyph = (rnd() % 4) ? rnd() : 0;
+		int i, j;
+
+		for (j=0; j < lh; j++) {
+			unsigned int *p = frame + (y0 + h - lh + j) * fb_w + x;
+			for (i=0; i < cw; i++) {
+				int bit = (glyph >> ((j / 2) * 4 + i / 2)) & 1;
+				p[i] = (bit && j > 1 && j < lh - 2) ?
+				    0xc0c0c0 : 0x000000;
+			}
+		}
+	}
+	post(x0, y0, w, h);
+}
+
+/* a W/3 x H/3 rectangle of noise, every pixel new each frame */
+static void draw_video(void) {
+	int x0 = fb_w / 4, y0 = fb_h / 4;
+	int w = fb_w / 3, h = fb_h / 3, x, y;
+
+	for (y=y0; y < y0 + h; y++) {
+		unsigned int *p = frame + y * fb_w;
+		for (x=x0; x < x0 + w; x++) {
+			p[x] = rnd() & 0xffffff;
+		}
+	}
+	post(x0, y0, w, h);
+}
+
+/*
+ * A 400x300 window bouncing around the screen, background repainted
+ * where it was, like an opaque move without a compositor.
+ */
+static void draw_drag(int n) {
+	static int wx, wy, dx, dy;
+	int ww = fb_w / 3, wh = fb_h / 3, x, y;
+
+	if (ww > 400) ww = 400;
+	if (wh > 300) wh = 300;
+	if (n == 0) {
+		wx = wy = 0;
+		dx = 7;
+		dy = 5;
+	} else {
+		for (y=wy; y < wy + wh; y++) {
+			for (x=wx; x < wx + ww; x++) {
+				frame[y * fb_w + x] = bg_pixel(x, y);
+			}
+		}
+		post(wx, wy, ww, wh);
+		if (wx + dx < 0 || wx + dx + ww > fb_w) dx = -dx;
+		if (wy + dy < 0 || wy + dy + wh > fb_h) dy = -dy;
+		wx += dx;
+		wy += dy;
+	}
+	for (y=0; y < wh; y++) {
+		unsigned int *p = frame + (wy + y) * fb_w + wx;
+		for (x=0; x < ww; x++) {
+			if (y < 20) {
+				p[x] = 0x3050a0;	/* title bar */
+			} else if (x == 0 || y == wh - 1 || x == ww - 1) {
+				p[x] = 0x202020;
+			} else {
+				p[x] = 0xe0e0e0 ^ ((x * 3) ^ (y * 5)) % 64;
+			}
+		}
+	}
+	post(wx, wy, ww, wh);
+}
+
+/*
+ * Count the tiles where a (the mapped file) and b differ.  With
+ * b == shadow this is the number that really changed since the last
+ * frame; with b the rfb framebuffer the number still stale after the
+ * poll (always 0 under -zerocopy, the clients read the file itself).
+ */
+static int tiles_differ(unsigned int *a, unsigned int *b, int bpl_b) {
+	int tx, ty, y, count = 0;
+
+	for (ty=0; ty < ntiles_y; ty++) {
+		int y1 = ty * tile_y, y2 = y1 + tile_y;
+		if (y2 > fb_h) y2 = fb_h;
+		for (tx=0; tx < ntiles_x; tx++) {
+			int x1 = tx * tile_x, w = tile_x;
+			if (x1 + w > fb_w) w = fb_w - x1;
+			for (y=y1; y < y2; y++) {
+				char *pb = ((char *) b) + y * bpl_b + x1 * 4;
+				if (memcmp(a + y * fb_w + x1, pb, w * 4)) {
+					count++;
+					break;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+/* poll until main_fb has caught up with the file */
+static void settle(void) {
+	int i;
+
+	for (i=0; i < 4 * NSCAN; i++) {
+		scan_for_updates(0);
+		if (! tiles_differ(frame, (unsigned int *) screen->frameBuffer,
+		    screen->paddedWidthInBytes)) {
+			break;
+		}
+	}
+}
+
+static void run_pattern(int pat, int nframes) {
+	double t0, total = 0.0, worst = 0.0;
+	long changed = 0, stale = 0, marked = 0;
+	int i, n;
+
+	draw_background();
+	settle();
+	memcpy(shadow, frame, fb_w * fb_h * 4);
+	scan_timing_reset();
+
+	for (n=0; n < nframes; n++) {
+		switch (pat) {
+		case PAT_SCROLL: draw_scroll(n); break;
+		case PAT_VIDEO:  draw_video();   break;
+		case PAT_DRAG:   draw_drag(n);   break;
+		default: break;
+		}
+		if (damage_hdr) {
+			x11vnc_shmfb_frame_done(damage_hdr);
+		}
+		changed += tiles_differ(frame, shadow, fb_w * 4);
+		memcpy(shadow, frame, fb_w * fb_h * 4);
+
+		t0 = dnow();
+		scan_timing = 1;
+		marked += scan_for_updates(0);
+		scan_timing = 0;
+		t0 = dnow() - t0;
+		total += t0;
+		if (t0 > worst) {
+			worst = t0;
+		}
+		stale += tiles_differ(frame,
+		    (unsigned int *) screen->frameBuffer,
+		    screen->paddedWidthInBytes);
+	}
+
+	fprintf(stdout, "%-7s %8.3f %7.3f", pat_names[pat],
+	    1000.0 * total / nframes, 1000.0 * worst);
+	for (i=0; i < SCAN_PHASE_MAX; i++) {
+		fprintf(stdout, " %7.3f",
+		    1000.0 * scan_phase_time[i] / nframes);
+	}
+	fprintf(stdout, " %8.1f %8.1f %8.1f %6.1f\n",
+	    (double) scan_tiles_fetched / nframes,
+	    (double) changed / nframes, (double) marked / nframes,
+	    (double) stale / nframes);
+}
+
+/*
+ * Colormap lookups as done by transform_rect() for an 8bpp overlay
+ * covering the whole screen, one line at a time.
+ */
+static void run_cmap(int nframes) {
+	unsigned int lut[256], *dst, *ref;
+	unsigned char *idx;
+	double t, t_ref, t_8, t_hi;
+	int i, n, y, np = fb_w * fb_h, bad = 0;
+
+	idx = (unsigned char *) malloc(np);
+	dst = (unsigned int *) malloc(np * 4);
+	ref = (unsigned int *) malloc(np * 4);
+	if (! idx || ! dst || ! ref) {
+		perror("x11vnc_bench: malloc");
+		exit(1);
+	}
+	for (i=0; i < 256; i++) {
+		lut[i] = rnd() & 0xffffff;
+	}
+	for (i=0; i < np; i++) {
+		/* runs of color, like a CAD drawing */
+		idx[i] = (i / 7 + i / fb_w) % 16 ? (rnd() & 0x3) : rnd();
+	}
+
+	t = dnow();
+	for (n=0; n < nframes; n++) {
+		for (i=0; i < np; i++) {
+			ref[i] = lut[idx[i]];
+		}
+	}
+	t_ref = dnow() - t;
+
+	t = dnow();
+	for (n=0; n < nframes; n++) {
+		for (y=0; y < fb_h; y++) {
+			fb_cmap8to32(dst + y * fb_w, idx + y * fb_w, fb_w, lut);
+		}
+	}
+	t_8 = dnow() - t;
+	if (memcmp(dst, ref, np * 4)) {
+		bad++;
+	}
+
+	for (i=0; i < np; i++) {
+		dst[i] = (unsigned int) idx[i] << 24;
+		ref[i] = dst[i] | lut[idx[i]];
+	}
+	t = dnow();
+	for (n=0; n < nframes; n++) {
+		/* in place, rewrites the same values after the first */
+		for (y=0; y < fb_h; y++) {
+			fb_cmap_hi8(dst + y * fb_w, fb_w, lut);
+		}
+	}
+	t_hi = dnow() - t;
+	if (memcmp(dst, ref, np * 4)) {
+		bad++;
+	}
+
+	fprintf(stdout, "x11vnc_bench: -cmap %dx%d, %d frames, %s kernels\n",
+	    fb_w, fb_h, nframes, simd_kernel_name());
+	fprintf(stdout, "lookup         ms/frame  Mpixel/s\n");
+	fprintf(stdout, "pixel loop     %8.3f  %8.1f\n",
+	    1000.0 * t_ref / nframes, np * nframes / (1e6 * t_ref));
+	fprintf(stdout, "fb_cmap8to32   %8.3f  %8.1f\n",
+	    1000.0 * t_8 / nframes, np * nframes / (1e6 * t_8));
+	fprintf(stdout, "fb_cmap_hi8    %8.3f  %8.1f\n",
+	    1000.0 * t_hi / nframes, np * nframes / (1e6 * t_hi));
+	if (bad) {
+		fprintf(stdout, "x11vnc_bench: colormap kernels MISMATCH\n");
+		exit(1);
+	}
+
+	free(idx);
+	free(dst);
+	free(ref);
+}
+
+/*
+ * Widening as done by copy_raw_fb() for a full screen -24to32 -rawfb,
+ * one line at a time.
+ */
+static void run_pack24(int nframes) {
+	unsigned char *src, *dst, *ref, *s, *d;
+	double t, t_ref, t_pk;
+	int i, n, y, np = fb_w * fb_h;
+
+	src = (unsigned char *) malloc(np * 3);
+	dst = (unsigned char *) malloc(np * 4);
+	ref = (unsigned char *) malloc(np * 4);
+	if (! src || ! dst || ! ref) {
+		perror("x11vnc_bench: malloc");
+		exit(1);
+	}
+	for (i=0; i < np * 3; i++) {
+		src[i] = rnd();
+	}
+
+	t = dnow();
+	for (n=0; n < nframes; n++) {
+		s = src;
+		d = ref;
+		for (i=0; i < np; i++) {
+			if (rfbEndianTest) {
+				*d++ = *s++;
+				*d++ = *s++;
+				*d++ = *s++;
+				*d++ = 0;
+			} else {
+				*d++ = 0;
+				*d++ = *s++;
+				*d++ = *s++;
+				*d++ = *s++;
+			}
+		}
+	}
+	t_ref = dnow() - t;
+
+	t = dnow();
+	for (n=0; n < nframes; n++) {
+		for (y=0; y < fb_h; y++) {
+			fb_pack24to32((char *) dst + y * fb_w * 4,
+			    (char *) src + y * fb_w * 3, fb_w);
+		}
+	}
+	t_pk = dnow() - t;
+
+	fprintf(stdout, "x11vnc_bench: -24to32 %dx%d, %d frames, %s kernels\n",
+	    fb_w, fb_h, nframes, simd_kernel_name());
+	fprintf(stdout, "widen          ms/frame  Mpixel/s\n");
+	fprintf(stdout, "byte loop      %8.3f  %8.1f\n",
+	    1000.0 * t_ref / nframes, np * nframes / (1e6 * t_ref));
+	fprintf(stdout, "fb_pack24to32  %8.3f  %8.1f\n",
+	    1000.0 * t_pk / nframes, np * nframes / (1e6 * t_pk));
+	if (memcmp(dst, ref, np * 4)) {
+		fprintf(stdout, "x11vnc_bench: 24to32 kernel MISMATCH\n");
+		exit(1);
+	}
+
+	free(src);
+	free(dst);
+	free(ref);
+}
+
+int main(int argc, char *argv[]) {
+	static char *vnc_argv[] = {"x11vnc_bench", NULL};
+	char tmp[] = "/tmp/x11vnc_bench.XXXXXX";
+	char str[100];
+	int vnc_argc = 1;
+	int i, fd, pat = -1, nframes = 300, cmap = 0, pack24 = 0;
+	size_t len, hsize = 0;
+	char *base;
+	XImage *fb;
+
+	for (i=1; i < argc; i++) {
+		char *arg = argv[i];
+		if (i + 1 >= argc && strcmp(arg, "-nosimd")
+		    && strcmp(arg, "-zerocopy") && strcmp(arg, "-damage")
+		    && strcmp(arg, "-cmap") && strcmp(arg, "-24to32")) {
+			usage(argv[0]);
+		}
+		if (!strcmp(arg, "-geometry")) {
+			if (sscanf(argv[++i], "%dx%d", &fb_w, &fb_h) != 2
+			    || fb_w < 64 || fb_h < 64) {
+				usage(argv[0]);
+			}
+		} else if (!strcmp(arg, "-frames")) {
+			nframes = atoi(argv[++i]);
+			if (nframes < 1) {
+				usage(argv[0]);
+			}
+		} else if (!strcmp(arg, "-pattern")) {
+			char *p = argv[++i];
+			if (!strcmp(p, "all")) {
+				pat = -1;
+			} else {
+				for (pat=0; pat < PAT_MAX; pat++) {
+					if (!strcmp(p, pat_names[pat])) {
+						break;
+					}
+				}
+				if (pat == PAT_MAX) {
+					usage(argv[0]);
+				}
+			}
+		} else if (!strcmp(arg, "-fs")) {
+			fs_frac = atof(argv[++i]);
+		} else if (!strcmp(arg, "-gaps")) {
+			gaps_fill = atoi(argv[++i]);
+		} else if (!strcmp(arg, "-grow")) {
+			grow_fill = atoi(argv[++i]);
+		} else if (!strcmp(arg, "-fuzz")) {
+			tile_fuzz = atoi(argv[++i]);
+		} else if (!strcmp(arg, "-nosimd")) {
+			use_simd = 0;
+		} else if (!strcmp(arg, "-scanthreads")) {
+			scan_threads = atoi(argv[++i]);
+		} else if (!strcmp(arg, "-zerocopy")) {
+			raw_fb_zerocopy = 1;
+		} else if (!strcmp(arg, "-damage")) {
+			hsize = (X11VNC_SHMFB_HEADER_SIZE(256) + 4095) & ~4095;
+		} else if (!strcmp(arg, "-cmap")) {
+			cmap = 1;
+		} else if (!strcmp(arg, "-24to32")) {
+			pack24 = 1;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (cmap) {
+		quiet = 1;
+		run_cmap(nframes);
+		return 0;
+	}
+	if (pack24) {
+		quiet = 1;
+		run_pack24(nframes);
+		return 0;
+	}
+
+	len = (size_t) fb_w * fb_h * 4;
+	fd = mkstemp(tmp);
+	if (fd < 0 || ftruncate(fd, hsize + len) != 0) {
+		perror("x11vnc_bench: tmp file");
+		exit(1);
+	}
+	base = (char *) mmap(NULL, hsize + len, PROT_READ|PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	shadow = (unsigned int *) malloc(len);
+	if (base == MAP_FAILED || ! shadow) {
+		perror("x11vnc_bench: mmap");
+		unlink(tmp);
+		exit(1);
+	}
+	if (hsize) {
+		x11vnc_shmfb_init(base, hsize, 256);
+		damage_hdr = (x11vnc_shmfb_header_t *) base;
+	}
+	frame = (unsigned int *) (base + hsize);
+	draw_background();
+
+	sprintf(str, "map:%s@%dx%dx32", tmp, fb_w, fb_h);
+	raw_fb_str = strdup(str);
+	quiet = 1;
+	take_naps = 0;
+	use_xdamage = 0;
+	got_rfbport = 1;
+	got_rfbport_val = 0;	/* no listening socket */
+	rfbLogEnable(0);
+
+	fb = initialize_xdisplay_fb();
+	if (! fb || dpy_x != fb_w || dpy_y != fb_h) {
+		fprintf(stderr, "x11vnc_bench: could not map %s\n", raw_fb_str);
+		unlink(tmp);
+		exit(1);
+	}
+	initialize_screen(&vnc_argc, vnc_argv, fb);
+	initialize_tiles();
+	initialize_polling_images();
+
+	fprintf(stdout, "x11vnc_bench: %dx%d, %dx%d tiles of %dx%d, "
+	    "%d frames%s%s%s\n", fb_w, fb_h, ntiles_x, ntiles_y, tile_x,
+	    tile_y, nframes, use_simd ? "" : ", -nosimd",
+	    rawfb_zerocopy ? ", -zerocopy" : "",
+	    damage_hdr ? ", -damage" : "");
+	fprintf(stdout, "                ms/frame"
+	    " ---------- ms/frame by phase ----------"
+	    " ---------- tiles/frame ----------\n");
+	fprintf(stdout, "pattern     mean   worst    scan    copy islands"
+	    "    gaps   hints  fetched  changed   marked  stale\n");
+
+	for (i=0; i < PAT_MAX; i++) {
+		if (pat < 0 || pat == i) {
+			run_pattern(i, nframes);
+		}
+	}
+
+	unlink(tmp);
+	return 0;
+}
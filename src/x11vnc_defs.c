@@ -84,12 +84,14 @@ XImage **tile_row = NULL;	/* for all possible row runs */
 XImage *snaprect = NULL;	/* for XShmGetImage (fs_factor) */
 XImage *snap = NULL;		/* the full snap fb */
 XImage *raw_fb_image = NULL;	/* the raw fb */
+XImage *capture_row[2] = {NULL, NULL};	/* -pipeline tile row buffers */
 
 /* corresponding shm structures */
 XShmSegmentInfo scanline_shm;
 XShmSegmentInfo fullscreen_shm;
 XShmSegmentInfo *tile_row_shm;	/* for all possible row runs */
 XShmSegmentInfo snaprect_shm;
+XShmSegmentInfo capture_row_shm[2];
 
 /* rfb screen info */
 rfbScreenInfoPtr screen = NULL;
@@ -161,6 +163,7 @@ int ntiles, ntiles_x = 0, ntiles_y = 0;
 /* arrays that indicate changed or checked tiles. */
 unsigned char *tile_has_diff = NULL, *tile_tried = NULL, *tile_copied = NULL;
 unsigned char *tile_has_xdamage_diff = NULL, *tile_row_has_xdamage_diff = NULL;
+unsigned long long *tile_diff_bits = NULL;
 
 /* times of recent events */
 time_t last_event = 0, last_input = 0, last_client = 0, last_open_xdisplay = 0;
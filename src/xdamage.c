@@ -54,6 +54,7 @@ int xdamage_max_area = 20000;	/* pixels */
 #endif
 
 double xdamage_memory = 1.0;	/* in units of NSCAN */
+int xdamage_rects = 0;		/* -xd_rects, poll only the damaged tiles */
 int xdamage_tile_count = 0, xdamage_direct_count = 0;
 double xdamage_scheduled_mark = 0.0;
 double xdamage_crazy_time = 0.0;
@@ -68,6 +69,8 @@ void clear_xdamage_mark_region(sraRegionPtr markregion, int flush);
 int collect_non_X_xdamage(int x_in, int y_in, int w_in, int h_in, int call);
 int collect_xdamage(int scancnt, int call);
 int xdamage_hint_skip(int y);
+int xdamage_rects_ok(void);
+int xdamage_mark_tiles(void);
 void initialize_xdamage(void);
 void create_xdamage_if_needed(int force);
 void destroy_xdamage_if_needed(void);
@@ -733,6 +736,82 @@ if (0) fprintf(stderr, "xdamage_hint_skip: %d -> %d\n", y, ret);
 	return ret;
 }
 
+/*
+ * Whether -xd_rects polling can be used right now: we need a live
+ * Damage object on a real X display.
+ */
+int xdamage_rects_ok(void) {
+	if (! xdamage_rects || ! use_xdamage || ! xdamage_present) {
+		return 0;
+	}
+	if (! dpy || raw_fb_str || macosx_console || ncache > 0) {
+		return 0;
+	}
+	if (! xdamage_regions || xdamage_ticker < 0) {
+		return 0;
+	}
+#if HAVE_LIBXDAMAGE
+	if (! xdamage || ! xdamage_base_event_type) {
+		return 0;
+	}
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * For -xd_rects: set tile_has_diff[] for every tile touched by the
+ * damage of this poll and the previous one (the drawing may not have
+ * been finished when its DAMAGE event came in).  Returns the number
+ * of tiles marked.
+ */
+int xdamage_mark_tiles(void) {
+	sraRegionPtr reg;
+	sraRectangleIterator *iter;
+	sraRect rect;
+	int i, n, nreg, nmem, count = 0;
+	int tx, ty, tx1, tx2, ty1, ty2;
+
+	if (! xdamage_regions || ntiles_x == 0 || ntiles_y == 0) {
+		return 0;
+	}
+	nreg = (xdamage_memory * NSCAN) + 1;
+	nmem = nreg < 2 ? nreg : 2;
+
+	for (i=0; i < nmem; i++) {
+		n = (xdamage_ticker + nreg - i) % nreg;
+		reg = xdamage_regions[n];
+		if (reg == NULL || sraRgnEmpty(reg)) {
+			continue;
+		}
+		iter = sraRgnGetIterator(reg);
+		while (sraRgnIteratorNext(iter, &rect)) {
+			if (rect.x2 <= rect.x1 || rect.y2 <= rect.y1) {
+				continue;
+			}
+			tx1 = nfix(rect.x1 / tile_x, ntiles_x);
+			tx2 = nfix((rect.x2 - 1) / tile_x, ntiles_x);
+			ty1 = nfix(rect.y1 / tile_y, ntiles_y);
+			ty2 = nfix((rect.y2 - 1) / tile_y, ntiles_y);
+			for (ty = ty1; ty <= ty2; ty++) {
+				for (tx = tx1; tx <= tx2; tx++) {
+					n = tx + ty * ntiles_x;
+					if (! tile_has_diff[n]) {
+						TILE_DIFF(n, 1);
+						count++;
+					}
+				}
+			}
+		}
+		sraRgnReleaseIterator(iter);
+	}
+	if (debug_xdamage > 1) {
+		fprintf(stderr, "xdamage_mark_tiles: %d\n", count);
+	}
+	return count;
+}
+
 void initialize_xdamage(void) {
 	sraRegionPtr *ptr;
 	int i, nreg;
@@ -42,6 +42,7 @@ extern int use_xdamage;
 extern int xdamage_present;
 extern int xdamage_max_area;
 extern double xdamage_memory;
+extern int xdamage_rects;
 extern int xdamage_tile_count, xdamage_direct_count;
 extern double xdamage_scheduled_mark;
 extern double xdamage_crazy_time;
@@ -56,6 +57,8 @@ extern void clear_xdamage_mark_region(sraRegionPtr markregion, int flush);
 extern int collect_non_X_xdamage(int x_in, int y_in, int w_in, int h_in, int call);
 extern int collect_xdamage(int scancnt, int call);
 extern int xdamage_hint_skip(int y);
+extern int xdamage_rects_ok(void);
+extern int xdamage_mark_tiles(void);
 extern void initialize_xdamage(void);
 extern void create_xdamage_if_needed(int force);
 extern void destroy_xdamage_if_needed(void);
@@ -388,6 +388,8 @@ static void initialize_xevents(int reset) {
 		if (guess_dm_gone(8, 45)) {
 			X_LOCK;
 			selwin = XCreateSimpleWindow(dpy, rootwin, 3, 2, 1, 1, 0, 0, 0);
+			/* for the chunks of INCR selection transfers */
+			XSelectInput_wr(dpy, selwin, PropertyChangeMask);
 			X_UNLOCK;
 			did_xcreate_simple_window = 1;
 			if (! quiet) rfbLog("created selwin: 0x%lx\n", selwin);
@@ -912,7 +914,9 @@ void sync_tod_with_servertime(void) {
 
 	XSync(dpy, False);
 	while (XCheckTypedEvent(dpy, PropertyNotify, &xev)) {
-		set_prop_atom(xev.xproperty.atom);
+		if (! sel_incr_event(&xev)) {
+			set_prop_atom(xev.xproperty.atom);
+		}
 	}
 
 	snprintf(diff, sizeof diff, "%d/%08d/%lu/%.6f", (int) getpid(), seq++,
@@ -926,6 +930,9 @@ void sync_tod_with_servertime(void) {
 		
 		for (k=0; k < 5; k++) {
 			while (XCheckTypedEvent(dpy, PropertyNotify, &xev)) {
+				if (sel_incr_event(&xev)) {
+					continue;
+				}
 				if (xev.xproperty.atom == ticker_atom) {
 					double stime;
 					
@@ -1353,7 +1360,10 @@ void check_xevents(int reset) {
 		/* to avoid piling up between calls, read all PropertyNotify now */
 		do {
 			if (xev.type == PropertyNotify) {
-				if (xev.xproperty.atom == XA_CUT_BUFFER0) {
+				if (sel_incr_event(&xev)) {
+					/* a chunk of an INCR selection transfer */
+					;
+				} else if (xev.xproperty.atom == XA_CUT_BUFFER0) {
 					got_cutbuffer++;
 				} else if (vnc_connect && vnc_connect_prop != None
 				    && xev.xproperty.atom == vnc_connect_prop) {
@@ -1516,7 +1526,7 @@ void check_xevents(int reset) {
 			atom = clipboard_atom;
 			req = "CLIPBOARD";
 		}
-		if (which != 0 && ! own && have_clients &&
+		if (which != 0 && ! own && have_clients && ! sel_incr_busy() &&
 		    XGetSelectionOwner(dpy, atom) != None && selwin != None) {
 			XConvertSelection(dpy, atom, XA_STRING, XA_STRING,
 			    selwin, CurrentTime);
@@ -41,6 +41,11 @@ so, delete this exception statement from your version.
 #include "macosx.h"
 #include "xi2_devices.h"
 #include "xwrappers.h"
+#include "simd.h"
+
+#if HAVE_PREADV
+#include <sys/uio.h>
+#endif
 
 int xshm_present = 0;
 int xshm_opcode = 0;
@@ -53,6 +58,7 @@ int xinerama_present = 0;
 int keycode_state[256];
 int rootshift = 0;
 int clipshift = 0;
+int raw_fb_nopread = 0;
 
 
 int guess_bits_per_color(int bits_per_pixel);
@@ -123,7 +129,10 @@ Status XQueryTree_wr(Display *display, Window w, Window *root_return,
 int XFree_wr(void *data);
 int XSelectInput_wr(Display *display, Window w, long event_mask);
 
+int raw_fb_read_rows(char *dst, int dst_bpl, off_t off, int sz, int bpl,
+    int h);
 void copy_raw_fb(XImage *dest, int x, int y, unsigned int w, unsigned int h);
+static size_t read_full(char *buf, size_t len, off_t off);
 static void upup_downdown_warning(KeyCode key, Bool down);
 
 /* 
@@ -428,14 +437,158 @@ XImage *XCreateImage_wr(Display *disp, Visual *visual, unsigned int depth,
 #endif	/* NO_X11 */
 }
 
+/*
+ * Seek mode -rawfb (file:, devices that cannot be mmap(2)'d, FIFOs) used
+ * an lseek(2) and a read(2) or two per scanline.  These read whole rects
+ * with pread(2) so the file offset never has to be moved, and, when the
+ * rows are not contiguous in the file, preadv(2) RAWFB_IOV/2 rows at a time
+ * with the bytes between them dropped into a scratch buffer.  Pipes and
+ * FIFOs cannot pread, for them the rows are read back to back as before.
+ */
+#define RAWFB_IOV	256
+#define RAWFB_GAP_MAX	65536
+
+static size_t read_full(char *buf, size_t len, off_t off) {
+	size_t del = 0;
+	ssize_t n;
+
+	while (del < len) {
+		if (raw_fb_nopread) {
+			n = read(raw_fb_fd, buf + del, len - del);
+		} else {
+			n = pread(raw_fb_fd, buf + del, len - del,
+			    off + (off_t) del);
+		}
+		if (n > 0) {
+			del += n;
+		} else if (n == 0) {
+			break;
+		} else if (errno == ESPIPE && ! raw_fb_nopread) {
+			raw_fb_nopread = 1;
+		} else if (errno != EINTR && errno != EAGAIN) {
+			break;
+		}
+	}
+	return del;
+}
+
+/*
+ * Read h rows of sz bytes, bpl apart in the file starting at off, into
+ * dst (dst_bpl apart).  Returns the number of rows read completely.
+ */
+int raw_fb_read_rows(char *dst, int dst_bpl, off_t off, int sz, int bpl,
+    int h) {
+	int line = 0;
+#if HAVE_PREADV
+	static char *gap_buf = NULL;
+	static int gap_len = 0;
+	struct iovec iov[RAWFB_IOV];
+	int gap = bpl - sz;
+#endif
+
+	if (h <= 0 || sz <= 0) {
+		return 0;
+	}
+	if (raw_fb_nopread) {
+		/* not seekable: rows are consecutive in the stream */
+		bpl = sz;
+	}
+	if (bpl == sz && dst_bpl == sz) {
+		size_t len = (size_t) sz * h;
+		return (int) (read_full(dst, len, off) / sz);
+	}
+
+#if HAVE_PREADV
+	if (gap >= 0 && gap <= RAWFB_GAP_MAX && ! raw_fb_nopread
+	    && (gap > gap_len || gap_buf == NULL)) {
+		if (gap_buf) {
+			free(gap_buf);
+		}
+		gap_buf = (char *) malloc((size_t) gap + 1);
+		gap_len = gap_buf ? gap : 0;
+	}
+	/* no gap_buf: fall through to the row by row reads below */
+	if (gap >= 0 && gap <= RAWFB_GAP_MAX && ! raw_fb_nopread && gap_buf) {
+		while (line < h) {
+			int i, k, nv = 0, nl = h - line;
+			size_t want = 0;
+			ssize_t n;
+
+			if (nl > RAWFB_IOV/2) {
+				nl = RAWFB_IOV/2;
+			}
+			for (k=0; k < nl; k++) {
+				iov[nv].iov_base = dst + (size_t) (line+k) * dst_bpl;
+				iov[nv].iov_len = sz;
+				want += sz;
+				nv++;
+				if (gap && k < nl - 1) {
+					iov[nv].iov_base = gap_buf;
+					iov[nv].iov_len = gap;
+					want += gap;
+					nv++;
+				}
+			}
+			n = preadv(raw_fb_fd, iov, nv,
+			    off + (off_t) line * bpl);
+			if (n == (ssize_t) want) {
+				line += nl;
+				continue;
+			}
+			if (n < 0 && errno != EINTR && errno != EAGAIN
+			    && errno != ESPIPE) {
+				return line;
+			}
+			/* short or failed: finish this batch row by row */
+			for (i=0; i < nl; i++) {
+				size_t at = (size_t) i * bpl;
+				size_t got = 0;
+
+				if (n > 0 && (size_t) n > at) {
+					got = (size_t) n - at;
+					if (got >= (size_t) sz) {
+						continue;
+					}
+				}
+				if (read_full(dst + (size_t) (line+i) * dst_bpl
+				    + got, sz - got, off + (off_t) (line+i) * bpl
+				    + got) != sz - got) {
+					return line + i;
+				}
+				if (raw_fb_nopread) {
+					/* turned out to be a pipe */
+					line += i + 1;
+					break;
+				}
+			}
+			if (raw_fb_nopread) {
+				break;
+			}
+			line += nl;
+		}
+		if (! raw_fb_nopread) {
+			return line;
+		}
+	}
+#endif
+
+	for (; line < h; line++) {
+		if (read_full(dst + (size_t) line * dst_bpl, sz,
+		    off + (off_t) line * bpl) != (size_t) sz) {
+			break;
+		}
+	}
+	return line;
+}
+
 static void copy_raw_fb_low_bpp(XImage *dest, int x, int y, unsigned int w,
     unsigned int h) {
-	char *src, *dst;
+	char *src, *dst, *row;
 	unsigned int line;
 	static char *buf = NULL;
 	static int buflen = -1;
 	int bpl = wdpy_x * raw_fb_native_bpp / 8;
-	int n, ix, len, del, sz = wdpy_x * raw_fb_expand_bytes;
+	int ix, sz = wdpy_x * raw_fb_expand_bytes;
 
 	unsigned int rm_n = raw_fb_native_red_mask;
 	unsigned int gm_n = raw_fb_native_green_mask;
@@ -472,6 +625,10 @@ static void copy_raw_fb_low_bpp(XImage *dest, int x, int y, unsigned int w,
 		}
 	}
 
+	if (raw_fb_seek && bpl * (int) h > sz) {
+		/* seek mode reads all the lines at once */
+		sz = bpl * h;
+	}
 	if (sz > buflen || buf == NULL) {
 		if (buf) {
 			free(buf);
@@ -503,6 +660,13 @@ static void copy_raw_fb_low_bpp(XImage *dest, int x, int y, unsigned int w,
 if (0) fprintf(stderr, "x=%d y=%d w=%d h=%d bpl=%d d_bpl=%d-%dx%dx%d/%d %p\n",
     x, y, w, h, bpl, dest->bytes_per_line, dest->width, dest->height, dest->bits_per_pixel, dest->depth, dst);
 
+	if (raw_fb_seek) {
+		/* the lines are contiguous: one read */
+		raw_fb_read_rows(buf, bpl, (off_t) (raw_fb_offset + bpl*y),
+		    bpl, bpl, h);
+	}
+
+	row = buf;
 	for (line = 0; line < h; line++) {
 
 		if (! raw_fb_seek) {
@@ -511,26 +675,7 @@ if (0) fprintf(stderr, "x=%d y=%d w=%d h=%d bpl=%d d_bpl=%d-%dx%dx%d/%d %p\n",
 
 			memcpy(buf, src, bpl);
 		} else {
-			/* lseek */
-			off_t off;
-			off = (off_t) (raw_fb_offset + bpl*(y+line));
-
-			lseek(raw_fb_fd, off, SEEK_SET);
-
-			len = bpl;
-			del = 0;
-			while (len > 0) {
-				n = read(raw_fb_fd, buf + del, len);
-
-				if (n > 0) {
-					del += n;
-					len -= n;
-				} else if (n == 0) {
-					break;
-				} else if (errno != EINTR && errno != EAGAIN) {
-					break;
-				}
-			}
+			row = buf + bpl*line;
 		}
 		for (ix = 0; ix < (int) w; ix++) {
 			int bx = (x + ix) * raw_fb_native_bpp;
@@ -538,7 +683,7 @@ if (0) fprintf(stderr, "x=%d y=%d w=%d h=%d bpl=%d d_bpl=%d-%dx%dx%d/%d %p\n",
 			int br = bx - ib * 8;
 			unsigned char val;
 
-			val = *((unsigned char*) (buf + ib));
+			val = *((unsigned char*) (row + ib));
 
 			val = msk[br] & val;
 			val = val >> br;
@@ -585,43 +730,23 @@ if (0) fprintf(stderr, "x=%d y=%d w=%d h=%d bpl=%d d_bpl=%d-%dx%dx%d/%d %p\n",
 static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
     unsigned int h) {
 	/*
-	 * kludge to read 1 byte at a time and dynamically transform
-	 * 24bpp -> 32bpp by inserting a extra 0 byte into dst.
+	 * dynamically transform 24bpp -> 32bpp by inserting an extra
+	 * 0 byte per pixel into dst (fb_pack24to32).  Only seek mode
+	 * needs the buffer.
 	 */
-	char *src, *dst;
+	char *dst, *row;
 	unsigned int line;
 	static char *buf = NULL;
 	static int buflen = -1;
 	int bpl = wdpy_x * 3;	/* pixelsize == 3 */
-	int LE, n, stp, len, del, sz = w * 3;
+	int sz = w * 3;
 	int insert_zeroes = 1;
 
 #define INSERT_ZEROES  \
-	len = sz; \
-	del = 0; \
-	stp = 0; \
-	while (len > 0) { \
-		if (insert_zeroes && (del - LE) % 4 == 0) { \
-			*(dst + del) = 0; \
-			del++; \
-		} \
-		*(dst + del) = *(buf + stp); \
-		del++; \
-		len--; \
-		stp++; \
-	}
-
-	if (rfbEndianTest) {
-		LE = 3;	/* little endian */
-	} else {
-		LE = 0; /* big endian */
-	}
-
-	if (sz > buflen || buf == NULL) {
-		if (buf) {
-			free(buf);
-		}
-		buf = (char *) malloc((size_t)4*(sz + 1000));
+	if (insert_zeroes) { \
+		fb_pack24to32(dst, row, w); \
+	} else { \
+		memcpy(dst, row, sz); \
 	}
 
 	if (clipshift && ! use_snapfb) {
@@ -631,14 +756,12 @@ static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
 
 	if (use_snapfb && dest != snap) {
 		/* snapfb src */
-		src = snap->data + snap->bytes_per_line*y + 3*x;
+		row = snap->data + snap->bytes_per_line*y + 3*x;
 		dst = dest->data;
 		for (line = 0; line < h; line++) {
-			memcpy(buf, src, sz);
-
 			INSERT_ZEROES
 
-			src += snap->bytes_per_line;
+			row += snap->bytes_per_line;
 			dst += dest->bytes_per_line;
 		}
 
@@ -648,7 +771,7 @@ static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
 		if (clipshift && wdpy_x != cdpy_x) {
 			bpl = wdpy_x * 3;
 		}
-		src = raw_fb_addr + raw_fb_offset + bpl*y + 3*x;
+		row = raw_fb_addr + raw_fb_offset + bpl*y + 3*x;
 		dst = dest->data;
 
 		if (use_snapfb && dest == snap) {
@@ -661,16 +784,14 @@ static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
 		}
 
 		for (line = 0; line < h; line++) {
-			memcpy(buf, src, sz);
-
 			INSERT_ZEROES
 
-			src += bpl;
+			row += bpl;
 			dst += dest->bytes_per_line;
 		}
 
 	} else {
-		/* lseek */
+		/* lseek: read the whole rect, then expand each row */
 		off_t off;
 		bpl = raw_fb_bytes_per_line;
 		if (clipshift && wdpy_x != cdpy_x) {
@@ -678,7 +799,14 @@ static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
 		}
 		off = (off_t) (raw_fb_offset + bpl*y + 3*x);
 
-		lseek(raw_fb_fd, off, SEEK_SET);
+		if (sz * (int) h > buflen || buf == NULL) {
+			if (buf) {
+				free(buf);
+			}
+			buflen = sz * h + 1000;
+			buf = (char *) malloc((size_t) buflen);
+		}
+		raw_fb_read_rows(buf, sz, off, sz, bpl, h);
 		dst = dest->data;
 
 		if (use_snapfb && dest == snap) {
@@ -690,28 +818,11 @@ static void copy_raw_fb_24_to_32(XImage *dest, int x, int y, unsigned int w,
 			insert_zeroes = 0;
 		}
 
+		row = buf;
 		for (line = 0; line < h; line++) {
-			len = sz;
-			del = 0;
-			while (len > 0) {
-				n = read(raw_fb_fd, buf + del, len);
-
-				if (n > 0) {
-					del += n;
-					len -= n;
-				} else if (n == 0) {
-					break;
-				} else if (errno != EINTR && errno != EAGAIN) {
-					break;
-				}
-			}
-
 			INSERT_ZEROES
 
-			if (bpl > sz) {
-				off = (off_t) (bpl - sz);
-				lseek(raw_fb_fd, off, SEEK_CUR);
-			}
+			row += sz;
 			dst += dest->bytes_per_line;
 		}
 	}
@@ -790,7 +901,7 @@ if (db) fprintf(stderr, "bpl: %d, dest->bytes_per_line: %d, w: %d h: %d dpy_x: %
 
 	} else {
 		/* lseek */
-		int n, len, del, sz = w * pixelsize;
+		int sz = w * pixelsize;
 		off_t off;
 		int bpl = raw_fb_bytes_per_line;
 
@@ -800,32 +911,10 @@ if (db) fprintf(stderr, "bpl: %d, dest->bytes_per_line: %d, w: %d h: %d dpy_x: %
 
 		off = (off_t) (raw_fb_offset + bpl*y + pixelsize*x);
 
-		lseek(raw_fb_fd, off, SEEK_SET);
-		dst = dest->data;
-
 if (db) fprintf(stderr, "lseek 0 ps: %d  sz: %d off: %d bpl: %d\n", pixelsize, sz, (int) off, bpl);
 
-		for (line = 0; line < h; line++) {
-			len = sz;
-			del = 0;
-			while (len > 0) {
-				n = read(raw_fb_fd, dst + del, len);
-
-				if (n > 0) {
-					del += n;
-					len -= n;
-				} else if (n == 0) {
-					break;
-				} else if (errno != EINTR && errno != EAGAIN) {
-					break;
-				}
-			}
-			if (bpl > sz) {
-				off = (off_t) (bpl - sz);
-				lseek(raw_fb_fd, off, SEEK_CUR);
-			}
-			dst += dest->bytes_per_line;
-		}
+		raw_fb_read_rows(dest->data, dest->bytes_per_line, off, sz,
+		    bpl, h);
 	}
 }
 
@@ -50,6 +50,7 @@ extern int xinerama_present;
 extern int keycode_state[];
 extern int rootshift;
 extern int clipshift;
+extern int raw_fb_nopread;
 
 
 extern int guess_bits_per_color(int bits_per_pixel);
@@ -78,6 +79,8 @@ extern XImage *XCreateImage_wr(Display *disp, Visual *visual, unsigned int depth
     int format, int offset, char *data, unsigned int width,
     unsigned int height, int bitmap_pad, int bytes_per_line);
 extern void copy_image(XImage *dest, int x, int y, unsigned int w, unsigned int h);
+extern int raw_fb_read_rows(char *dst, int dst_bpl, off_t off, int sz,
+    int bpl, int h);
 extern void copy_raw_fb(XImage *dest, int x, int y, unsigned int w, unsigned int h);
 extern void init_track_keycode_state(void);
 